@@ -0,0 +1,227 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  */
+
+/*
+ * Hashing building blocks, each one timed on its own - the keccak front end and keccakf, the
+ * scratchpad explode and implode, the four extra_hashes finalizers, a single soft_aesenc, the hex
+ * codec and the stratum job parser. The main loop can't be pulled out of a hash without changing
+ * it, so that one comes from the kernel_profile builds of the real kernels.
+ *
+ * Every block of calls is repeated and we keep the fastest, cycles are TSC (reference) cycles.
+ * The first argument is how long a block should take in ms (100 by default).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "../crypto/cryptonight_aesni.h"
+#include "../cpu_features.h"
+#include "../hexcodec.h"
+#include "../stratum.h"
+
+static volatile uint64_t iSink;
+static double fBlockMs = 100.0;
+
+struct timing
+{
+	double fCycles; // per call
+	double fNs;
+};
+
+template <typename F>
+static timing time_block(F& fn, size_t iIters)
+{
+	using namespace std::chrono;
+	auto start = steady_clock::now();
+	uint64_t iStart = __rdtsc();
+	for(size_t i = 0; i < iIters; i++)
+		fn(i);
+	uint64_t iTicks = __rdtsc() - iStart;
+	double fNs = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	return { (double)iTicks / iIters, fNs / iIters };
+}
+
+// Sizes the block to fBlockMs, then keeps the best of five
+template <typename F>
+static void run(const char* sName, size_t iBytes, F fn)
+{
+	size_t iIters = 1;
+	timing t = time_block(fn, iIters);
+	while(t.fNs * iIters < fBlockMs * 1e6 && iIters < (size_t(1) << 30))
+	{
+		iIters *= 2;
+		t = time_block(fn, iIters);
+	}
+
+	for(size_t r = 0; r < 5; r++)
+	{
+		timing n = time_block(fn, iIters);
+		if(n.fCycles < t.fCycles)
+			t = n;
+	}
+
+	if(iBytes != 0)
+		printf("| %-26s | %7u | %13.1f | %9.2f | %12.1f |\n", sName, (unsigned)iBytes, t.fCycles, t.fCycles / iBytes, t.fNs);
+	else
+		printf("| %-26s | %7s | %13.1f | %9s | %12.1f |\n", sName, "-", t.fCycles, "-", t.fNs);
+}
+
+typedef void (*prof_fn)(const void*, size_t, void*, cryptonight_ctx*, uint64_t*);
+
+// Main loop ticks as the profiled kernel sees them, averaged over iHashes
+static void run_main_loop(const char* sName, prof_fn fn, cryptonight_ctx* ctx, size_t iHashes)
+{
+	uint8_t bBlob[76] = {0};
+	uint8_t bResult[32];
+	uint64_t iPhases[CN_PHASE_CNT];
+
+	fn(bBlob, sizeof(bBlob), bResult, ctx, iPhases); // Warm up
+	memset(iPhases, 0, sizeof(iPhases));
+	for(size_t i = 0; i < iHashes; i++)
+	{
+		bBlob[39] = (uint8_t)i;
+		fn(bBlob, sizeof(bBlob), bResult, ctx, iPhases);
+	}
+
+	double fCycles = (double)iPhases[CN_PHASE_MAIN] / iHashes;
+	printf("| %-26s | %7s | %13.1f | %9s | %12s |\n", sName, "-", fCycles, "-", "-");
+	printf("|   per iteration            | %7s | %13.2f | %9s | %12s |\n", "-", fCycles / 0x40000, "-", "-");
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1)
+		fBlockMs = strtod(argv[1], nullptr);
+
+	alloc_msg msg = { 0 };
+	cryptonight_ctx* ctx = cryptonight_alloc_ctx(1, 0, &msg);
+	if(ctx == nullptr && (ctx = cryptonight_alloc_ctx(0, 0, &msg)) == nullptr)
+	{
+		printf("MEMORY ALLOC FAILED: %s\n", msg.warning);
+		return 1;
+	}
+	bool bLargePages = ctx->ctx_info[0] == 1;
+	bool bHaveAes = cpu_has_aes();
+
+	uint8_t bBlob[76];
+	for(size_t i = 0; i < sizeof(bBlob); i++)
+		bBlob[i] = (uint8_t)rand();
+
+	printf("Cryptonight-lite building blocks, %s scratchpad, %.0f ms blocks\n", bLargePages ? "large page" : "normal page", fBlockMs);
+	if(!bHaveAes)
+		printf("No hardware AES, only the soft AES kernels are timed.\n");
+	printf("| Operation                  |   Bytes |   Cycles/call |  Cycles/B |      ns/call |\n");
+
+	run("keccak (76 B blob)", sizeof(bBlob), [&](size_t i) {
+		bBlob[39] = (uint8_t)i;
+		keccak(bBlob, sizeof(bBlob), ctx->hash_state, 200);
+		iSink = ctx->hash_state[0];
+	});
+
+	keccak(bBlob, sizeof(bBlob), ctx->hash_state, 200);
+	run("keccakf (24 rounds)", 200, [&](size_t) {
+		keccakf((uint64_t*)ctx->hash_state, 24);
+		iSink = ctx->hash_state[0];
+	});
+
+	if(bHaveAes)
+	{
+		run("cn_explode_scratchpad", MEMORY, [&](size_t) {
+			cn_explode_scratchpad<MEMORY, false>((__m128i*)ctx->hash_state, (__m128i*)ctx->long_state);
+			iSink = ctx->long_state[0];
+		});
+	}
+
+	run("cn_explode_scratchpad soft", MEMORY, [&](size_t) {
+		cn_explode_scratchpad<MEMORY, true>((__m128i*)ctx->hash_state, (__m128i*)ctx->long_state);
+		iSink = ctx->long_state[0];
+	});
+
+	if(bHaveAes)
+	{
+		run("cn_implode_scratchpad", MEMORY, [&](size_t) {
+			cn_implode_scratchpad<MEMORY, false>((__m128i*)ctx->long_state, (__m128i*)ctx->hash_state);
+			iSink = ctx->hash_state[0];
+		});
+	}
+
+	run("cn_implode_scratchpad soft", MEMORY, [&](size_t) {
+		cn_implode_scratchpad<MEMORY, true>((__m128i*)ctx->long_state, (__m128i*)ctx->hash_state);
+		iSink = ctx->hash_state[0];
+	});
+
+	// The AES-NI kernels would die on SIGILL without it
+	if(bHaveAes)
+	{
+		run_main_loop("main loop", cryptonight_hash_ctx_prof, ctx, 64);
+		run_main_loop("main loop no prefetch", cryptonight_hash_ctx_np_prof, ctx, 64);
+	}
+	run_main_loop("main loop soft", cryptonight_hash_ctx_soft_prof, ctx, 16);
+
+	const char* sFinalizers[4] = { "extra_hashes[0] blake256", "extra_hashes[1] groestl", "extra_hashes[2] jh", "extra_hashes[3] skein" };
+	for(size_t h = 0; h < 4; h++)
+	{
+		char bOut[32];
+		run(sFinalizers[h], 200, [&](size_t i) {
+			ctx->hash_state[1] = (uint8_t)i;
+			extra_hashes[h](ctx->hash_state, 200, bOut);
+			iSink = bOut[0];
+		});
+	}
+
+	__m128i x = _mm_loadu_si128((const __m128i*)bBlob);
+	__m128i key = _mm_loadu_si128((const __m128i*)(bBlob + 16));
+	run("soft_aesenc (dependent)", 16, [&](size_t) {
+		x = soft_aesenc(x, key);
+	});
+	iSink = _mm_cvtsi128_si64(x);
+
+	char sHex[153];
+	uint8_t bOut[76];
+	hex_encode(bBlob, sizeof(bBlob), sHex);
+	sHex[152] = '\0';
+	run("hex2bin (152 chars)", 152, [&](size_t) {
+		hex_decode(sHex, 152, bOut);
+		iSink = bOut[0];
+	});
+
+	char sResult[64];
+	run("bin2hex (32 B result)", 32, [&](size_t i) {
+		bOut[0] = (uint8_t)i;
+		hex_encode(bOut, 32, sResult);
+		iSink = sResult[0];
+	});
+
+	// The line is parsed in place, so every call starts with a fresh copy of it
+	char sJob[512], sLine[512];
+	int iJobLen = snprintf(sJob, sizeof(sJob), "{\"jsonrpc\":\"2.0\",\"method\":\"job\",\"params\":{\"blob\":\"%s\","
+		"\"job_id\":\"A5Gw1RqyGgDDFhtWz3Lnxo8fnKBX\",\"target\":\"b88d0600\"}}", sHex);
+	stratum_parser parser;
+	pool_job* job = pool_job::alloc();
+	job_ref oJob(job);
+	run("job parse + decode", iJobLen, [&](size_t) {
+		memcpy(sLine, sJob, iJobLen + 1);
+		stratum_msg msg;
+		if(!parser.parse(sLine, msg) || stratum_parser::decode_job(msg.oParams, *job) != nullptr)
+			abort();
+		iSink = job->iTarget;
+	});
+
+	cryptonight_free_ctx(ctx);
+	return 0;
+}
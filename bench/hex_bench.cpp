@@ -0,0 +1,126 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  */
+
+/*
+ * Hex codec microbenchmark - a job blob decode (76 bytes, 152 characters) and a result
+ * encode (32 bytes), vector path against the scalar one. Outputs are compared first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "../hexcodec.h"
+
+typedef bool (*decode_fn)(const char*, size_t, uint8_t*);
+typedef void (*encode_fn)(const uint8_t*, size_t, char*);
+
+static volatile uint8_t iSink;
+
+static bool check_codecs()
+{
+	const char* sHex = "0123456789abcdefABCDEF";
+	char sIn[512];
+	uint8_t bA[256], bB[256];
+	char sA[512], sB[512];
+
+	for(size_t n = 0; n < 5000; n++)
+	{
+		size_t len = (rand() % 256) * 2;
+		for(size_t i = 0; i < len; i++)
+			sIn[i] = sHex[rand() % 22];
+
+		// Every now and then poison one character
+		if(len > 0 && (n % 4) == 0)
+			sIn[rand() % len] = (char)(rand() % 256);
+
+		bool bRa = hex_decode(sIn, len, bA);
+		bool bRb = hex_decode_scalar(sIn, len, bB);
+		if(bRa != bRb || (bRa && memcmp(bA, bB, len / 2) != 0))
+		{
+			printf("hex_decode mismatch at len %u\n", (unsigned)len);
+			return false;
+		}
+
+		size_t blen = len / 2;
+		for(size_t i = 0; i < blen; i++)
+			bA[i] = (uint8_t)rand();
+
+		hex_encode(bA, blen, sA);
+		hex_encode_scalar(bA, blen, sB);
+		if(memcmp(sA, sB, blen * 2) != 0)
+		{
+			printf("hex_encode mismatch at len %u\n", (unsigned)blen);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static double bench_decode(decode_fn fn, const char* in, size_t len, size_t iters)
+{
+	uint8_t out[128];
+	using namespace std::chrono;
+	auto start = high_resolution_clock::now();
+	for(size_t i = 0; i < iters; i++)
+	{
+		fn(in, len, out);
+		iSink = out[i % (len / 2)];
+	}
+	return (double)duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / iters;
+}
+
+static double bench_encode(encode_fn fn, const uint8_t* in, size_t len, size_t iters)
+{
+	char out[256];
+	using namespace std::chrono;
+	auto start = high_resolution_clock::now();
+	for(size_t i = 0; i < iters; i++)
+	{
+		fn(in, len, out);
+		iSink = out[i % (len * 2)];
+	}
+	return (double)duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / iters;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t iters = 10000000;
+	if(argc > 1)
+		iters = strtoul(argv[1], nullptr, 10);
+
+	if(!check_codecs())
+		return 1;
+
+	char sBlob[153];
+	uint8_t bResult[32];
+	for(size_t i = 0; i < 32; i++)
+		bResult[i] = (uint8_t)rand();
+	for(size_t i = 0; i < 152; i++)
+		sBlob[i] = "0123456789abcdef"[rand() % 16];
+	sBlob[152] = '\0';
+
+	printf("Hex codec: %s, %llu iterations\n", hex_codec_name(), (unsigned long long)iters);
+	printf("| Operation            | scalar ns | %6s ns |\n", hex_codec_name());
+	printf("| decode blob (152 ch) | %9.2f | %9.2f |\n",
+		bench_decode(hex_decode_scalar, sBlob, 152, iters), bench_decode(hex_decode, sBlob, 152, iters));
+	printf("| encode result (32 B) | %9.2f | %9.2f |\n",
+		bench_encode(hex_encode_scalar, bResult, 32, iters), bench_encode(hex_encode, bResult, 32, iters));
+
+	return 0;
+}
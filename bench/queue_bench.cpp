@@ -0,0 +1,107 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  */
+
+/*
+ * Executor queue microbenchmark - N producer threads (64 by default, like a big miner box) push
+ * executor events as fast as they can while one consumer drains them. We time every push and
+ * report the enqueue latency percentiles, thdq (mutex + condition variable) against mpscq, and mpscq
+ * again with the consumer taking everything at once with pop_all() like the executor does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#include "../msgstruct.h"
+#include "../thdq.hpp"
+#include "../mpscq.hpp"
+#include "../histogram.h"
+
+// drain(q) takes events off the queue and returns how many
+template <typename Q, typename D>
+static void run(const char* sName, size_t iThreads, size_t iPushes, D drain)
+{
+	Q q;
+	std::atomic<bool> bGo(false);
+	std::vector<histogram> vHist(iThreads);
+	std::vector<std::thread> vThd;
+
+	std::thread consumer([&q, &drain, iThreads, iPushes]() {
+		size_t iLeft = iThreads * iPushes;
+		while(iLeft > 0)
+			iLeft -= drain(q);
+	});
+
+	for(size_t t=0; t < iThreads; t++)
+	{
+		vThd.emplace_back([&q, &bGo, &vHist, t, iPushes]() {
+			using namespace std::chrono;
+			while(!bGo.load()) {}
+
+			for(size_t i=0; i < iPushes; i++)
+			{
+				auto start = steady_clock::now();
+				q.push(ex_event(EV_PERF_TICK, t));
+				vHist[t].add((uint32_t)duration_cast<nanoseconds>(steady_clock::now() - start).count());
+			}
+		});
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	bGo = true;
+	for(std::thread& thd : vThd)
+		thd.join();
+	consumer.join();
+	double fSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	histogram all;
+	for(histogram& h : vHist)
+		all.merge(h);
+
+	printf("| %-11s | %7u | %7u | %7u | %10u | %9.2f |\n", sName, all.percentile(50), all.percentile(99),
+		all.percentile(99.9), all.max(), (double)(iThreads * iPushes) / fSec / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t iThreads = 64;
+	size_t iPushes = 100000;
+	if(argc > 1)
+		iThreads = strtoul(argv[1], nullptr, 10);
+	if(argc > 2)
+		iPushes = strtoul(argv[2], nullptr, 10);
+
+	printf("Executor queue, %u producers, %u pushes each, enqueue latency in ns\n", (unsigned)iThreads, (unsigned)iPushes);
+	printf("| Queue       |     p50 |     p99 |   p99.9 |        max |   Mpush/s |\n");
+	run<thdq<ex_event>>("thdq", iThreads, iPushes, [](thdq<ex_event>& q) {
+		q.pop();
+		return size_t(1);
+	});
+	run<mpscq<ex_event>>("mpscq", iThreads, iPushes, [](mpscq<ex_event>& q) {
+		q.pop();
+		return size_t(1);
+	});
+
+	std::vector<ex_event> vEvents;
+	run<mpscq<ex_event>>("mpscq batch", iThreads, iPushes, [&vEvents](mpscq<ex_event>& q) {
+		q.pop_all(vEvents);
+		return vEvents.size();
+	});
+	return 0;
+}
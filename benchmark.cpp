@@ -0,0 +1,337 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "benchmark.h"
+#include "minethd.h"
+#include "console.h"
+#include "tsc_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#endif // _WIN32
+
+const char* benchmark::usage()
+{
+	return "benchmark_mode CONFIG [--duration S] [--warmup S] [--trials N] [--sweep] [--json FILE]";
+}
+
+static bool parse_uint(const char* sArg, const char* sVal, uint32_t& iOut, uint32_t iMin)
+{
+	char* sEnd;
+	unsigned long iVal = strtoul(sVal, &sEnd, 10);
+	if(*sVal == '\0' || *sEnd != '\0' || iVal < iMin || iVal > 0xFFFFFFFF)
+	{
+		printer::inst()->print_msg(L0, "Invalid value for %s: %s", sArg, sVal);
+		return false;
+	}
+	iOut = (uint32_t)iVal;
+	return true;
+}
+
+bool benchmark::parse_args(int argc, char* argv[], options& opt)
+{
+	for(int i = 0; i < argc; i++)
+	{
+		const char* sArg = argv[i];
+		bool bHaveVal = i + 1 < argc;
+
+		if(strcasecmp(sArg, "--sweep") == 0)
+			opt.bSweep = true;
+		else if(strcasecmp(sArg, "--duration") == 0 && bHaveVal)
+		{
+			if(!parse_uint(sArg, argv[++i], opt.iDuration, 1))
+				return false;
+		}
+		else if(strcasecmp(sArg, "--warmup") == 0 && bHaveVal)
+		{
+			if(!parse_uint(sArg, argv[++i], opt.iWarmup, 0))
+				return false;
+		}
+		else if(strcasecmp(sArg, "--trials") == 0 && bHaveVal)
+		{
+			if(!parse_uint(sArg, argv[++i], opt.iTrials, 1))
+				return false;
+		}
+		else if(strcasecmp(sArg, "--json") == 0 && bHaveVal)
+			opt.sJsonFile = argv[++i];
+		else
+		{
+			printer::inst()->print_msg(L0, "Unknown or incomplete benchmark option %s", sArg);
+			printer::inst()->print_msg(L0, "Usage: %s", usage());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static double median(std::vector<double> v)
+{
+	if(v.empty())
+		return 0.0;
+
+	std::sort(v.begin(), v.end());
+	size_t n = v.size();
+	return (n % 2) != 0 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+static double mean(const std::vector<double>& v)
+{
+	double fSum = 0.0;
+	for(double f : v)
+		fSum += f;
+	return v.empty() ? 0.0 : fSum / v.size();
+}
+
+// Sample standard deviation, zero with fewer than two trials
+static double stddev(const std::vector<double>& v)
+{
+	if(v.size() < 2)
+		return 0.0;
+
+	double fMean = mean(v), fSum = 0.0;
+	for(double f : v)
+		fSum += (f - fMean) * (f - fMean);
+	return sqrt(fSum / (v.size() - 1));
+}
+
+std::vector<benchmark::layout> benchmark::make_layouts(bool bSweep)
+{
+	std::vector<layout> vLayouts;
+	size_t iThreads = jconf::inst()->GetThreadCount();
+
+	layout conf;
+	conf.sName = "config";
+	conf.vThd.resize(iThreads);
+	for(size_t i = 0; i < iThreads; i++)
+		jconf::inst()->GetThreadConfig(i, conf.vThd[i]);
+	vLayouts.push_back(conf);
+
+	if(!bSweep)
+		return vLayouts;
+
+	// Same rules as the config checks - both need AES-NI, and no_prefetch is pointless in slow memory
+	bool bHaveAes = jconf::inst()->HaveHardwareAes();
+	bool bNoPrefetchOk = bHaveAes && jconf::inst()->GetSlowMemSetting() != jconf::always_use;
+
+	const struct { const char* sName; bool bDoubleMode; bool bNoPrefetch; } kernels[] = {
+		{ "single", false, false },
+		{ "single_noprefetch", false, true },
+		{ "double", true, false }
+	};
+
+	for(const auto& k : kernels)
+	{
+		if((k.bNoPrefetch && !bNoPrefetchOk) || (k.bDoubleMode && !bHaveAes))
+			continue;
+
+		for(size_t n = 1; n <= iThreads; n = (n * 2 <= iThreads || n == iThreads) ? n * 2 : iThreads)
+		{
+			layout l;
+			char buffer[64];
+			snprintf(buffer, sizeof(buffer), "%s_x%u", k.sName, (unsigned)n);
+			l.sName = buffer;
+			l.vThd.resize(n);
+			for(size_t i = 0; i < n; i++)
+			{
+				l.vThd[i] = conf.vThd[i];
+				l.vThd[i].bDoubleMode = k.bDoubleMode;
+				l.vThd[i].bNoPrefetch = k.bNoPrefetch;
+			}
+			vLayouts.push_back(l);
+		}
+	}
+
+	return vLayouts;
+}
+
+void benchmark::run_layout(const options& opt, result& res)
+{
+	const layout& l = *res.pLayout;
+	size_t iThreads = l.vThd.size();
+
+	pool_job* job = pool_job::alloc();
+	memset(job->sJobID, 0, sizeof(job->sJobID));
+	memset(job->bWorkBlob, 0, sizeof(job->bWorkBlob));
+	job->iWorkLen = 76;
+	minethd::miner_work oWork = minethd::miner_work(job_ref(job), 0, 0, false, 0);
+	std::vector<minethd*>* pvThreads = minethd::thread_starter(oWork, l.vThd);
+
+	std::this_thread::sleep_for(std::chrono::seconds(opt.iWarmup));
+
+	res.vThdHps.assign(iThreads, std::vector<double>());
+	std::vector<uint64_t> vStartCnt(iThreads), vStartStamp(iThreads);
+	for(uint32_t t = 0; t < opt.iTrials; t++)
+	{
+		tsc_clock::calibrate();
+		for(size_t i = 0; i < iThreads; i++)
+			pvThreads->at(i)->get_stats(vStartCnt[i], vStartStamp[i]);
+
+		std::this_thread::sleep_for(std::chrono::seconds(opt.iDuration));
+		tsc_clock::calibrate();
+
+		double fTotalHps = 0.0;
+		for(size_t i = 0; i < iThreads; i++)
+		{
+			uint64_t iHashCount, iTimestamp;
+			pvThreads->at(i)->get_stats(iHashCount, iTimestamp);
+
+			// A thread that hasn't published anything since the start of the trial did nothing in it
+			double fHps = 0.0;
+			if(vStartStamp[i] != 0 && iTimestamp > vStartStamp[i])
+				fHps = (iHashCount - vStartCnt[i]) * 1000.0 / (iTimestamp - vStartStamp[i]);
+
+			res.vThdHps[i].push_back(fHps);
+			fTotalHps += fHps;
+		}
+		res.vTotalHps.push_back(fTotalHps);
+
+		printer::inst()->print_msg(L1, "%s trial %u/%u: %.1f H/s", l.sName.c_str(), t + 1, opt.iTrials, fTotalHps);
+	}
+
+	minethd::stop_threads(pvThreads);
+}
+
+void benchmark::print_result(const result& res)
+{
+	const std::vector<double>& v = res.vTotalHps;
+	printer::inst()->print_msg(L0, "%s (%u threads): median %.1f H/s, min %.1f, max %.1f, stddev %.1f",
+		res.pLayout->sName.c_str(), (unsigned)res.vThdHps.size(), median(v),
+		*std::min_element(v.begin(), v.end()), *std::max_element(v.begin(), v.end()), stddev(v));
+
+	for(size_t i = 0; i < res.vThdHps.size(); i++)
+	{
+		const jconf::thd_cfg& cfg = res.pLayout->vThd[i];
+		printer::inst()->print_msg(L0, "  Thread %u (%s%s, affinity %lld): %.1f H/s", (unsigned)i,
+			cfg.bDoubleMode ? "double" : "single", cfg.bNoPrefetch ? ", no prefetch" : "",
+			cfg.iCpuAff, median(res.vThdHps[i]));
+	}
+}
+
+static void json_stats(std::string& out, const std::vector<double>& v)
+{
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "\"min\": %.2f, \"median\": %.2f, \"mean\": %.2f, \"max\": %.2f, \"stddev\": %.2f",
+		*std::min_element(v.begin(), v.end()), median(v), mean(v), *std::max_element(v.begin(), v.end()), stddev(v));
+	out.append(buffer);
+}
+
+static void json_array(std::string& out, const std::vector<double>& v)
+{
+	char buffer[32];
+	out.append("[");
+	for(size_t i = 0; i < v.size(); i++)
+	{
+		snprintf(buffer, sizeof(buffer), i == 0 ? "%.2f" : ", %.2f", v[i]);
+		out.append(buffer);
+	}
+	out.append("]");
+}
+
+bool benchmark::write_json(const options& opt, const std::vector<result>& vRes)
+{
+	std::string out;
+	char buffer[256];
+
+	snprintf(buffer, sizeof(buffer), "{\n\t\"duration\": %u,\n\t\"warmup\": %u,\n\t\"trials\": %u,\n\t\"tsc_invariant\": %s,\n\t\"layouts\": [\n",
+		opt.iDuration, opt.iWarmup, opt.iTrials, tsc_clock::is_invariant() ? "true" : "false");
+	out.append(buffer);
+
+	for(size_t r = 0; r < vRes.size(); r++)
+	{
+		const result& res = vRes[r];
+		out.append("\t\t{\n\t\t\t\"name\": \"").append(res.pLayout->sName).append("\",\n\t\t\t\"total_hps\": {");
+		json_stats(out, res.vTotalHps);
+		out.append(", \"trials\": ");
+		json_array(out, res.vTotalHps);
+		out.append("},\n\t\t\t\"threads\": [\n");
+
+		for(size_t i = 0; i < res.vThdHps.size(); i++)
+		{
+			const jconf::thd_cfg& cfg = res.pLayout->vThd[i];
+			snprintf(buffer, sizeof(buffer), "\t\t\t\t{\"double_mode\": %s, \"no_prefetch\": %s, \"affine_to_cpu\": %lld, ",
+				cfg.bDoubleMode ? "true" : "false", cfg.bNoPrefetch ? "true" : "false", cfg.iCpuAff);
+			out.append(buffer);
+			json_stats(out, res.vThdHps[i]);
+			out.append(", \"trials\": ");
+			json_array(out, res.vThdHps[i]);
+			out.append(i + 1 < res.vThdHps.size() ? "},\n" : "}\n");
+		}
+
+		out.append(r + 1 < vRes.size() ? "\t\t\t]\n\t\t},\n" : "\t\t\t]\n\t\t}\n");
+	}
+	out.append("\t]\n}\n");
+
+	FILE* fp = fopen(opt.sJsonFile, "wb");
+	if(fp == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Failed to open %s for the benchmark report.", opt.sJsonFile);
+		return false;
+	}
+
+	bool bOk = fwrite(out.data(), 1, out.size(), fp) == out.size();
+	bOk = fclose(fp) == 0 && bOk;
+	if(!bOk)
+		printer::inst()->print_msg(L0, "Failed to write the benchmark report to %s.", opt.sJsonFile);
+	return bOk;
+}
+
+bool benchmark::run(const options& opt)
+{
+	std::vector<layout> vLayouts = make_layouts(opt.bSweep);
+
+	printer::inst()->print_msg(L0, "Benchmarking %u layout(s), %u trial(s) of %u s after a %u s warmup each...",
+		(unsigned)vLayouts.size(), opt.iTrials, opt.iDuration, opt.iWarmup);
+
+	std::vector<result> vRes(vLayouts.size());
+	for(size_t i = 0; i < vLayouts.size(); i++)
+	{
+		vRes[i].pLayout = &vLayouts[i];
+		run_layout(opt, vRes[i]);
+		print_result(vRes[i]);
+	}
+
+	if(vRes.size() > 1)
+	{
+		size_t iBest = 0;
+		for(size_t i = 1; i < vRes.size(); i++)
+		{
+			if(median(vRes[i].vTotalHps) > median(vRes[iBest].vTotalHps))
+				iBest = i;
+		}
+		printer::inst()->print_msg(L0, "Fastest layout: %s, %.1f H/s", vRes[iBest].pLayout->sName.c_str(),
+			median(vRes[iBest].vTotalHps));
+	}
+
+	if(opt.sJsonFile != nullptr)
+		return write_json(opt, vRes);
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "jconf.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+	benchmark_mode - hashes an all zero job for a while and reports what each thread did.
+
+	Every thread layout gets a warmup (huge pages faulted in, clocks ramped up, caches warm) that
+	we don't count, and then a number of trials of the same length. We report the spread over the
+	trials as well as the median, a single number on its own doesn't tell a real change from noise.
+
+	With a sweep we run single, single without prefetch and double hash kernels on 1, 2, 4, ... of
+	the configured threads (keeping their affinity) on top of the configured layout, so that one run
+	answers "what should my cpu_threads_conf be".
+*/
+class benchmark
+{
+public:
+	struct options
+	{
+		uint32_t iDuration = 20; // s per trial
+		uint32_t iWarmup = 10; // s before the first trial of each layout
+		uint32_t iTrials = 3;
+		bool bSweep = false;
+		const char* sJsonFile = nullptr;
+	};
+
+	// What follows "benchmark_mode config.txt" on the command line
+	static bool parse_args(int argc, char* argv[], options& opt);
+	static const char* usage();
+
+	// false if we couldn't write the report
+	static bool run(const options& opt);
+
+private:
+	struct layout
+	{
+		std::string sName;
+		std::vector<jconf::thd_cfg> vThd;
+	};
+
+	struct result
+	{
+		const layout* pLayout;
+		std::vector<double> vTotalHps; // per trial
+		std::vector<std::vector<double>> vThdHps; // [thread][trial]
+	};
+
+	static std::vector<layout> make_layouts(bool bSweep);
+	static void run_layout(const options& opt, result& res);
+	static void print_result(const result& res);
+	static bool write_json(const options& opt, const std::vector<result>& vRes);
+};
@@ -27,6 +27,11 @@
 #include "console.h"
 #include "donate-level.h"
 #include "httpd.h"
+#include "proxy.h"
+#include "benchmark.h"
+#include "replay.h"
+#include "mock_pool.h"
+#include "hashcheck.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -52,8 +57,6 @@ void win_exit()
 void win_exit() { return; }
 #endif // _WIN32
 
-void do_benchmark();
-
 int main(int argc, char *argv[])
 {
 #ifndef CONF_NO_TLS
@@ -67,12 +70,24 @@ int main(int argc, char *argv[])
 
 	const char* sFilename = "config.txt";
 	bool benchmark_mode = false;
+	benchmark::options oBenchOpts;
+	bool self_test_mode = false;
+	size_t iTestRounds = 0;
+	uint64_t iTestSeed = 0;
+	bool replay_mode = false;
+	replay::options oReplayOpts;
+	bool mock_pool_mode = false;
+	mock_pool::options oMockOpts;
 
 	if(argc >= 2)
 	{
 		if(strcmp(argv[1], "-h") == 0)
 		{
 			printer::inst()->print_msg(L0, "Usage %s [CONFIG FILE]", argv[0]);
+			printer::inst()->print_msg(L0, "      %s %s", argv[0], benchmark::usage());
+			printer::inst()->print_msg(L0, "      %s self_test CONFIG [ROUNDS] [SEED]", argv[0]);
+			printer::inst()->print_msg(L0, "      %s %s", argv[0], replay::usage());
+			printer::inst()->print_msg(L0, "      %s %s", argv[0], mock_pool::usage());
 			win_exit();
 			return 0;
 		}
@@ -85,6 +100,47 @@ int main(int argc, char *argv[])
 		{
 			sFilename = argv[2];
 			benchmark_mode = true;
+
+			if(!benchmark::parse_args(argc - 3, argv + 3, oBenchOpts))
+			{
+				win_exit();
+				return 0;
+			}
+		}
+		else if(argc >= 3 && strcasecmp(argv[1], "self_test") == 0)
+		{
+			sFilename = argv[2];
+			self_test_mode = true;
+			iTestRounds = 20;
+
+			if(!hashcheck::parse_args(argc - 3, argv + 3, iTestRounds, iTestSeed))
+			{
+				printer::inst()->print_msg(L0, "Usage: %s self_test CONFIG [ROUNDS] [SEED]", argv[0]);
+				win_exit();
+				return 1;
+			}
+		}
+		else if(argc >= 3 && strcasecmp(argv[1], "replay") == 0)
+		{
+			sFilename = argv[2];
+			replay_mode = true;
+
+			if(!replay::parse_args(argc - 3, argv + 3, oReplayOpts))
+			{
+				win_exit();
+				return 0;
+			}
+		}
+		else if(argc >= 3 && strcasecmp(argv[1], "mock_pool") == 0)
+		{
+			sFilename = argv[2];
+			mock_pool_mode = true;
+
+			if(!mock_pool::parse_args(argc - 3, argv + 3, oMockOpts))
+			{
+				win_exit();
+				return 0;
+			}
 		}
 		else
 			sFilename = argv[1];
@@ -96,7 +152,17 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
-	if (!minethd::self_test())
+	bool bKernelsOk = minethd::self_test(iTestRounds, iTestSeed);
+
+	if(self_test_mode)
+	{
+		if(bKernelsOk)
+			printer::inst()->print_msg(L0, "Self-test passed, all kernels agree.");
+		win_exit();
+		return bKernelsOk ? 0 : 1;
+	}
+
+	if(!bKernelsOk)
 	{
 		win_exit();
 		return 0;
@@ -104,11 +170,25 @@ int main(int argc, char *argv[])
 
 	if(benchmark_mode)
 	{
-		do_benchmark();
+		benchmark::run(oBenchOpts);
 		win_exit();
 		return 0;
 	}
 
+	if(replay_mode)
+	{
+		bool bOk = replay::run(oReplayOpts);
+		win_exit();
+		return bOk ? 0 : 1;
+	}
+
+	if(mock_pool_mode)
+	{
+		bool bOk = mock_pool::run(oMockOpts);
+		win_exit();
+		return bOk ? 0 : 1;
+	}
+
 	if(jconf::inst()->GetHttpdPort() != 0)
 	{
 		if (!httpd::inst()->start_daemon())
@@ -118,6 +198,15 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if(jconf::inst()->GetProxyPort() != 0)
+	{
+		if (!proxy::inst()->start())
+		{
+			win_exit();
+			return 0;
+		}
+	}
+
 	printer::inst()->print_str("-------------------------------------------------------------------\n");
 	printer::inst()->print_str("AEON-Stak-CPU mining software, CPU Version.\n");
 	printer::inst()->print_str("Based on CPU mining code by wolf9466 (heavily optimized by myself).\n");
@@ -159,34 +248,3 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
-
-void do_benchmark()
-{
-	using namespace std::chrono;
-	std::vector<minethd*>* pvThreads;
-
-	printer::inst()->print_msg(L0, "Running a 60 second benchmark...");
-
-	uint8_t work[76] = {0};
-	minethd::miner_work oWork = minethd::miner_work("", work, sizeof(work), 0, 0, false, 0);
-	pvThreads = minethd::thread_starter(oWork);
-
-	uint64_t iStartStamp = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
-
-	std::this_thread::sleep_for(std::chrono::seconds(60));
-
-	oWork = minethd::miner_work();
-	minethd::switch_work(oWork);
-
-	double fTotalHps = 0.0;
-	for (uint32_t i = 0; i < pvThreads->size(); i++)
-	{
-		double fHps = pvThreads->at(i)->iHashCount;
-		fHps /= (pvThreads->at(i)->iTimestamp - iStartStamp) / 1000.0;
-
-		printer::inst()->print_msg(L0, "Thread %u: %.1f H/S", i, fHps);
-		fTotalHps += fHps;
-	}
-
-	printer::inst()->print_msg(L0, "Total: %.1f H/S", fTotalHps);
-}
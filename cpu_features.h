@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+/*
+	CPUID feature bits we care about. The miner checks them when it reads the config, the hash check
+	and the kernel bench have no config and ask directly.
+*/
+inline void cpu_features_leaf1(int cpu_info[4])
+{
+#ifdef _WIN32
+	__cpuid(cpu_info, 1);
+#else
+	__cpuid(1, cpu_info[0], cpu_info[1], cpu_info[2], cpu_info[3]);
+#endif
+}
+
+inline bool cpu_has_aes()
+{
+	constexpr int AESNI_BIT = 1 << 25;
+
+	int cpu_info[4];
+	cpu_features_leaf1(cpu_info);
+	return (cpu_info[2] & AESNI_BIT) != 0;
+}
+
+inline bool cpu_has_sse2()
+{
+	constexpr int SSE2_BIT = 1 << 26;
+
+	int cpu_info[4];
+	cpu_features_leaf1(cpu_info);
+	return (cpu_info[3] & SSE2_BIT) != 0;
+}
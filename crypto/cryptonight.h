@@ -29,6 +29,15 @@ void cryptonight_hash_ctx_soft(const void* input, size_t len, void* output, cryp
 void cryptonight_hash_ctx_np(const void* input, size_t len, void* output, cryptonight_ctx* ctx);
 void cryptonight_double_hash_ctx(const void*  input, size_t len, void* output, cryptonight_ctx** ctx);
 
+// Same hashes with a TSC read at each phase boundary. The ticks of every phase are added to
+// phases[CN_PHASE_*], the final phase is the last keccakf and the extra_hashes finalizer.
+enum { CN_PHASE_KECCAK, CN_PHASE_EXPLODE, CN_PHASE_MAIN, CN_PHASE_IMPLODE, CN_PHASE_FINAL, CN_PHASE_CNT };
+
+void cryptonight_hash_ctx_prof(const void* input, size_t len, void* output, cryptonight_ctx* ctx, uint64_t* phases);
+void cryptonight_hash_ctx_soft_prof(const void* input, size_t len, void* output, cryptonight_ctx* ctx, uint64_t* phases);
+void cryptonight_hash_ctx_np_prof(const void* input, size_t len, void* output, cryptonight_ctx* ctx, uint64_t* phases);
+void cryptonight_double_hash_ctx_prof(const void*  input, size_t len, void* output, cryptonight_ctx** ctx, uint64_t* phases);
+
 #ifdef __cplusplus
 }
 #endif
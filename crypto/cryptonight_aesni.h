@@ -278,13 +278,29 @@ void cn_implode_scratchpad(const __m128i* input, __m128i* output)
 	_mm_store_si128(output + 11, xout7);
 }
 
-template<size_t ITERATIONS, size_t MEM, bool PREFETCH, bool SOFT_AES>
-void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_ctx* ctx0)
+// Charges the ticks since iStart to a phase and starts the next one. Compiles to nothing unless profiling.
+template<bool PROFILE>
+inline void cn_phase_end(uint64_t* phases, int phase, uint64_t& iStart)
 {
+	if(PROFILE)
+	{
+		uint64_t iNow = __rdtsc();
+		phases[phase] += iNow - iStart;
+		iStart = iNow;
+	}
+}
+
+template<size_t ITERATIONS, size_t MEM, bool PREFETCH, bool SOFT_AES, bool PROFILE = false>
+void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_ctx* ctx0, uint64_t* phases = nullptr)
+{
+	uint64_t iStart = PROFILE ? __rdtsc() : 0;
+
 	keccak((const uint8_t *)input, len, ctx0->hash_state, 200);
+	cn_phase_end<PROFILE>(phases, CN_PHASE_KECCAK, iStart);
 
 	// Optim - 99% time boundary
 	cn_explode_scratchpad<MEM, SOFT_AES>((__m128i*)ctx0->hash_state, (__m128i*)ctx0->long_state);
+	cn_phase_end<PROFILE>(phases, CN_PHASE_EXPLODE, iStart);
 
 	uint8_t* l0 = ctx0->long_state;
 	uint64_t* h0 = (uint64_t*)ctx0->hash_state;
@@ -325,25 +341,32 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 			_mm_prefetch((const char*)&l0[idx0 & 0xFFFF0], _MM_HINT_T0);
 	}
 
+	cn_phase_end<PROFILE>(phases, CN_PHASE_MAIN, iStart);
+
 	// Optim - 90% time boundary
 	cn_implode_scratchpad<MEM, SOFT_AES>((__m128i*)ctx0->long_state, (__m128i*)ctx0->hash_state);
+	cn_phase_end<PROFILE>(phases, CN_PHASE_IMPLODE, iStart);
 
 	// Optim - 99% time boundary
 
 	keccakf((uint64_t*)ctx0->hash_state, 24);
 	extra_hashes[ctx0->hash_state[0] & 3](ctx0->hash_state, 200, (char*)output);
+	cn_phase_end<PROFILE>(phases, CN_PHASE_FINAL, iStart);
 }
 
 // This lovely creation will do 2 cn hashes at a time. We have plenty of space on silicon
 // to fit temporary vars for two contexts. Function will read len*2 from input and write 64 bytes to output
 // We are still limited by L3 cache, so doubling will only work with CPUs where we have more than 2MB to core (Xeons)
-template<size_t ITERATIONS, size_t MEM, bool PREFETCH, bool SOFT_AES>
-void cryptonight_double_hash(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+template<size_t ITERATIONS, size_t MEM, bool PREFETCH, bool SOFT_AES, bool PROFILE = false>
+void cryptonight_double_hash(const void* input, size_t len, void* output, cryptonight_ctx** ctx, uint64_t* phases = nullptr)
 {
 	static const int hashes = 2;
+	uint64_t iStart = PROFILE ? __rdtsc() : 0;
 	for(int i = 0; i<hashes; i++){
 		keccak((const uint8_t *)input+(i*len), len, ctx[i]->hash_state, 200);
+		cn_phase_end<PROFILE>(phases, CN_PHASE_KECCAK, iStart);
 		cn_explode_scratchpad<MEM, SOFT_AES>((__m128i*)ctx[i]->hash_state, (__m128i*)ctx[i]->long_state);
+		cn_phase_end<PROFILE>(phases, CN_PHASE_EXPLODE, iStart);
 	}
 
 	uint8_t* l[hashes];
@@ -397,10 +420,14 @@ void cryptonight_double_hash(const void* input, size_t len, void* output, crypto
 
 	}
 
+	cn_phase_end<PROFILE>(phases, CN_PHASE_MAIN, iStart);
+
 	// Optim - 90% time boundary
 	for(int i = 0; i<hashes; i++){
 		cn_implode_scratchpad<MEM, SOFT_AES>((__m128i*)ctx[i]->long_state, (__m128i*)ctx[i]->hash_state);
+		cn_phase_end<PROFILE>(phases, CN_PHASE_IMPLODE, iStart);
 		keccakf((uint64_t*)ctx[i]->hash_state, 24);
 		extra_hashes[ctx[i]->hash_state[0] & 3](ctx[i]->hash_state, 200, (char*)output + 32*i);
+		cn_phase_end<PROFILE>(phases, CN_PHASE_FINAL, iStart);
 	}
 }
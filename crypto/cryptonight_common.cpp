@@ -209,3 +209,23 @@ void cryptonight_double_hash_ctx(const void*  input, size_t len, void* output, c
 {
 	cryptonight_double_hash<0x40000, MEMORY, false, false>(input, len, output, ctx);
 }
+
+void cryptonight_hash_ctx_prof(const void* input, size_t len, void* output, cryptonight_ctx* ctx, uint64_t* phases)
+{
+	cryptonight_hash<0x40000, MEMORY, true, false, true>(input, len, output, ctx, phases);
+}
+
+void cryptonight_hash_ctx_soft_prof(const void* input, size_t len, void* output, cryptonight_ctx* ctx, uint64_t* phases)
+{
+	cryptonight_hash<0x40000, MEMORY, true, true, true>(input, len, output, ctx, phases);
+}
+
+void cryptonight_hash_ctx_np_prof(const void* input, size_t len, void* output, cryptonight_ctx* ctx, uint64_t* phases)
+{
+	cryptonight_hash<0x40000, MEMORY, false, false, true>(input, len, output, ctx, phases);
+}
+
+void cryptonight_double_hash_ctx_prof(const void*  input, size_t len, void* output, cryptonight_ctx** ctx, uint64_t* phases)
+{
+	cryptonight_double_hash<0x40000, MEMORY, false, false, true>(input, len, output, ctx, phases);
+}
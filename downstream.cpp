@@ -0,0 +1,158 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <string.h>
+
+#include "downstream.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Miners that stop reading get dropped rather than buffered forever
+constexpr size_t iMaxSendBuffer = 64 * 1024;
+
+bool downstream::handle_events(uint32_t iEvents)
+{
+	if(bDead || (iEvents & reactor::ev_error) != 0)
+		return false;
+
+	if((iEvents & reactor::ev_write) != 0 && !flush())
+		return false;
+
+	if((iEvents & reactor::ev_read) != 0 && (!read_lines() || bDead))
+		return false;
+
+	return true;
+}
+
+// Reactor thread only
+void downstream::close()
+{
+	reactor::inst()->del_socket(hSocket);
+	sock_close(hSocket);
+}
+
+bool downstream::send(const char* buf, size_t len)
+{
+	if(bDead)
+		return false;
+
+	// Keep the ordering, whatever we couldn't send before needs to go out first
+	if(!sSendBuf.empty())
+	{
+		if(sSendBuf.size() + len > iMaxSendBuffer)
+		{
+			bDead = true;
+			reactor::inst()->set_want_write(hSocket, true);
+			return false;
+		}
+
+		sSendBuf.append(buf, len);
+		return true;
+	}
+
+	size_t pos = 0;
+	while(pos != len)
+	{
+		int ret = ::send(hSocket, buf + pos, len - pos, MSG_NOSIGNAL);
+		if(ret == SOCKET_ERROR)
+		{
+			if(sock_would_block())
+			{
+				sSendBuf.assign(buf + pos, len - pos);
+				reactor::inst()->set_want_write(hSocket, true);
+				return true;
+			}
+
+			bDead = true;
+			reactor::inst()->set_want_write(hSocket, true);
+			return false;
+		}
+		pos += ret;
+	}
+
+	return true;
+}
+
+bool downstream::flush()
+{
+	size_t pos = 0, len = sSendBuf.size();
+	while(pos != len)
+	{
+		int ret = ::send(hSocket, sSendBuf.data() + pos, len - pos, MSG_NOSIGNAL);
+		if(ret == SOCKET_ERROR)
+		{
+			if(sock_would_block())
+			{
+				sSendBuf.erase(0, pos);
+				return true;
+			}
+			return false;
+		}
+		pos += ret;
+	}
+
+	sSendBuf.clear();
+	reactor::inst()->set_want_write(hSocket, false);
+	return true;
+}
+
+bool downstream::read_lines()
+{
+	while(true)
+	{
+		// A line that doesn't fit is not something a miner would send us
+		if(iRecvLen == sizeof(bRecvBuf))
+			return false;
+
+		int ret = ::recv(hSocket, bRecvBuf + iRecvLen, sizeof(bRecvBuf) - iRecvLen, 0);
+		if(ret == 0)
+			return false;
+
+		if(ret == SOCKET_ERROR)
+			return sock_would_block();
+
+		size_t iScanPos = iRecvLen;
+		iRecvLen += ret;
+
+		size_t iLinePos = 0;
+		char* lnend;
+		while((lnend = (char*)memchr(bRecvBuf + iScanPos, '\n', iRecvLen - iScanPos)) != nullptr)
+		{
+			char* lnstart = bRecvBuf + iLinePos;
+			*lnend = '\0';
+
+			if(!on_line(lnstart, lnend - lnstart))
+				return false;
+
+			iLinePos = iScanPos = lnend + 1 - bRecvBuf;
+		}
+
+		if(iLinePos > 0)
+		{
+			iRecvLen -= iLinePos;
+			memmove(bRecvBuf, bRecvBuf + iLinePos, iRecvLen);
+		}
+	}
+}
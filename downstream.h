@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+#include "reactor.h"
+
+/* A miner connected to us, the proxy's clients and the mock pool's are both this. It owns the
+	socket, queues whatever the kernel won't take right now and splits what comes in into lines,
+	the owner only deals with the messages.
+
+	None of it locks anything, the owner calls in with its own mutex held. The owner also drops
+	it: when handle_events() returns false it calls close() and deletes it on the reactor thread.
+	Sends from other threads only mark it dead, the reactor gets an event and the owner drops it
+	from there.
+*/
+class downstream : public sock_handler
+{
+public:
+	downstream(SOCKET s, uint64_t id) : hSocket(s), iConnId(id) {}
+
+	SOCKET hSocket;
+	uint64_t iConnId;
+	bool bLoggedIn = false;
+	bool bDead = false;
+
+	// False if the owner should drop the connection
+	bool handle_events(uint32_t iEvents);
+
+	// On failure we are marked dead, the reactor drops us
+	bool send(const char* buf, size_t len);
+
+	void close();
+
+protected:
+	// Gets every complete line, NUL terminated in place of the newline. False drops the connection.
+	virtual bool on_line(char* line, size_t len) = 0;
+
+private:
+	bool flush();
+	bool read_lines();
+
+	char bRecvBuf[4096];
+	size_t iRecvLen = 0;
+	std::string sSendBuf;
+};
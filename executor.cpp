@@ -29,7 +29,10 @@
 #include <time.h>
 #include "executor.h"
 #include "jpsock.h"
+#include "reactor.h"
+#include "proxy.h"
 #include "minethd.h"
+#include "tsc_clock.h"
 #include "jconf.h"
 #include "console.h"
 #include "donate-level.h"
@@ -44,12 +47,40 @@ executor* executor::oInst = NULL;
 executor::executor()
 {
 	my_thd = nullptr;
+	vTimedEvents.reserve(32);
 }
 
-void executor::push_timed_event(ex_event&& ev, size_t sec)
+size_t executor::push_timed_event_ms(ex_event&& ev, size_t ms)
 {
 	std::unique_lock<std::mutex> lck(timed_event_mutex);
-	lTimedEvents.emplace_back(std::move(ev), sec_to_ticks(sec));
+
+	size_t id = iNextTimedEvent++;
+	vTimedEvents.emplace_back(std::move(ev), reactor::get_ms_time() + ms, id);
+	std::push_heap(vTimedEvents.begin(), vTimedEvents.end());
+
+	// Only an event that is due before everything else needs to wake the clock thread up
+	bool bFirst = vTimedEvents.front().iId == id;
+	lck.unlock();
+
+	if(bFirst)
+		timed_event_cond.notify_one();
+	return id;
+}
+
+// There are only ever a handful of timed events, a linear search is as good as anything
+void executor::cancel_timed_event(size_t id)
+{
+	std::unique_lock<std::mutex> lck(timed_event_mutex);
+
+	for(size_t i=0; i < vTimedEvents.size(); i++)
+	{
+		if(vTimedEvents[i].iId == id)
+		{
+			vTimedEvents.erase(vTimedEvents.begin() + i);
+			std::make_heap(vTimedEvents.begin(), vTimedEvents.end());
+			return;
+		}
+	}
 }
 
 void executor::ex_clock_thd()
@@ -65,27 +96,34 @@ void executor::ex_clock_thd()
 	if(iDevPortion != 0)
 		iDevPortion += sec_to_ticks(2);
 
+	uint64_t iNextTick = reactor::get_ms_time() + iTickTime;
+	std::unique_lock<std::mutex> lck(timed_event_mutex);
 	while (true)
 	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(size_t(iTickTime)));
+		uint64_t iWake = iNextTick;
+		if(!vTimedEvents.empty() && vTimedEvents.front().iDeadline < iWake)
+			iWake = vTimedEvents.front().iDeadline;
 
-		push_event(ex_event(EV_PERF_TICK));
+		// A new event that is due earlier wakes us up, and then we simply look again
+		uint64_t iNow = reactor::get_ms_time();
+		if(iNow < iWake)
+		{
+			timed_event_cond.wait_for(lck, std::chrono::milliseconds(iWake - iNow));
+			continue;
+		}
 
-		// Service timed events
-		std::unique_lock<std::mutex> lck(timed_event_mutex);
-		std::list<timed_event>::iterator ev = lTimedEvents.begin();
-		while (ev != lTimedEvents.end())
+		while(!vTimedEvents.empty() && vTimedEvents.front().iDeadline <= iNow)
 		{
-			ev->ticks_left--;
-			if(ev->ticks_left == 0)
-			{
-				push_event(std::move(ev->event));
-				ev = lTimedEvents.erase(ev);
-			}
-			else
-				ev++;
+			std::pop_heap(vTimedEvents.begin(), vTimedEvents.end());
+			push_event(std::move(vTimedEvents.back().event));
+			vTimedEvents.pop_back();
 		}
-		lck.unlock();
+
+		if(iNow < iNextTick)
+			continue;
+
+		iNextTick += iTickTime;
+		push_event(ex_event(EV_PERF_TICK));
 
 		if(iDevPortion == 0)
 			continue;
@@ -103,6 +141,16 @@ void executor::ex_clock_thd()
 	}
 }
 
+// A pool has at most one retry pending, a new one replaces the old one
+void executor::sched_retry(size_t pool_id)
+{
+	usr_pool_state& st = usr_state(pool_id);
+	if(st.iRetryEvent != invalid_timed_event)
+		cancel_timed_event(st.iRetryEvent);
+
+	st.iRetryEvent = push_timed_event(ex_event(EV_RECONNECT, pool_id), jconf::inst()->GetNetRetry());
+}
+
 void executor::sched_reconnect()
 {
 	iReconnectAttempts++;
@@ -120,13 +168,21 @@ void executor::sched_reconnect()
 	auto work = minethd::miner_work();
 	minethd::switch_work(work);
 
-	push_timed_event(ex_event(EV_RECONNECT, usr_pool_id), rt);
+	sched_retry(active_pool_id);
 }
 
 void executor::log_socket_error(std::string&& sError)
 {
-	vSocketLog.emplace_back(std::move(sError));
-	printer::inst()->print_msg(L1, "SOCKET ERROR - %s", vSocketLog.back().msg.c_str());
+	printer::inst()->print_msg(L1, "SOCKET ERROR - %s", sError.c_str());
+	iSocketErrors++;
+
+	if(vSocketLog.size() < iSocketLogSize)
+		vSocketLog.emplace_back(std::move(sError));
+	else
+	{
+		vSocketLog[iSocketLogPos] = sck_error_log(std::move(sError));
+		iSocketLogPos = (iSocketLogPos + 1) % iSocketLogSize;
+	}
 }
 
 void executor::log_result_error(std::string&& sError)
@@ -168,7 +224,173 @@ jpsock* executor::pick_pool_by_id(size_t pool_id)
 	if(pool_id == dev_pool_id)
 		return dev_pool;
 	else
-		return usr_pool;
+		return vUsrPools[pool_id - usr_pool_id].pool;
+}
+
+const char* executor::usr_pool_addr(size_t pool_id)
+{
+	jconf::pool_cfg cfg;
+	jconf::inst()->GetPoolConfig(pool_id - usr_pool_id, cfg);
+	return cfg.sPoolAddr;
+}
+
+// Best pool to stand in for the active one. Pools with a known round trip time go first,
+// the fastest of them on top, then the rest in config order.
+size_t executor::pick_standby_pool()
+{
+	size_t best = invalid_pool_id;
+	for(size_t i = 0; i < vUsrPools.size(); i++)
+	{
+		size_t pool_id = usr_pool_id + i;
+		const usr_pool_state& st = vUsrPools[i];
+
+		if(pool_id == active_pool_id || st.bDown)
+			continue;
+
+		if(best == invalid_pool_id)
+		{
+			best = pool_id;
+			continue;
+		}
+
+		uint64_t iRtt = st.get_rtt(), iBestRtt = usr_state(best).get_rtt();
+		if(iRtt != 0 && (iBestRtt == 0 || iRtt < iBestRtt))
+			best = pool_id;
+	}
+
+	return best;
+}
+
+bool executor::connect_usr_pool(size_t pool_id)
+{
+	std::string error;
+	const char* sAddr = usr_pool_addr(pool_id);
+
+	printer::inst()->print_msg(L1, "Connecting to pool %s ...", sAddr);
+
+	if(pick_pool_by_id(pool_id)->connect(sAddr, error))
+	{
+		usr_state(pool_id).bOpen = true;
+		return true;
+	}
+
+	log_socket_error(std::move(error));
+	return false;
+}
+
+// Hang up on a pool that we don't need, without counting it as a failure
+void executor::close_usr_pool(size_t pool_id)
+{
+	usr_pool_state& st = usr_state(pool_id);
+	if(st.bOpen)
+	{
+		st.bClosing = true;
+		st.pool->disconnect();
+	}
+}
+
+void executor::fill_standby()
+{
+	if(!jconf::inst()->HotStandby() || standby_pool_id != invalid_pool_id)
+		return;
+
+	size_t pool_id = pick_standby_pool();
+	if(pool_id == invalid_pool_id)
+		return;
+
+	standby_pool_id = pool_id;
+	if(usr_state(pool_id).bOpen)
+		return;
+
+	if(!connect_usr_pool(pool_id))
+	{
+		standby_pool_id = invalid_pool_id;
+		usr_state(pool_id).bDown = true;
+		sched_retry(pool_id);
+		fill_standby();
+	}
+}
+
+// Work only moves to the new pool if we aren't mining for the dev pool at the moment
+void executor::set_active_pool(size_t pool_id)
+{
+	jpsock* pool = pick_pool_by_id(pool_id);
+	active_pool_id = pool_id;
+
+	if(pool->is_logged_in())
+	{
+		iReconnectAttempts = 0;
+		reset_stats();
+	}
+
+	job_ref oPoolJob;
+	uint32_t iResumeCnt;
+	bool bHaveJob = pool->is_logged_in() && pool->get_current_job(oPoolJob, iResumeCnt);
+
+	// Proxy miners follow the active pool, dev time or not
+	if(bHaveJob && jconf::inst()->GetProxyPort() != 0)
+		proxy::inst()->on_job(*oPoolJob, pool_id);
+
+	if(current_pool_id == dev_pool_id)
+		return;
+
+	current_pool_id = pool_id;
+
+	if(!bHaveJob)
+	{
+		// Nothing to do until it logs in, its first job will come through on_pool_have_job
+		auto work = minethd::miner_work();
+		minethd::switch_work(work);
+		return;
+	}
+
+	bool bNiceHash = prepare_usr_job(oPoolJob);
+	minethd::miner_work oWork(oPoolJob, iResumeCnt, get_local_target(oPoolJob->iTarget), bNiceHash, pool_id);
+
+	minethd::switch_work(oWork);
+
+	iPoolDiff = pool->get_current_diff();
+	iShareDiff = jpsock::t64_to_diff(oWork.iTarget);
+}
+
+// The standby takes over, the active pool becomes the standby
+void executor::swap_standby()
+{
+	size_t pool_id = standby_pool_id;
+	standby_pool_id = active_pool_id;
+	set_active_pool(pool_id);
+}
+
+// The active pool is gone. Move the work to the standby if we have one, otherwise to the
+// next best pool. We only wait for retry_time if every pool is down.
+void executor::failover()
+{
+	size_t old_id = active_pool_id;
+	size_t pool_id = standby_pool_id;
+	standby_pool_id = invalid_pool_id;
+
+	if(pool_id == invalid_pool_id)
+		pool_id = pick_standby_pool();
+
+	if(pool_id == invalid_pool_id)
+	{
+		sched_reconnect();
+		return;
+	}
+
+	sched_retry(old_id);
+
+	printer::inst()->print_msg(L1, "Switching to pool %s.", usr_pool_addr(pool_id));
+	set_active_pool(pool_id);
+
+	if(!usr_state(pool_id).bOpen && !connect_usr_pool(pool_id))
+	{
+		usr_state(pool_id).bDown = true;
+		failover();
+		return;
+	}
+
+	fill_standby();
 }
 
 void executor::on_sock_ready(size_t pool_id)
@@ -177,28 +399,59 @@ void executor::on_sock_ready(size_t pool_id)
 
 	if(pool_id == dev_pool_id)
 	{
-		if(!pool->cmd_login("", ""))
-			pool->disconnect();
+		pool->cmd_login("", "");
+		return;
+	}
+
+	jconf::pool_cfg cfg;
+	jconf::inst()->GetPoolConfig(pool_id - usr_pool_id, cfg);
+
+	printer::inst()->print_msg(L1, "Connected to %s. Logging in...", cfg.sPoolAddr);
+
+	//Failed logins come back to us as a socket error, and so does one that never went out
+	if(!pool->cmd_login(cfg.sWalletAddr, cfg.sPasswd))
+		printer::inst()->print_msg(L1, "Login to %s didn't go out, reconnecting.", cfg.sPoolAddr);
+}
 
+void executor::on_pool_logged_in(size_t pool_id)
+{
+	if(pool_id == dev_pool_id)
+	{
 		current_pool_id = dev_pool_id;
 		printer::inst()->print_msg(L1, "Dev pool logged in. Switching work.");
 		return;
 	}
 
-	printer::inst()->print_msg(L1, "Connected. Logging in...");
+	usr_pool_state& st = usr_state(pool_id);
+	st.iLoginTime = std::max<uint64_t>(pick_pool_by_id(pool_id)->get_login_time(), 1);
 
-	if (!pool->cmd_login(jconf::inst()->GetWalletAddress(), jconf::inst()->GetPoolPwd()))
-	{
-		if(!pool->have_sock_error())
-		{
-			log_socket_error(pool->get_call_error());
-			pool->disconnect();
-		}
-	}
-	else
+	if(pool_id == active_pool_id)
 	{
 		iReconnectAttempts = 0;
 		reset_stats();
+		fill_standby();
+		return;
+	}
+
+	if(pool_id != standby_pool_id)
+	{
+		close_usr_pool(pool_id);
+		return;
+	}
+
+	printer::inst()->print_msg(L1, "Standby pool %s logged in (%llu ms).", usr_pool_addr(pool_id), int_port(st.iLoginTime));
+
+	uint64_t iActiveRtt = usr_state(active_pool_id).get_rtt();
+	if(!pick_pool_by_id(active_pool_id)->is_logged_in())
+	{
+		printer::inst()->print_msg(L1, "Switching to pool %s.", usr_pool_addr(pool_id));
+		swap_standby();
+	}
+	else if(iActiveRtt > st.iLoginTime * 2)
+	{
+		printer::inst()->print_msg(L1, "Pool %s answers in %llu ms against %llu ms. Switching.",
+			usr_pool_addr(pool_id), int_port(st.iLoginTime), int_port(iActiveRtt));
+		swap_standby();
 	}
 }
 
@@ -218,22 +471,91 @@ void executor::on_sock_error(size_t pool_id, std::string&& sError)
 		return;
 	}
 
+	usr_pool_state& st = usr_state(pool_id);
+	st.bOpen = false;
+	if(st.bClosing)
+	{
+		st.bClosing = false;
+		return;
+	}
+
 	log_socket_error(std::move(sError));
 	pool->disconnect();
-	sched_reconnect();
+	st.bDown = true;
+	st.iFailures++;
+
+	if(pool_id == active_pool_id)
+	{
+		failover();
+		return;
+	}
+
+	if(pool_id == standby_pool_id)
+		standby_pool_id = invalid_pool_id;
+
+	sched_retry(pool_id);
+	fill_standby();
+}
+
+uint64_t executor::get_local_target(uint64_t iPoolTarget)
+{
+	uint64_t iMinDiff = jconf::inst()->GetMinShareDiff();
+	if(iMinDiff == 0)
+		return iPoolTarget;
+
+	// Only ever make it harder
+	uint64_t iLocalTarget = jpsock::diff_to_t64(iMinDiff);
+	return iLocalTarget < iPoolTarget ? iLocalTarget : iPoolTarget;
+}
+
+// In proxy mode our own threads keep nonce byte 0 for themselves, the same way the proxy miners keep theirs.
+// Jobs are shared, so if the pool left anything in the nonce we need a copy of our own to clear it in.
+bool executor::usr_nicehash()
+{
+	return jconf::inst()->GetProxyPort() != 0 || jconf::inst()->NiceHashMode();
+}
+
+bool executor::prepare_usr_job(job_ref& oPoolJob)
+{
+	if(jconf::inst()->GetProxyPort() == 0)
+		return usr_nicehash();
+
+	const uint8_t bZero[4] = {0};
+	if(oPoolJob->iWorkLen >= 43 && memcmp(oPoolJob->bWorkBlob + 39, bZero, 4) != 0)
+	{
+		pool_job* job = oPoolJob->copy();
+		memset(job->bWorkBlob + 39, 0, 4);
+		oPoolJob = job_ref(job);
+	}
+	return true;
+}
+
+void executor::replay_start(jpsock* pool)
+{
+	current_pool_id = usr_pool_id;
+	active_pool_id = usr_pool_id;
+	standby_pool_id = invalid_pool_id;
+
+	vUsrPools.clear();
+	vUsrPools.resize(1);
+	vUsrPools[0].pool = pool;
+	iPoolDiff = 0;
 }
 
-void executor::on_pool_have_job(size_t pool_id, pool_job& oPoolJob)
+void executor::on_pool_have_job(size_t pool_id, job_ref& oPoolJob)
 {
+	if(pool_id == active_pool_id && jconf::inst()->GetProxyPort() != 0)
+		proxy::inst()->on_job(*oPoolJob, pool_id);
+
 	if(pool_id != current_pool_id)
 		return;
 
 	jpsock* pool = pick_pool_by_id(pool_id);
 
-	minethd::miner_work oWork(oPoolJob.sJobID, oPoolJob.bWorkBlob,
-		oPoolJob.iWorkLen, oPoolJob.iResumeCnt, oPoolJob.iTarget,
-		pool_id != dev_pool_id && jconf::inst()->NiceHashMode(),
-		pool_id);
+	uint64_t iTarget = pool_id != dev_pool_id ? get_local_target(oPoolJob->iTarget) : oPoolJob->iTarget;
+	bool bNiceHash = pool_id != dev_pool_id && prepare_usr_job(oPoolJob);
+
+	minethd::miner_work oWork(oPoolJob, 0, iTarget, bNiceHash, pool_id);
 
 	minethd::switch_work(oWork);
 
@@ -243,7 +565,12 @@ void executor::on_pool_have_job(size_t pool_id, pool_job& oPoolJob)
 	if(iPoolDiff != pool->get_current_diff())
 	{
 		iPoolDiff = pool->get_current_diff();
-		printer::inst()->print_msg(L2, "Difficulty changed. Now: %llu.", int_port(iPoolDiff));
+		iShareDiff = jpsock::t64_to_diff(iTarget);
+		if(iShareDiff > iPoolDiff)
+			printer::inst()->print_msg(L2, "Difficulty changed. Now: %llu, sending shares above %llu.",
+				int_port(iPoolDiff), int_port(iShareDiff));
+		else
+			printer::inst()->print_msg(L2, "Difficulty changed. Now: %llu.", int_port(iPoolDiff));
 	}
 
 	printer::inst()->print_msg(L3, "New block detected.");
@@ -253,6 +580,20 @@ void executor::on_miner_result(size_t pool_id, job_result& oResult)
 {
 	jpsock* pool = pick_pool_by_id(pool_id);
 
+	// The pool moved on to a new block (or we logged in again) since this job was handed out,
+	// so the share will be rejected anyway. Don't waste a round trip on it.
+	if(oResult.iJobGen < pool->get_job_gen())
+	{
+		if(oResult.iProxyTag != 0)
+			proxy::inst()->on_result(oResult.iProxyTag, "Block expired");
+		else if(pool_id != dev_pool_id)
+		{
+			iStaleShares++;
+			printer::inst()->print_msg(L3, "Stale result dropped, the pool has a newer job.");
+		}
+		return;
+	}
+
 	if(pool_id == dev_pool_id)
 	{
 		//Ignore errors silently
@@ -262,67 +603,97 @@ void executor::on_miner_result(size_t pool_id, job_result& oResult)
 		return;
 	}
 
-	if (!pool->is_running() || !pool->is_logged_in())
+	//The pool's answer will come back as EV_POOL_RESULT
+	if (!pool->is_running() || !pool->is_logged_in() ||
+		!pool->cmd_submit(oResult.sJobID, oResult.iNonce, oResult.bResult, oResult.iProxyTag))
 	{
-		log_result_error("[NETWORK ERROR]");
-		return;
+		if(oResult.iProxyTag != 0)
+			proxy::inst()->on_result(oResult.iProxyTag, "[NETWORK ERROR]");
+		else
+			log_result_error("[NETWORK ERROR]");
 	}
+}
+
+void executor::on_pool_result(size_t pool_id, pool_result& oResult)
+{
+	if(pool_id == dev_pool_id)
+		return;
+
+	if(!oResult.bNetError)
+	{
+		oCallTimes.add(oResult.iCallTime);
 
-	using namespace std::chrono;
-	size_t t_start = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
-	bool bResult = pool->cmd_submit(oResult.sJobID, oResult.iNonce, oResult.bResult);
-	size_t t_len = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count() - t_start;
+		usr_pool_state& st = usr_state(pool_id);
+		uint64_t iCallTime = std::max<uint64_t>(oResult.iCallTime, 1);
+		st.iAvgCallTime = st.iAvgCallTime == 0 ? iCallTime : (st.iAvgCallTime * 7 + iCallTime) / 8;
+	}
 
-	if(t_len > 0xFFFF)
-		t_len = 0xFFFF;
-	iPoolCallTimes.push_back((uint16_t)t_len);
+	// Proxy miners get the verdict on their own shares, they don't count as ours
+	if(oResult.iProxyTag != 0)
+	{
+		proxy::inst()->on_result(oResult.iProxyTag, oResult.bSuccess ? nullptr : oResult.sError.c_str());
+		return;
+	}
 
-	if(bResult)
+	if(oResult.bSuccess)
 	{
-		uint64_t* targets = (uint64_t*)oResult.bResult;
-		log_result_ok(jpsock::t64_to_diff(targets[3]));
+		log_result_ok(oResult.iActualDiff);
 		printer::inst()->print_msg(L3, "Result accepted by the pool.");
 	}
+	else if(oResult.bNetError)
+		log_result_error(std::move(oResult.sError));
 	else
 	{
-		if(!pool->have_sock_error())
-		{
-			printer::inst()->print_msg(L3, "Result rejected by the pool.");
+		printer::inst()->print_msg(L3, "Result rejected by the pool.");
 
-			std::string error = pool->get_call_error();
-
-			if(strncasecmp(error.c_str(), "Unauthenticated", 15) == 0)
-			{
-				printer::inst()->print_msg(L2, "Your miner was unable to find a share in time. Either the pool difficulty is too high, or the pool timeout is too low.");
-				pool->disconnect();
-			}
-
-			log_result_error(std::move(error));
+		if(strncasecmp(oResult.sError.c_str(), "Unauthenticated", 15) == 0)
+		{
+			printer::inst()->print_msg(L2, "Your miner was unable to find a share in time. Either the pool difficulty is too high, or the pool timeout is too low.");
+			pick_pool_by_id(pool_id)->disconnect();
 		}
-		else
-			log_result_error("[NETWORK ERROR]");
+
+		log_result_error(std::move(oResult.sError));
 	}
 }
 
 void executor::on_reconnect(size_t pool_id)
 {
-	jpsock* pool = pick_pool_by_id(pool_id);
-
-	std::string error;
 	if(pool_id == dev_pool_id)
 		return;
 
-	printer::inst()->print_msg(L1, "Connecting to pool %s ...", jconf::inst()->GetPoolAddress());
+	usr_pool_state& st = usr_state(pool_id);
+	st.iRetryEvent = invalid_timed_event;
+	st.bDown = false;
 
-	if(!pool->connect(jconf::inst()->GetPoolAddress(), error))
+	// A pool without a role is only a candidate again, it may become the standby
+	if(pool_id != active_pool_id && pool_id != standby_pool_id)
 	{
-		log_socket_error(std::move(error));
-		sched_reconnect();
+		fill_standby();
+		return;
+	}
+
+	if(st.bOpen)
+		return;
+
+	if(connect_usr_pool(pool_id))
+		return;
+
+	st.bDown = true;
+	if(pool_id == active_pool_id)
+		failover();
+	else
+	{
+		standby_pool_id = invalid_pool_id;
+		sched_retry(pool_id);
 	}
 }
 
 void executor::on_switch_pool(size_t pool_id)
 {
+	// Going back to the user pools means going back to whichever one is active now
+	if(pool_id != dev_pool_id)
+		pool_id = active_pool_id;
+
 	if(pool_id == current_pool_id)
 		return;
 
@@ -343,25 +714,47 @@ void executor::on_switch_pool(size_t pool_id)
 		printer::inst()->print_msg(L1, "Switching back to user pool.");
 
 		current_pool_id = pool_id;
-		pool_job oPoolJob;
+		job_ref oPoolJob;
+		uint32_t iResumeCnt;
 
-		if(!pool->get_current_job(oPoolJob))
+		if(pool->is_logged_in() && pool->get_current_job(oPoolJob, iResumeCnt))
 		{
-			pool->disconnect();
-			return;
-		}
+			bool bNiceHash = prepare_usr_job(oPoolJob);
+			minethd::miner_work oWork(oPoolJob, iResumeCnt, get_local_target(oPoolJob->iTarget), bNiceHash, pool_id);
 
-		minethd::miner_work oWork(oPoolJob.sJobID, oPoolJob.bWorkBlob,
-			oPoolJob.iWorkLen, oPoolJob.iResumeCnt, oPoolJob.iTarget,
-			jconf::inst()->NiceHashMode(), pool_id);
-
-		minethd::switch_work(oWork);
+			minethd::switch_work(oWork);
+		}
+		else
+		{
+			// The pool is still reconnecting, wait for its login job
+			auto work = minethd::miner_work();
+			minethd::switch_work(work);
+		}
 
 		if(dev_pool->is_running())
 			push_timed_event(ex_event(EV_DEV_POOL_EXIT), 5);
 	}
 }
 
+/* Every logged in pool (standby included, that one is idle by definition) gets a keepalive once
+ * it has been quiet for keepalived_time. We look twice per period, so the longest silence is
+ * one and a half periods. */
+void executor::on_pool_keepalive()
+{
+	size_t iTime = jconf::inst()->GetKeepalivedTime();
+
+	for(usr_pool_state& st : vUsrPools)
+	{
+		if(st.bOpen)
+			st.pool->cmd_keepalive(iTime * 1000);
+	}
+
+	if(dev_pool->is_running())
+		dev_pool->cmd_keepalive(iTime * 1000);
+
+	push_timed_event_ms(ex_event(EV_POOL_KEEPALIVE), iTime * 500);
+}
+
 void executor::ex_main()
 {
 	assert(1000 % iTickTime == 0);
@@ -371,11 +764,18 @@ void executor::ex_main()
 	telem = new telemetry(pvThreads->size());
 
 	current_pool_id = usr_pool_id;
-	usr_pool = new jpsock(usr_pool_id, jconf::inst()->GetTlsSetting());
+	active_pool_id = usr_pool_id;
+	standby_pool_id = invalid_pool_id;
+
+	vUsrPools.resize(jconf::inst()->GetPoolCount());
+	for(size_t i = 0; i < vUsrPools.size(); i++)
+		vUsrPools[i].pool = new jpsock(usr_pool_id + i, jconf::inst()->GetTlsSetting());
+
 	dev_pool = new jpsock(dev_pool_id, jconf::inst()->GetTlsSetting());
 
-	ex_event ev;
+	std::vector<ex_event> vEvents;
 	std::thread clock_thd(&executor::ex_clock_thd, this);
+	reactor::inst()->start();
 
 	//This will connect us to the pool for the first time
 	push_event(ex_event(EV_RECONNECT, usr_pool_id));
@@ -388,91 +788,116 @@ void executor::ex_main()
 	if(jconf::inst()->GetVerboseLevel() >= 4)
 		push_timed_event(ex_event(EV_HASHRATE_LOOP), jconf::inst()->GetAutohashTime());
 
+	if(jconf::inst()->GetKeepalivedTime() != 0)
+		push_timed_event_ms(ex_event(EV_POOL_KEEPALIVE), jconf::inst()->GetKeepalivedTime() * 500);
+
 	size_t cnt = 0, i;
 	while (true)
 	{
-		ev = oEventQ.pop();
-		switch (ev.iName)
+		// Everything that piled up while we were busy, in the order it was pushed
+		oEventQ.pop_all(vEvents);
+		for(ex_event& ev : vEvents)
 		{
-		case EV_SOCK_READY:
-			on_sock_ready(ev.iPoolId);
-			break;
+			switch (ev.iName)
+			{
+			case EV_SOCK_READY:
+				on_sock_ready(ev.iPoolId);
+				break;
 
-		case EV_SOCK_ERROR:
-			on_sock_error(ev.iPoolId, std::move(ev.sSocketError));
-			break;
+			case EV_SOCK_ERROR:
+				on_sock_error(ev.iPoolId, std::move(ev.sSocketError));
+				break;
 
-		case EV_POOL_HAVE_JOB:
-			on_pool_have_job(ev.iPoolId, ev.oPoolJob);
-			break;
+			case EV_POOL_LOGGED_IN:
+				on_pool_logged_in(ev.iPoolId);
+				break;
 
-		case EV_MINER_HAVE_RESULT:
-			on_miner_result(ev.iPoolId, ev.oJobResult);
-			break;
+			case EV_POOL_HAVE_JOB:
+				on_pool_have_job(ev.iPoolId, ev.oPoolJob);
+				break;
 
-		case EV_RECONNECT:
-			on_reconnect(ev.iPoolId);
-			break;
+			case EV_POOL_RESULT:
+				on_pool_result(ev.iPoolId, ev.oPoolResult);
+				break;
 
-		case EV_SWITCH_POOL:
-			on_switch_pool(ev.iPoolId);
-			break;
+			case EV_MINER_HAVE_RESULT:
+				on_miner_result(ev.iPoolId, ev.oJobResult);
+				break;
 
-		case EV_DEV_POOL_EXIT:
-			dev_pool->disconnect();
-			break;
+			case EV_RECONNECT:
+				on_reconnect(ev.iPoolId);
+				break;
 
-		case EV_PERF_TICK:
-			for (i = 0; i < pvThreads->size(); i++)
-				telem->push_perf_value(i, pvThreads->at(i)->iHashCount.load(std::memory_order_relaxed),
-				pvThreads->at(i)->iTimestamp.load(std::memory_order_relaxed));
+			case EV_SWITCH_POOL:
+				on_switch_pool(ev.iPoolId);
+				break;
 
-			if((cnt++ & 0xF) == 0) //Every 16 ticks
-			{
-				double fHps = 0.0;
-				double fTelem;
-				bool normal = true;
+			case EV_DEV_POOL_EXIT:
+				dev_pool->disconnect();
+				break;
+
+			case EV_POOL_KEEPALIVE:
+				on_pool_keepalive();
+				break;
 
+			case EV_PERF_TICK:
+				tsc_clock::calibrate();
 				for (i = 0; i < pvThreads->size(); i++)
 				{
-					fTelem = telem->calc_telemetry_data(2500, i);
-					if(std::isnormal(fTelem))
-					{
-						fHps += fTelem;
-					}
-					else
-					{
-						normal = false;
-						break;
-					}
+					uint64_t iHashCount, iTimestamp;
+					pvThreads->at(i)->get_stats(iHashCount, iTimestamp);
+					telem->push_perf_value(i, iHashCount, iTimestamp);
 				}
 
-				if(normal && fHighestHps < fHps)
-					fHighestHps = fHps;
-			}
-		break;
+				if((cnt++ & 0xF) == 0) //Every 16 ticks
+				{
+					double fHps = 0.0;
+					double fTelem;
+					bool normal = true;
 
-		case EV_USR_HASHRATE:
-		case EV_USR_RESULTS:
-		case EV_USR_CONNSTAT:
-			print_report(ev.iName);
-			break;
+					for (i = 0; i < pvThreads->size(); i++)
+					{
+						fTelem = telem->calc_telemetry_data(2500, i);
+						if(std::isnormal(fTelem))
+						{
+							fHps += fTelem;
+						}
+						else
+						{
+							normal = false;
+							break;
+						}
+					}
 
-		case EV_HTML_HASHRATE:
-		case EV_HTML_RESULTS:
-		case EV_HTML_CONNSTAT:
-			http_report(ev.iName);
-			break;
+					if(normal && fHighestHps < fHps)
+						fHighestHps = fHps;
 
-		case EV_HASHRATE_LOOP:
-			print_report(EV_USR_HASHRATE);
-			push_timed_event(ex_event(EV_HASHRATE_LOOP), jconf::inst()->GetAutohashTime());
+					sample_hw_counters();
+				}
 			break;
 
-		case EV_INVALID_VAL:
-		default:
-			assert(false);
-			break;
+			case EV_USR_HASHRATE:
+			case EV_USR_RESULTS:
+			case EV_USR_CONNSTAT:
+				print_report(ev.iName);
+				break;
+
+			case EV_HTML_HASHRATE:
+			case EV_HTML_RESULTS:
+			case EV_HTML_CONNSTAT:
+				http_report(ev.iName);
+				break;
+
+			case EV_HASHRATE_LOOP:
+				print_report(EV_USR_HASHRATE);
+				push_timed_event(ex_event(EV_HASHRATE_LOOP), jconf::inst()->GetAutohashTime());
+				break;
+
+			case EV_INVALID_VAL:
+			default:
+				assert(false);
+				break;
+			}
 		}
 	}
 }
@@ -495,7 +920,7 @@ void executor::hashrate_report(std::string& out)
 
 	out.reserve(256 + nthd * 64);
 
-	double fTotal[3] = { 0.0, 0.0, 0.0};
+	double fTotal[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
 	size_t i;
 
 	out.append("HASHRATE REPORT\n");
@@ -522,6 +947,8 @@ void executor::hashrate_report(std::string& out)
 		fTotal[0] += fHps[0];
 		fTotal[1] += fHps[1];
 		fTotal[2] += fHps[2];
+		fTotal[3] += telem->calc_telemetry_data(3600000, i);
+		fTotal[4] += telem->calc_telemetry_data(86400000, i);
 
 		if((i & 0x1) == 1) //Odd i's
 			out.append("|\n");
@@ -539,9 +966,213 @@ void executor::hashrate_report(std::string& out)
 	out.append(hps_format(fTotal[0], num, sizeof(num)));
 	out.append(hps_format(fTotal[1], num, sizeof(num)));
 	out.append(hps_format(fTotal[2], num, sizeof(num)));
+	out.append(" H/s\n1h / 24h:");
+	out.append(hps_format(fTotal[3], num, sizeof(num)));
+	out.append(hps_format(fTotal[4], num, sizeof(num)));
 	out.append(" H/s\nHighest: ");
 	out.append(hps_format(fHighestHps, num, sizeof(num)));
 	out.append(" H/s\n");
+
+	if(minethd::is_profiling())
+		profile_report(out);
+
+	if(bHaveHwCounters)
+		hw_counter_report(out);
+}
+
+static const char* sPhaseNames[CN_PHASE_CNT] = { "keccak", "explode", "main", "implode", "final" };
+
+// Average ticks per hash of each phase, false if the thread didn't time any hashes yet
+static bool get_phase_avg(minethd* thd, double* fAvg, uint64_t* pTotal)
+{
+	uint64_t iHashes, iTicks[CN_PHASE_CNT];
+	thd->get_profile(iHashes, iTicks);
+	if(iHashes == 0)
+		return false;
+
+	for(size_t i = 0; i < CN_PHASE_CNT; i++)
+	{
+		fAvg[i] = double(iTicks[i]) / iHashes;
+		pTotal[i] += iTicks[i];
+	}
+	return true;
+}
+
+void executor::sample_hw_counters()
+{
+	size_t nthd = pvThreads->size();
+	vHwPrev.swap(vHwLast);
+	vHwLast.resize(nthd);
+	iHwPrevTime = iHwLastTime;
+	iHwLastTime = tsc_clock::now_ms();
+
+	for(size_t i = 0; i < nthd; i++)
+	{
+		hw_sample& s = vHwLast[i];
+		uint64_t iTimestamp;
+		s.bValid = pvThreads->at(i)->get_counters(s.oCnt);
+		pvThreads->at(i)->get_stats(s.iHashCount, iTimestamp);
+		bHaveHwCounters |= s.bValid;
+	}
+}
+
+enum { HW_CYC_PER_HASH, HW_IPC, HW_LLC_PER_HASH, HW_DTLB_PER_HASH, HW_GHZ, HW_NOMINAL, HW_RATE_CNT };
+static const char* sHwRateNames[HW_RATE_CNT] = { "cyc/hash", "IPC", "LLC/hash", "dTLB/hash", "GHz", "nominal" };
+
+// Over the last sample interval, NaN for whatever we don't have
+bool executor::get_hw_rates(size_t iThd, double* fRates)
+{
+	for(size_t j = 0; j < HW_RATE_CNT; j++)
+		fRates[j] = nan("");
+
+	if(iThd >= vHwPrev.size() || iThd >= vHwLast.size() || !vHwPrev[iThd].bValid || !vHwLast[iThd].bValid)
+		return false;
+
+	const perf_counters::sample& a = vHwPrev[iThd].oCnt;
+	const perf_counters::sample& b = vHwLast[iThd].oCnt;
+	double fHashes = double(vHwLast[iThd].iHashCount - vHwPrev[iThd].iHashCount);
+
+	auto delta = [&](size_t c) -> double {
+		return a.bHave[c] && b.bHave[c] ? double(b.iValue[c] - a.iValue[c]) : nan("");
+	};
+
+	double fCycles = delta(perf_counters::CYCLES);
+	double fTime = double(b.iTimeEnabled - a.iTimeEnabled);
+
+	if(fHashes > 0)
+	{
+		fRates[HW_CYC_PER_HASH] = fCycles / fHashes;
+		fRates[HW_LLC_PER_HASH] = delta(perf_counters::LLC_MISSES) / fHashes;
+		fRates[HW_DTLB_PER_HASH] = delta(perf_counters::DTLB_MISSES) / fHashes;
+	}
+
+	if(fCycles > 0)
+		fRates[HW_IPC] = delta(perf_counters::INSTRUCTIONS) / fCycles;
+
+	if(fTime > 0)
+		fRates[HW_GHZ] = fCycles / fTime;
+
+	// Ref cycles tick at the nominal clock, so this shows turbo above 100% and throttling below
+	double fRef = delta(perf_counters::REF_CYCLES);
+	if(fRef > 0)
+		fRates[HW_NOMINAL] = 100.0 * fCycles / fRef;
+
+	return true;
+}
+
+static const char* hw_format(double fVal, size_t iRate, char* buf, size_t l)
+{
+	if(std::isnan(fVal))
+		snprintf(buf, l, "(na)");
+	else if(iRate == HW_IPC || iRate == HW_GHZ)
+		snprintf(buf, l, "%.2f", fVal);
+	else if(iRate == HW_NOMINAL)
+		snprintf(buf, l, "%.0f%%", fVal);
+	else
+		snprintf(buf, l, "%.0f", fVal);
+	return buf;
+}
+
+void executor::hw_counter_report(std::string& out)
+{
+	char num[64], val[32];
+	size_t nthd = pvThreads->size();
+
+	snprintf(num, sizeof(num), "HARDWARE COUNTERS (last %u s)\n", (unsigned int)((iHwLastTime - iHwPrevTime + 500) / 1000));
+	out.append(num);
+	out.append("| ID |");
+	for(size_t j = 0; j < HW_RATE_CNT; j++)
+	{
+		snprintf(num, sizeof(num), " %9s |", sHwRateNames[j]);
+		out.append(num);
+	}
+	out.append(1, '\n');
+
+	for(size_t i = 0; i < nthd; i++)
+	{
+		double fRates[HW_RATE_CNT];
+		get_hw_rates(i, fRates);
+
+		snprintf(num, sizeof(num), "| %2u |", (unsigned int)i);
+		out.append(num);
+		for(size_t j = 0; j < HW_RATE_CNT; j++)
+		{
+			snprintf(num, sizeof(num), " %9s |", hw_format(fRates[j], j, val, sizeof(val)));
+			out.append(num);
+		}
+		out.append(1, '\n');
+	}
+}
+
+void executor::http_hw_counter_report(std::string& out)
+{
+	char buffer[1024];
+	char num[HW_RATE_CNT][32];
+	size_t nthd = pvThreads->size();
+
+	snprintf(buffer, sizeof(buffer), sHtmlCountersBodyHigh, (unsigned int)((iHwLastTime - iHwPrevTime + 500) / 1000),
+		sHwRateNames[0], sHwRateNames[1], sHwRateNames[2], sHwRateNames[3], sHwRateNames[4], sHwRateNames[5]);
+	out.append(buffer);
+
+	for(size_t i = 0; i < nthd; i++)
+	{
+		double fRates[HW_RATE_CNT];
+		get_hw_rates(i, fRates);
+		for(size_t j = 0; j < HW_RATE_CNT; j++)
+			hw_format(fRates[j], j, num[j], sizeof(num[j]));
+
+		snprintf(buffer, sizeof(buffer), sHtmlCountersTableRow, (unsigned int)i, num[0], num[1], num[2], num[3], num[4], num[5]);
+		out.append(buffer);
+	}
+
+	out.append(sHtmlCountersBodyLow);
+}
+
+void executor::profile_report(std::string& out)
+{
+	char num[64];
+	size_t nthd = pvThreads->size();
+	uint64_t iTotal[CN_PHASE_CNT] = { 0 };
+
+	snprintf(num, sizeof(num), "KERNEL PROFILE (1 in %u hashes)\n", minethd::get_profile_rate());
+	out.append(num);
+	out.append("| ID |");
+	for(size_t j = 0; j < CN_PHASE_CNT; j++)
+	{
+		snprintf(num, sizeof(num), " %9s |", sPhaseNames[j]);
+		out.append(num);
+	}
+	out.append(1, '\n');
+
+	for(size_t i = 0; i < nthd; i++)
+	{
+		double fAvg[CN_PHASE_CNT];
+		snprintf(num, sizeof(num), "| %2u |", (unsigned int)i);
+		out.append(num);
+
+		bool bHave = get_phase_avg(pvThreads->at(i), fAvg, iTotal);
+		for(size_t j = 0; j < CN_PHASE_CNT; j++)
+		{
+			if(bHave)
+				snprintf(num, sizeof(num), " %9.0f |", fAvg[j]);
+			else
+				snprintf(num, sizeof(num), " %9s |", "(na)");
+			out.append(num);
+		}
+		out.append(1, '\n');
+	}
+
+	uint64_t iSum = 0;
+	for(size_t j = 0; j < CN_PHASE_CNT; j++)
+		iSum += iTotal[j];
+
+	out.append("| %  |");
+	for(size_t j = 0; j < CN_PHASE_CNT; j++)
+	{
+		snprintf(num, sizeof(num), " %8.2f%% |", iSum != 0 ? 100.0 * iTotal[j] / iSum : 0.0);
+		out.append(num);
+	}
+	out.append("\nTSC cycles per hash, % of the total time of all threads\n");
 }
 
 char* time_format(char* buf, size_t len, std::chrono::system_clock::time_point time)
@@ -594,13 +1225,16 @@ void executor::result_report(std::string& out)
 	snprintf(num, sizeof(num), " (%.1f %%)\n", 100.0 * iGoodRes / iTotalRes);
 
 	out.append("Difficulty       : ").append(std::to_string(iPoolDiff)).append(1, '\n');
+	out.append("Share difficulty : ").append(std::to_string(iShareDiff)).append(1, '\n');
 	out.append("Good results     : ").append(std::to_string(iGoodRes)).append(" / ").
 		append(std::to_string(iTotalRes)).append(num);
+	out.append("Stale, not sent  : ").append(std::to_string(iStaleShares)).append(1, '\n');
+	out.append("Rate limited     : ").append(std::to_string(minethd::get_rate_limited())).append(1, '\n');
 
-	if(iPoolCallTimes.size() != 0)
+	if(oCallTimes.count() != 0)
 	{
-		// Here we use iPoolCallTimes since it also gets reset when we disconnect
-		snprintf(num, sizeof(num), "%.1f sec\n", dConnSec / iPoolCallTimes.size());
+		// Here we use oCallTimes since it also gets reset when we disconnect
+		snprintf(num, sizeof(num), "%.1f sec\n", dConnSec / oCallTimes.count());
 		out.append("Avg result time  : ").append(num);
 	}
 	out.append("Pool-side hashes : ").append(std::to_string(iPoolHashes)).append(2, '\n');
@@ -635,34 +1269,71 @@ void executor::connection_report(std::string& out)
 
 	out.reserve(512);
 
-	jpsock* pool = pick_pool_by_id(dev_pool_id + 1);
+	jpsock* pool = pick_pool_by_id(active_pool_id);
 
 	out.append("CONNECTION REPORT\n");
-	out.append("Pool address    : ").append(jconf::inst()->GetPoolAddress()).append(1, '\n');
+	out.append("Pool address    : ").append(usr_pool_addr(active_pool_id)).append(1, '\n');
 	if (pool->is_running() && pool->is_logged_in())
 		out.append("Connected since : ").append(time_format(date, sizeof(date), tPoolConnTime)).append(1, '\n');
 	else
 		out.append("Connected since : <not connected>\n");
 
-	size_t n_calls = iPoolCallTimes.size();
-	if (n_calls > 1)
+	if (oCallTimes.count() > 1)
 	{
-		//Not-really-but-good-enough median
-		std::nth_element(iPoolCallTimes.begin(), iPoolCallTimes.begin() + n_calls/2, iPoolCallTimes.end());
-		out.append("Pool ping time  : ").append(std::to_string(iPoolCallTimes[n_calls/2])).append(" ms\n");
+		snprintf(num, sizeof(num), "Pool ping time  : %u ms (p90 %u ms, p99 %u ms)\n",
+			oCallTimes.percentile(50), oCallTimes.percentile(90), oCallTimes.percentile(99));
+		out.append(num);
 	}
 	else
 		out.append("Pool ping time  : (n/a)\n");
 
+	if(vUsrPools.size() > 1)
+	{
+		out.append("\nPools:\n");
+		out.append("| Pool address                     | Status  | RTT ms | Errors |\n");
+		for(size_t i=0; i < vUsrPools.size(); i++)
+		{
+			size_t pool_id = usr_pool_id + i;
+			const char* sStatus = "idle";
+			if(pool_id == active_pool_id)
+				sStatus = "active";
+			else if(pool_id == standby_pool_id)
+				sStatus = "standby";
+			else if(vUsrPools[i].bDown)
+				sStatus = "down";
+
+			snprintf(num, sizeof(num), "| %-32.32s | %-7s | %6llu | %6llu |\n", usr_pool_addr(pool_id), sStatus,
+				int_port(vUsrPools[i].get_rtt()), int_port(vUsrPools[i].iFailures));
+			out.append(num);
+		}
+	}
+
+	if(jconf::inst()->GetProxyPort() != 0)
+	{
+		size_t iClients;
+		uint64_t iAccepted, iRejected;
+		proxy::inst()->get_stats(iClients, iAccepted, iRejected);
+		snprintf(num, sizeof(num), "Proxy miners    : %llu, shares %llu accepted / %llu rejected\n",
+			int_port(iClients), int_port(iAccepted), int_port(iRejected));
+		out.append(num);
+	}
+
 	out.append("\nNetwork error log:\n");
 	size_t ln = vSocketLog.size();
 	if(ln > 0)
 	{
+		if(iSocketErrors > ln)
+		{
+			snprintf(num, sizeof(num), "Last %llu of %llu errors\n", int_port(ln), int_port(iSocketErrors));
+			out.append(num);
+		}
+
 		out.append("| Date                | Error text                                             |\n");
 		for(size_t i=0; i < ln; i++)
 		{
+			const sck_error_log& err = vSocketLog[(iSocketLogPos + i) % ln];
 			snprintf(num, sizeof(num), "| %s | %-54.54s |\n",
-				time_format(date, sizeof(date), vSocketLog[i].time), vSocketLog[i].msg.c_str());
+				time_format(date, sizeof(date), err.time), err.msg.c_str());
 			out.append(num);
 		}
 	}
@@ -696,7 +1367,7 @@ void executor::print_report(ex_event_name ev)
 
 void executor::http_hashrate_report(std::string& out)
 {
-	char num_a[32], num_b[32], num_c[32], num_d[32];
+	char num_a[32], num_b[32], num_c[32], num_d[32], num_e[32], num_f[32];
 	char buffer[4096];
 	size_t nthd = pvThreads->size();
 
@@ -705,10 +1376,10 @@ void executor::http_hashrate_report(std::string& out)
 	snprintf(buffer, sizeof(buffer), sHtmlCommonHeader, "Hashrate Report", "Hashrate Report");
 	out.append(buffer);
 
-	snprintf(buffer, sizeof(buffer), sHtmlHashrateBodyHigh, (unsigned int)nthd + 3);
+	snprintf(buffer, sizeof(buffer), sHtmlHashrateBodyHigh, (unsigned int)nthd + 4);
 	out.append(buffer);
 
-	double fTotal[3] = { 0.0, 0.0, 0.0};
+	double fTotal[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
 	for(size_t i=0; i < nthd; i++)
 	{
 		double fHps[3];
@@ -725,18 +1396,67 @@ void executor::http_hashrate_report(std::string& out)
 		fTotal[0] += fHps[0];
 		fTotal[1] += fHps[1];
 		fTotal[2] += fHps[2];
+		fTotal[3] += telem->calc_telemetry_data(3600000, i);
+		fTotal[4] += telem->calc_telemetry_data(86400000, i);
 
 		snprintf(buffer, sizeof(buffer), sHtmlHashrateTableRow, (unsigned int)i, num_a, num_b, num_c);
 		out.append(buffer);
 	}
 
-	num_a[0] = num_b[0] = num_c[0] = num_d[0] ='\0';
+	num_a[0] = num_b[0] = num_c[0] = num_d[0] = num_e[0] = num_f[0] ='\0';
 	hps_format(fTotal[0], num_a, sizeof(num_a));
 	hps_format(fTotal[1], num_b, sizeof(num_b));
 	hps_format(fTotal[2], num_c, sizeof(num_c));
-	hps_format(fHighestHps, num_d, sizeof(num_d));
+	hps_format(fTotal[3], num_d, sizeof(num_d));
+	hps_format(fTotal[4], num_e, sizeof(num_e));
+	hps_format(fHighestHps, num_f, sizeof(num_f));
+
+	snprintf(buffer, sizeof(buffer), sHtmlHashrateBodyLow, num_a, num_b, num_c, num_d, num_e, num_f);
+	out.append(buffer);
+
+	if(minethd::is_profiling())
+		http_profile_report(out);
+
+	if(bHaveHwCounters)
+		http_hw_counter_report(out);
+
+	out.append(sHtmlHashrateFooter);
+}
+
+void executor::http_profile_report(std::string& out)
+{
+	char buffer[1024];
+	char num[CN_PHASE_CNT][32];
+	size_t nthd = pvThreads->size();
+	uint64_t iTotal[CN_PHASE_CNT] = { 0 };
+
+	snprintf(buffer, sizeof(buffer), sHtmlProfileBodyHigh, minethd::get_profile_rate(),
+		sPhaseNames[0], sPhaseNames[1], sPhaseNames[2], sPhaseNames[3], sPhaseNames[4]);
+	out.append(buffer);
 
-	snprintf(buffer, sizeof(buffer), sHtmlHashrateBodyLow, num_a, num_b, num_c, num_d);
+	for(size_t i = 0; i < nthd; i++)
+	{
+		double fAvg[CN_PHASE_CNT];
+		bool bHave = get_phase_avg(pvThreads->at(i), fAvg, iTotal);
+		for(size_t j = 0; j < CN_PHASE_CNT; j++)
+		{
+			if(bHave)
+				snprintf(num[j], sizeof(num[j]), "%.0f", fAvg[j]);
+			else
+				snprintf(num[j], sizeof(num[j]), "(na)");
+		}
+
+		snprintf(buffer, sizeof(buffer), sHtmlProfileTableRow, (unsigned int)i, num[0], num[1], num[2], num[3], num[4]);
+		out.append(buffer);
+	}
+
+	uint64_t iSum = 0;
+	for(size_t j = 0; j < CN_PHASE_CNT; j++)
+		iSum += iTotal[j];
+	for(size_t j = 0; j < CN_PHASE_CNT; j++)
+		snprintf(num[j], sizeof(num[j]), "%.2f %%", iSum != 0 ? 100.0 * iTotal[j] / iSum : 0.0);
+
+	snprintf(buffer, sizeof(buffer), sHtmlProfileBodyLow, num[0], num[1], num[2], num[3], num[4]);
 	out.append(buffer);
 }
 
@@ -761,15 +1481,16 @@ void executor::http_result_report(std::string& out)
 		fGoodResPrc = 100.0 * iGoodRes / iTotalRes;
 
 	double fAvgResTime = 0.0;
-	if(iPoolCallTimes.size() > 0)
+	if(oCallTimes.count() > 0)
 	{
 		using namespace std::chrono;
 		fAvgResTime = ((double)duration_cast<seconds>(system_clock::now() - tPoolConnTime).count())
-			/ iPoolCallTimes.size();
+			/ oCallTimes.count();
 	}
 
 	snprintf(buffer, sizeof(buffer), sHtmlResultBodyHigh,
-		iPoolDiff, iGoodRes, iTotalRes, fGoodResPrc, fAvgResTime, iPoolHashes,
+		iPoolDiff, int_port(iShareDiff), iGoodRes, iTotalRes, fGoodResPrc, int_port(iStaleShares),
+		int_port(minethd::get_rate_limited()), fAvgResTime, iPoolHashes,
 		int_port(iTopDiff[0]), int_port(iTopDiff[1]), int_port(iTopDiff[2]), int_port(iTopDiff[3]),
 		int_port(iTopDiff[4]), int_port(iTopDiff[5]), int_port(iTopDiff[6]), int_port(iTopDiff[7]),
 		int_port(iTopDiff[8]), int_port(iTopDiff[9]));
@@ -796,30 +1517,34 @@ void executor::http_connection_report(std::string& out)
 	snprintf(buffer, sizeof(buffer), sHtmlCommonHeader, "Connection Report", "Connection Report");
 	out.append(buffer);
 
-	jpsock* pool = pick_pool_by_id(dev_pool_id + 1);
+	jpsock* pool = pick_pool_by_id(active_pool_id);
 	const char* cdate = "not connected";
 	if (pool->is_running() && pool->is_logged_in())
 		cdate = time_format(date, sizeof(date), tPoolConnTime);
 
-	size_t n_calls = iPoolCallTimes.size();
-	unsigned int ping_time = 0;
-	if (n_calls > 1)
+
+	char sProxy[128] = "off";
+	if(jconf::inst()->GetProxyPort() != 0)
 	{
-		//Not-really-but-good-enough median
-		std::nth_element(iPoolCallTimes.begin(), iPoolCallTimes.begin() + n_calls/2, iPoolCallTimes.end());
-		ping_time = iPoolCallTimes[n_calls/2];
+		size_t iClients;
+		uint64_t iAccepted, iRejected;
+		proxy::inst()->get_stats(iClients, iAccepted, iRejected);
+		snprintf(sProxy, sizeof(sProxy), "%llu, shares %llu accepted / %llu rejected",
+			int_port(iClients), int_port(iAccepted), int_port(iRejected));
 	}
 
 	snprintf(buffer, sizeof(buffer), sHtmlConnectionBodyHigh,
-		jconf::inst()->GetPoolAddress(),
-		cdate, ping_time);
+		usr_pool_addr(active_pool_id),
+		standby_pool_id != invalid_pool_id ? usr_pool_addr(standby_pool_id) : "none",
+		cdate, oCallTimes.percentile(50), oCallTimes.percentile(90), oCallTimes.percentile(99), sProxy);
 	out.append(buffer);
 
-
-	for(size_t i=0; i < vSocketLog.size(); i++)
+	size_t ln = vSocketLog.size();
+	for(size_t i=0; i < ln; i++)
 	{
+		const sck_error_log& err = vSocketLog[(iSocketLogPos + i) % ln];
 		snprintf(buffer, sizeof(buffer), sHtmlConnectionTableRow,
-			time_format(date, sizeof(date), vSocketLog[i].time), vSocketLog[i].msg.c_str());
+			time_format(date, sizeof(date), err.time), err.msg.c_str());
 		out.append(buffer);
 	}
 
@@ -1,10 +1,13 @@
 #pragma once
-#include "thdq.hpp"
+#include "mpscq.hpp"
 #include "msgstruct.h"
+#include "histogram.h"
+#include "perfcnt.h"
 #include <atomic>
 #include <array>
-#include <list>
+#include <vector>
 #include <future>
+#include <condition_variable>
 
 class jpsock;
 class minethd;
@@ -25,31 +28,61 @@ public:
 	void get_http_report(ex_event_name ev_id, std::string& data);
 
 	inline void push_event(ex_event&& ev) { oEventQ.push(std::move(ev)); }
-	void push_timed_event(ex_event&& ev, size_t sec);
+
+	// The event goes into the queue once it is due. The returned id can cancel it until then.
+	inline size_t push_timed_event(ex_event&& ev, size_t sec) { return push_timed_event_ms(std::move(ev), sec * 1000); }
+	size_t push_timed_event_ms(ex_event&& ev, size_t ms);
+	void cancel_timed_event(size_t id);
+
+	constexpr static size_t invalid_timed_event = 0;
+
+	// What user pool jobs are mined for, and whether the threads keep the nonce byte the pool
+	// gave us. The job replay judges the results with them.
+	static uint64_t get_local_target(uint64_t iPoolTarget);
+	static bool usr_nicehash();
+
+	// The job replay stands in for ex_main, never while it runs. Its pool reads a recording instead of
+	// a socket, the replay takes the events and hands the jobs back to become miner work like live ones.
+	void replay_start(jpsock* pool);
+	inline void replay_job(ex_event& ev) { on_pool_have_job(ev.iPoolId, ev.oPoolJob); }
+	inline bool try_pop_event(ex_event& ev) { return oEventQ.try_pop(ev); }
 
 	constexpr static size_t invalid_pool_id = 0;
 	constexpr static size_t dev_pool_id = 1;
-	constexpr static size_t usr_pool_id = 2;
+	constexpr static size_t usr_pool_id = 2; // First user pool, the failover pools follow
 
 private:
 	struct timed_event
 	{
+		uint64_t iDeadline; // reactor::get_ms_time
+		size_t iId;
 		ex_event event;
-		size_t ticks_left;
 
-		timed_event(ex_event&& ev, size_t ticks) : event(std::move(ev)), ticks_left(ticks) {}
+		timed_event(ex_event&& ev, uint64_t deadline, size_t id) : iDeadline(deadline), iId(id), event(std::move(ev)) {}
+		timed_event(timed_event&&) = default;
+		timed_event& operator=(timed_event&&) = default;
+
+		// The std heap functions keep the largest element on top, so "largest" is the earliest
+		bool operator<(const timed_event& o) const
+		{
+			return iDeadline != o.iDeadline ? iDeadline > o.iDeadline : iId > o.iId;
+		}
 	};
 
-	// In miliseconds, has to divide a second (1000ms) into an integer number
+	// Performance sampling (and dev pool switching) period, in miliseconds.
+	// Has to divide a second (1000ms) into an integer number
 	constexpr static size_t iTickTime = 500;
 
 	// Dev donation time period in seconds. 100 minutes by default.
 	// We will divide up this period according to the config setting
 	constexpr static size_t iDevDonatePeriod = 100 * 60;
 
-	std::list<timed_event> lTimedEvents;
+	// Min-heap on the deadline. The clock thread sleeps until the top one (or the next tick) is due.
+	std::vector<timed_event> vTimedEvents;
 	std::mutex timed_event_mutex;
-	thdq<ex_event> oEventQ;
+	std::condition_variable timed_event_cond;
+	size_t iNextTimedEvent = 1;
+	mpscq<ex_event> oEventQ;
 
 	telemetry* telem;
 	std::vector<minethd*>* pvThreads;
@@ -57,7 +90,38 @@ private:
 
 	size_t current_pool_id;
 
-	jpsock* usr_pool;
+	/* User pools have one of two roles. The active pool is the one that we mine on (unless it
+	 * is dev time), the standby is kept logged in so that it can take over without a reconnect.
+	 * Pools that failed stay down until their retry event comes. */
+	struct usr_pool_state
+	{
+		jpsock* pool;
+		uint64_t iLoginTime = 0; // ms, zero until we log in for the first time
+		uint64_t iAvgCallTime = 0; // Moving average of the submit round trip, ms
+		size_t iFailures = 0;
+		size_t iRetryEvent = invalid_timed_event;
+		bool bDown = false;
+		// Connected (or connecting) until we see its socket error. The socket itself can close before
+		// the error reaches us, so we can't go by jpsock::is_running here.
+		bool bOpen = false;
+		bool bClosing = false; // We hung up on it ourselves, so its socket error is expected
+
+		inline uint64_t get_rtt() const { return iAvgCallTime != 0 ? iAvgCallTime : iLoginTime; }
+	};
+	std::vector<usr_pool_state> vUsrPools;
+	size_t active_pool_id;
+	size_t standby_pool_id;
+
+	inline usr_pool_state& usr_state(size_t pool_id) { return vUsrPools[pool_id - usr_pool_id]; }
+	const char* usr_pool_addr(size_t pool_id);
+	size_t pick_standby_pool();
+	bool connect_usr_pool(size_t pool_id);
+	void close_usr_pool(size_t pool_id);
+	void fill_standby();
+	void set_active_pool(size_t pool_id);
+	void swap_standby();
+	void failover();
+
 	jpsock* dev_pool;
 
 	jpsock* pick_pool_by_id(size_t pool_id);
@@ -71,10 +135,14 @@ private:
 	void pool_connect(jpsock* pool);
 
 	void hashrate_report(std::string& out);
+	void profile_report(std::string& out);
+	void hw_counter_report(std::string& out);
 	void result_report(std::string& out);
 	void connection_report(std::string& out);
 
 	void http_hashrate_report(std::string& out);
+	void http_profile_report(std::string& out);
+	void http_hw_counter_report(std::string& out);
 	void http_result_report(std::string& out);
 	void http_connection_report(std::string& out);
 
@@ -97,7 +165,11 @@ private:
 			time = std::chrono::system_clock::now();
 		}
 	};
+	// Ring of the last few errors, the oldest one is at iSocketLogPos once it is full
+	constexpr static size_t iSocketLogSize = 32;
 	std::vector<sck_error_log> vSocketLog;
+	size_t iSocketLogPos = 0;
+	size_t iSocketErrors = 0;
 
 	// Element zero is always the success element.
 	// Keep in mind that this is a tally and not a log like above
@@ -142,34 +214,59 @@ private:
 	std::chrono::system_clock::time_point tPoolConnTime;
 	size_t iPoolHashes = 0;
 	uint64_t iPoolDiff = 0;
+	size_t iStaleShares = 0; // Results for superseded jobs that we didn't send
+	uint64_t iShareDiff = 0; // What we actually look for, can be above iPoolDiff (min_share_diff)
 
-	// Set it to 16 bit so that we can just let it grow
-	// Maximum realistic growth rate - 5MB / month
-	std::vector<uint16_t> iPoolCallTimes;
+	// Submit round trips in ms
+	histogram oCallTimes;
 
 	//Those stats are reset if we disconnect
 	inline void reset_stats()
 	{
-		iPoolCallTimes.clear();
+		oCallTimes.reset();
 		tPoolConnTime = std::chrono::system_clock::now();
 		iPoolHashes = 0;
 		iPoolDiff = 0;
+		iShareDiff = 0;
 	}
 
+	bool prepare_usr_job(job_ref& oPoolJob);
+
 	double fHighestHps = 0.0;
 
+	// Hardware counters and hash counts of each thread at the last two samples, the reports
+	// show the difference. bHaveHwCounters is set once any thread gave us counters.
+	struct hw_sample
+	{
+		perf_counters::sample oCnt;
+		uint64_t iHashCount;
+		bool bValid;
+	};
+	std::vector<hw_sample> vHwPrev;
+	std::vector<hw_sample> vHwLast;
+	uint64_t iHwPrevTime = 0;
+	uint64_t iHwLastTime = 0;
+	bool bHaveHwCounters = false;
+
+	void sample_hw_counters();
+	bool get_hw_rates(size_t iThd, double* fRates);
+
 	void log_socket_error(std::string&& sError);
 	void log_result_error(std::string&& sError);
 	void log_result_ok(uint64_t iActualDiff);
 
 	void sched_reconnect();
+	void sched_retry(size_t pool_id);
 
 	void on_sock_ready(size_t pool_id);
+	void on_pool_logged_in(size_t pool_id);
 	void on_sock_error(size_t pool_id, std::string&& sError);
-	void on_pool_have_job(size_t pool_id, pool_job& oPoolJob);
+	void on_pool_have_job(size_t pool_id, job_ref& oPoolJob);
 	void on_miner_result(size_t pool_id, job_result& oResult);
+	void on_pool_result(size_t pool_id, pool_result& oResult);
 	void on_reconnect(size_t pool_id);
 	void on_switch_pool(size_t pool_id);
+	void on_pool_keepalive();
 
 	inline size_t sec_to_ticks(size_t sec) { return sec * (1000 / iTickTime); }
 };
@@ -0,0 +1,298 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "hashcheck.h"
+#include "console.h"
+#include "hexcodec.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto/cryptonight_aesni.h"
+
+namespace
+{
+
+typedef void (*kernel_fn)(const void* input, size_t len, void* output, cryptonight_ctx** ctx);
+
+struct cn_kernel
+{
+	const char* sName;
+	kernel_fn hash;
+	size_t iLanes; // Blobs per call, laid out one after another, and so are the results
+	bool bNeedAes;
+};
+
+void k_single(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	cryptonight_hash_ctx(input, len, output, ctx[0]);
+}
+
+void k_single_np(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	cryptonight_hash_ctx_np(input, len, output, ctx[0]);
+}
+
+void k_single_soft(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	cryptonight_hash_ctx_soft(input, len, output, ctx[0]);
+}
+
+void k_double(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	cryptonight_double_hash_ctx(input, len, output, ctx);
+}
+
+void k_single_prof(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	uint64_t phases[CN_PHASE_CNT] = {0};
+	cryptonight_hash_ctx_prof(input, len, output, ctx[0], phases);
+}
+
+void k_single_np_prof(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	uint64_t phases[CN_PHASE_CNT] = {0};
+	cryptonight_hash_ctx_np_prof(input, len, output, ctx[0], phases);
+}
+
+void k_single_soft_prof(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	uint64_t phases[CN_PHASE_CNT] = {0};
+	cryptonight_hash_ctx_soft_prof(input, len, output, ctx[0], phases);
+}
+
+void k_double_prof(const void* input, size_t len, void* output, cryptonight_ctx** ctx)
+{
+	uint64_t phases[CN_PHASE_CNT] = {0};
+	cryptonight_double_hash_ctx_prof(input, len, output, ctx, phases);
+}
+
+// The first one is the reference
+const cn_kernel oKernels[] = {
+	{ "soft", k_single_soft, 1, false },
+	{ "single", k_single, 1, true },
+	{ "single no_prefetch", k_single_np, 1, true },
+	{ "double", k_double, 2, true },
+	{ "soft profiled", k_single_soft_prof, 1, false },
+	{ "single profiled", k_single_prof, 1, true },
+	{ "single no_prefetch profiled", k_single_np_prof, 1, true },
+	{ "double profiled", k_double_prof, 2, true }
+};
+const size_t iKernelCnt = sizeof(oKernels) / sizeof(oKernels[0]);
+
+struct hash_vector
+{
+	const char* sInput; // hex
+	const char* sHash;
+};
+
+/*
+	Cryptonight-lite (variant 0). The text inputs are the ones from the Monero and Aeon hash tests,
+	the 76 byte block header is the usual miner test input. Between them the last keccak state picks
+	every one of the four extra_hashes finalizers (noted as the branch below).
+*/
+const hash_vector oCnVectors[] = {
+	// "" - branch 0
+	{ "", "4cec4a947f670ffdd591f89cdb56ba066c31cd093d1d4d7ce15d33704c090611" },
+	// "This is a test" - branch 1
+	{ "5468697320697320612074657374", "88e5e684db178c825e4ce3809ccc1cda79cc2adb4406bff93debeaf20a8bebd9" },
+	// "caveat emptor" - branch 2
+	{ "63617665617420656d70746f72", "afffe6c3084b0de799f6851389619bfe36be4705e4fb9e5039f8044b0decf8ea" },
+	// "de omnibus dubitandum" - branch 3
+	{ "6465206f6d6e69627573206475626974616e64756d", "1b73647a792df8724ce28fddc1e4b6f348dc39e6aa47c434fe400cec98ec2b91" },
+	// "abundans cautela non nocet"
+	{ "6162756e64616e732063617574656c61206e6f6e206e6f636574", "058293a2279aa3e3816c9e06bef3c0b3e4de8850f251a195ca4c2e35a1eebf58" },
+	// 76 byte block header
+	{ "0305a0dbd6bf05cf16e503f3a66f78007cbf34144332ecbfc22ed95c8700383b309ace1923a0964b00000008ba939a62724c0d7581fce5761e9d8a0e6a1c3f924fdd8493d1115649c05eb601",
+		"3695b4b53bb00358b0ad38dc160feb9e004eece09b83a72ef6ba9864d3510c88" }
+};
+
+// Empty message digests from the algorithm specifications, keccak is the original (pre SHA-3) padding
+const char* sFinalizerEmpty[4] = {
+	"716f6e863f744b9ac22c97ec7b76ea5f5908bc5b2f67c61510bfc4751384ea7a", // BLAKE-256
+	"1a52d11d550039be16107f9c58db9ebcc417f16f736adb2502567119f0083467", // Groestl-256
+	"46e64619c18bb0a92a5e87185a47eef83ca747b8fcc8e1412921357e326df434", // JH-256
+	"39ccc4554a8b31853b9de7a1fe638a24cce6b35a55f2431009e18780335d2621"  // Skein-512-256
+};
+const char* sFinalizerNames[4] = { "blake256", "groestl", "jh", "skein" };
+const char* sKeccakEmpty = "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470";
+
+// Largest input we hash at random. Real blobs are under 112 bytes, this takes keccak into a second block.
+constexpr size_t iMaxRandomLen = 256;
+
+bool check_digest(const uint8_t* bHash, const char* sExpected, const char* sWhat, const char* sKernel)
+{
+	uint8_t bExpected[32];
+	hex_decode(sExpected, 64, bExpected);
+	if(memcmp(bHash, bExpected, 32) == 0)
+		return true;
+
+	char sGot[65];
+	hex_encode(bHash, 32, sGot);
+	sGot[64] = '\0';
+	printer::inst()->print_msg(L0, "Hash check failed - %s, %s: got %s, expected %s.", sKernel, sWhat, sGot, sExpected);
+	return false;
+}
+
+inline bool can_run(const cn_kernel& k, bool bHaveAes)
+{
+	return bHaveAes || !k.bNeedAes;
+}
+
+// A small PRNG of our own, so that a seed gives the same blobs everywhere
+inline uint64_t xorshift64(uint64_t& s)
+{
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return s;
+}
+
+bool parse_u64(const char* sArg, const char* sVal, uint64_t& iOut)
+{
+	char* sEnd;
+	errno = 0;
+	unsigned long long iVal = strtoull(sVal, &sEnd, 10);
+	if(*sVal < '0' || *sVal > '9' || *sEnd != '\0' || errno == ERANGE)
+	{
+		printer::inst()->print_msg(L0, "Invalid value for %s: %s", sArg, sVal);
+		return false;
+	}
+	iOut = iVal;
+	return true;
+}
+
+}
+
+bool hashcheck::parse_args(int argc, char* argv[], size_t& iRounds, uint64_t& iSeed)
+{
+	if(argc > 2)
+	{
+		printer::inst()->print_msg(L0, "Unexpected argument %s", argv[2]);
+		return false;
+	}
+
+	uint64_t iVal;
+	if(argc >= 1)
+	{
+		if(!parse_u64("ROUNDS", argv[0], iVal) || iVal > SIZE_MAX)
+			return false;
+		iRounds = (size_t)iVal;
+	}
+
+	if(argc >= 2 && !parse_u64("SEED", argv[1], iSeed))
+		return false;
+
+	return true;
+}
+
+bool hashcheck::known_answers(cryptonight_ctx** ctx, bool bHaveAes)
+{
+	bool bResult = true;
+	uint8_t bHash[200];
+
+	for(size_t i = 0; i < 4; i++)
+	{
+		extra_hashes[i]("", 0, (char*)bHash);
+		bResult &= check_digest(bHash, sFinalizerEmpty[i], "empty message", sFinalizerNames[i]);
+	}
+
+	keccak((const uint8_t*)"", 0, bHash, 32);
+	bResult &= check_digest(bHash, sKeccakEmpty, "empty message", "keccak-256");
+
+	uint8_t bInput[iMaxRandomLen * 2];
+	uint8_t bOut[64];
+	for(const hash_vector& v : oCnVectors)
+	{
+		size_t len = strlen(v.sInput) / 2;
+		hex_decode(v.sInput, len * 2, bInput);
+
+		for(const cn_kernel& k : oKernels)
+		{
+			if(!can_run(k, bHaveAes))
+				continue;
+
+			// Every lane gets the same blob
+			for(size_t l = 1; l < k.iLanes; l++)
+				memcpy(bInput + l * len, bInput, len);
+
+			k.hash(bInput, len, bOut, ctx);
+			for(size_t l = 0; l < k.iLanes; l++)
+				bResult &= check_digest(bOut + l * 32, v.sHash, v.sInput[0] != '\0' ? v.sInput : "(empty)", k.sName);
+		}
+	}
+
+	return bResult;
+}
+
+bool hashcheck::differential(cryptonight_ctx** ctx, bool bHaveAes, size_t iRounds, uint64_t iSeed)
+{
+	uint64_t s = iSeed != 0 ? iSeed : 1;
+	uint8_t bInput[iMaxRandomLen * 2];
+	uint8_t bRef[64], bOut[64];
+	size_t iBranches[4] = {0};
+	size_t iFailed = 0;
+
+	printer::inst()->print_msg(L0, "Hashing %llu random blob pairs through every kernel, seed %llu...", int_port(iRounds), int_port(s));
+
+	for(size_t r = 0; r < iRounds; r++)
+	{
+		size_t len = xorshift64(s) % (iMaxRandomLen + 1);
+		for(size_t i = 0; i < len * 2; i++)
+			bInput[i] = (uint8_t)xorshift64(s);
+
+		// Two different blobs, so that the double hash can mix up its lanes
+		oKernels[0].hash(bInput, len, bRef, ctx);
+		iBranches[ctx[0]->hash_state[0] & 3]++;
+		oKernels[0].hash(bInput + len, len, bRef + 32, ctx);
+		iBranches[ctx[0]->hash_state[0] & 3]++;
+
+		for(size_t i = 1; i < iKernelCnt; i++)
+		{
+			const cn_kernel& k = oKernels[i];
+			if(!can_run(k, bHaveAes))
+				continue;
+
+			k.hash(bInput, len, bOut, ctx);
+			if(k.iLanes == 1)
+				k.hash(bInput + len, len, bOut + 32, ctx);
+
+			if(memcmp(bOut, bRef, 64) != 0)
+			{
+				char sBlob[iMaxRandomLen * 4 + 1];
+				hex_encode(bInput, len * 2, sBlob);
+				sBlob[len * 4] = '\0';
+				printer::inst()->print_msg(L0, "Hash check failed - %s differs from %s, %llu byte blobs %s.",
+					k.sName, oKernels[0].sName, int_port(len), sBlob);
+				iFailed++;
+			}
+		}
+	}
+
+	printer::inst()->print_msg(L0, "%llu of %llu rounds failed. Finalizers hit: blake256 %llu, groestl %llu, jh %llu, skein %llu.",
+		int_port(iFailed), int_port(iRounds), int_port(iBranches[0]), int_port(iBranches[1]), int_port(iBranches[2]), int_port(iBranches[3]));
+
+	return iFailed == 0;
+}
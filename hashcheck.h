@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crypto/cryptonight.h"
+
+/*
+	Checks of the hashing kernels against known answers and against each other.
+
+	Every kernel the miner can run is in one table (hashcheck.cpp), so a new variant gets the
+	same checks by adding a line there. The soft AES single hash is the reference - it's plain
+	portable code, and it is held to the published cryptonight-lite vectors like all the others.
+
+	known_answers() is quick and runs on every start. differential() hashes random blobs of random
+	length through every kernel and compares them with the reference, it's what "self_test" on the
+	command line is for.
+
+	parse_args() reads the [ROUNDS] [SEED] that "self_test" and the standalone check take, and leaves
+	the defaults alone for anything that isn't given. It complains and returns false on anything else.
+
+	ctx - two contexts, the double hash uses both.
+*/
+class hashcheck
+{
+public:
+	static bool parse_args(int argc, char* argv[], size_t& iRounds, uint64_t& iSeed);
+	static bool known_answers(cryptonight_ctx** ctx, bool bHaveAes);
+	static bool differential(cryptonight_ctx** ctx, bool bHaveAes, size_t iRounds, uint64_t iSeed);
+};
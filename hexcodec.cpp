@@ -0,0 +1,188 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "hexcodec.h"
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <x86intrin.h>
+#endif
+
+static inline uint8_t hf_hex2bin(char c, bool &err)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 0xA;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 0xA;
+
+	err = true;
+	return 0;
+}
+
+static inline char hf_bin2hex(uint8_t c)
+{
+	if (c <= 0x9)
+		return '0' + c;
+	else
+		return 'a' - 0xA + c;
+}
+
+bool hex_decode_scalar(const char* in, size_t len, uint8_t* out)
+{
+	bool error = false;
+	for (size_t i = 0; i < len; i += 2)
+	{
+		out[i / 2] = (hf_hex2bin(in[i], error) << 4) | hf_hex2bin(in[i + 1], error);
+		if (error) return false;
+	}
+	return true;
+}
+
+void hex_encode_scalar(const uint8_t* in, size_t len, char* out)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		out[i * 2] = hf_bin2hex((in[i] & 0xF0) >> 4);
+		out[i * 2 + 1] = hf_bin2hex(in[i] & 0x0F);
+	}
+}
+
+#if defined(__SSSE3__)
+/*
+ * 16 characters to 16 nibbles. Digits keep their low nibble, letters (any case) get 9 added
+ * to theirs. Sets bValid to false if any of the characters is not a hex digit.
+ */
+static inline __m128i sse_hex_nibbles(__m128i v, bool& bValid)
+{
+	__m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1)));
+
+	if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+		bValid = false;
+
+	return _mm_add_epi8(_mm_and_si128(v, _mm_set1_epi8(0x0F)), _mm_and_si128(alpha, _mm_set1_epi8(9)));
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i avx_hex_nibbles(__m256i v, bool& bValid)
+{
+	__m256i l = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(l, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), l));
+
+	if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != 0xFFFFFFFF)
+		bValid = false;
+
+	return _mm256_add_epi8(_mm256_and_si256(v, _mm256_set1_epi8(0x0F)), _mm256_and_si256(alpha, _mm256_set1_epi8(9)));
+}
+#endif
+
+bool hex_decode(const char* in, size_t len, uint8_t* out)
+{
+	bool bValid = true;
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	// Multiply-add the (high, low) nibble pairs into bytes, pack and gather the two lanes
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+		__m256i b = _mm256_maddubs_epi16(avx_hex_nibbles(v, bValid), _mm256_set1_epi16(0x0110));
+		b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b, b), 0x08);
+		_mm_storeu_si128((__m128i*)(out + i / 2), _mm256_castsi256_si128(b));
+	}
+#endif
+
+#if defined(__SSSE3__)
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i b = _mm_maddubs_epi16(sse_hex_nibbles(v, bValid), _mm_set1_epi16(0x0110));
+		_mm_storel_epi64((__m128i*)(out + i / 2), _mm_packus_epi16(b, b));
+	}
+#endif
+
+	if (!bValid)
+		return false;
+
+	return hex_decode_scalar(in + i, len - i, out + i / 2);
+}
+
+void hex_encode(const uint8_t* in, size_t len, char* out)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	{
+		const __m256i lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+			'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+		const __m256i mask = _mm256_set1_epi8(0x0F);
+
+		for (; i + 32 <= len; i += 32)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+			__m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+			__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+
+			// Unpack works within 128 bit lanes, so put the lanes back in order
+			__m256i a = _mm256_unpacklo_epi8(hi, lo);
+			__m256i b = _mm256_unpackhi_epi8(hi, lo);
+			_mm256_storeu_si256((__m256i*)(out + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+			_mm256_storeu_si256((__m256i*)(out + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+		}
+	}
+#endif
+
+#if defined(__SSSE3__)
+	{
+		const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+		const __m128i mask = _mm_set1_epi8(0x0F);
+
+		for (; i + 16 <= len; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+			__m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+			__m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+
+			_mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi8(hi, lo));
+			_mm_storeu_si128((__m128i*)(out + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+		}
+	}
+#endif
+
+	hex_encode_scalar(in + i, len - i, out + i * 2);
+}
+
+const char* hex_codec_name()
+{
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSSE3__)
+	return "ssse3";
+#else
+	return "scalar";
+#endif
+}
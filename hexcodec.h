@@ -0,0 +1,22 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hex codecs used for job blobs, targets and results. Like the hashing code, the vector
+ * path is picked at compile time by -march: AVX2, then SSSE3, with a scalar tail (and a
+ * scalar everything on older targets).
+ *
+ * hex_decode - len is the number of hex characters, every one of them is checked and
+ *              anything other than [0-9a-fA-F] makes it return false (out is garbage then).
+ * hex_encode - writes 2 * len lowercase characters, no terminator.
+ */
+bool hex_decode(const char* in, size_t len, uint8_t* out);
+void hex_encode(const uint8_t* in, size_t len, char* out);
+
+// Plain versions, for the tails and to compare against
+bool hex_decode_scalar(const char* in, size_t len, uint8_t* out);
+void hex_encode_scalar(const uint8_t* in, size_t len, char* out);
+
+// Name of the vector path we were compiled with
+const char* hex_codec_name();
@@ -0,0 +1,113 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Log-linear (HDR style) histogram of 32 bit values in fixed memory. Values below 64 get a bucket
+ * each, above that every power of two is split into 32 buckets, so a percentile is off by at most
+ * 1/32 (about 3%) of the true value. Adding a value and reading a percentile cost the same no
+ * matter how many values we have seen, which is what we want on a miner that runs for months.
+ */
+class histogram
+{
+public:
+	histogram() { reset(); }
+
+	void reset()
+	{
+		memset(iBuckets, 0, sizeof(iBuckets));
+		iCount = 0;
+		iSum = 0;
+		iMax = 0;
+	}
+
+	void add(uint32_t v)
+	{
+		iBuckets[bucket_of(v)]++;
+		iCount++;
+		iSum += v;
+		if(v > iMax)
+			iMax = v;
+	}
+
+	void merge(const histogram& o)
+	{
+		for(size_t i=0; i < iBucketCnt; i++)
+			iBuckets[i] += o.iBuckets[i];
+		iCount += o.iCount;
+		iSum += o.iSum;
+		if(o.iMax > iMax)
+			iMax = o.iMax;
+	}
+
+	inline uint64_t count() const { return iCount; }
+	inline uint32_t max() const { return iMax; }
+	inline uint32_t mean() const { return iCount != 0 ? uint32_t(iSum / iCount) : 0; }
+
+	// fPrc in the 0 - 100 range, zero if we have no values
+	uint32_t percentile(double fPrc) const
+	{
+		if(iCount == 0)
+			return 0;
+
+		uint64_t iRank = uint64_t(fPrc / 100.0 * iCount + 0.5);
+		if(iRank == 0)
+			iRank = 1;
+
+		uint64_t iSeen = 0;
+		for(size_t i=0; i < iBucketCnt; i++)
+		{
+			iSeen += iBuckets[i];
+			if(iSeen >= iRank)
+			{
+				// Middle of the bucket, but never above what we actually saw
+				uint32_t v = bucket_mid(i);
+				return v < iMax ? v : iMax;
+			}
+		}
+
+		return iMax;
+	}
+
+private:
+	constexpr static uint32_t iSubBits = 5;
+	constexpr static uint32_t iSubCnt = 1 << iSubBits; // Buckets per power of two
+	constexpr static uint32_t iLinear = iSubCnt * 2; // Values below this get their own bucket
+	constexpr static size_t iBucketCnt = iLinear + (32 - iSubBits - 1) * iSubCnt;
+
+	static inline uint32_t msb(uint32_t v)
+	{
+#if defined(__GNUC__)
+		return 31 - __builtin_clz(v);
+#else
+		uint32_t r = 0;
+		while(v >>= 1)
+			r++;
+		return r;
+#endif
+	}
+
+	static inline size_t bucket_of(uint32_t v)
+	{
+		if(v < iLinear)
+			return v;
+
+		uint32_t iShift = msb(v) - iSubBits;
+		return iLinear + (iShift - 1) * iSubCnt + ((v >> iShift) - iSubCnt);
+	}
+
+	static inline uint32_t bucket_mid(size_t i)
+	{
+		if(i < iLinear)
+			return uint32_t(i);
+
+		uint32_t iShift = uint32_t((i - iLinear) / iSubCnt) + 1;
+		uint64_t iLow = uint64_t((i - iLinear) % iSubCnt + iSubCnt) << iShift;
+		return uint32_t(iLow + (uint64_t(1) << iShift) / 2);
+	}
+
+	uint32_t iBuckets[iBucketCnt];
+	uint64_t iCount;
+	uint64_t iSum;
+	uint32_t iMax;
+};
@@ -23,6 +23,7 @@
 
 #include "jconf.h"
 #include "console.h"
+#include "cpu_features.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,9 +31,6 @@
 
 #ifdef _WIN32
 #define strcasecmp _stricmp
-#include <intrin.h>
-#else
-#include <cpuid.h>
 #endif
 
 #include "rapidjson/document.h"
@@ -46,9 +44,9 @@ using namespace rapidjson;
  * This enum needs to match index in oConfigValues, otherwise we will get a runtime error
  */
 enum configEnum { iCpuThreadNum, aCpuThreadsConf, sUseSlowMem, bNiceHashMode,
-	bTlsMode, bTlsSecureAlgo, sTlsFingerprint, sPoolAddr, sWalletAddr, sPoolPwd,
-	iCallTimeout, iNetRetry, iGiveUpLimit, iVerboseLevel, iAutohashTime,
-	sOutputFile, iHttpdPort, bPreferIpv4 };
+	bTlsMode, bTlsSecureAlgo, sTlsFingerprint, sPoolAddr, sWalletAddr, sPoolPwd, aFailoverPools, bHotStandby,
+	iCallTimeout, iNetRetry, iGiveUpLimit, iTcpKeepaliveTime, iTcpKeepaliveIntvl, iKeepalivedTime, iMinShareDiff, iMaxSharesPerSec, iVerboseLevel, iAutohashTime, iKernelProfile,
+	sOutputFile, iHttpdPort, iProxyPort, bPreferIpv4, iDnsCacheTime };
 
 struct configVal {
 	configEnum iName;
@@ -68,14 +66,24 @@ configVal oConfigValues[] = {
 	{ sPoolAddr, "pool_address", kStringType },
 	{ sWalletAddr, "wallet_address", kStringType },
 	{ sPoolPwd, "pool_password", kStringType },
+	{ aFailoverPools, "failover_pools", kArrayType },
+	{ bHotStandby, "hot_standby", kTrueType },
 	{ iCallTimeout, "call_timeout", kNumberType },
 	{ iNetRetry, "retry_time", kNumberType },
 	{ iGiveUpLimit, "giveup_limit", kNumberType },
+	{ iTcpKeepaliveTime, "tcp_keepalive_time", kNumberType },
+	{ iTcpKeepaliveIntvl, "tcp_keepalive_interval", kNumberType },
+	{ iKeepalivedTime, "keepalived_time", kNumberType },
+	{ iMinShareDiff, "min_share_diff", kNumberType },
+	{ iMaxSharesPerSec, "max_shares_per_sec", kNumberType },
 	{ iVerboseLevel, "verbose_level", kNumberType },
 	{ iAutohashTime, "h_print_time", kNumberType },
+	{ iKernelProfile, "kernel_profile", kNumberType },
 	{ sOutputFile, "output_file", kStringType },
 	{ iHttpdPort, "httpd_port", kNumberType },
-	{ bPreferIpv4, "prefer_ipv4", kTrueType }
+	{ iProxyPort, "proxy_port", kNumberType },
+	{ bPreferIpv4, "prefer_ipv4", kTrueType },
+	{ iDnsCacheTime, "dns_cache_time", kNumberType }
 };
 
 constexpr size_t iConfigCnt = (sizeof(oConfigValues)/sizeof(oConfigValues[0]));
@@ -199,11 +207,62 @@ const char* jconf::GetWalletAddress()
 	return prv->configValues[sWalletAddr]->GetString();
 }
 
+size_t jconf::GetPoolCount()
+{
+	return prv->configValues[aFailoverPools]->Size() + 1;
+}
+
+bool jconf::GetPoolConfig(size_t id, pool_cfg &cfg)
+{
+	if(id == 0)
+	{
+		cfg.sPoolAddr = GetPoolAddress();
+		cfg.sWalletAddr = GetWalletAddress();
+		cfg.sPasswd = GetPoolPwd();
+		return true;
+	}
+
+	if(id > prv->configValues[aFailoverPools]->Size())
+		return false;
+
+	const Value& oPoolConf = prv->configValues[aFailoverPools]->GetArray()[id - 1];
+
+	if(!oPoolConf.IsObject())
+		return false;
+
+	const Value *addr, *wallet, *pwd;
+	addr = GetObjectMember(oPoolConf, "pool_address");
+	wallet = GetObjectMember(oPoolConf, "wallet_address");
+	pwd = GetObjectMember(oPoolConf, "pool_password");
+
+	if(addr == nullptr || wallet == nullptr || pwd == nullptr)
+		return false;
+
+	if(!addr->IsString() || !wallet->IsString() || !pwd->IsString())
+		return false;
+
+	cfg.sPoolAddr = addr->GetString();
+	cfg.sWalletAddr = wallet->GetString();
+	cfg.sPasswd = pwd->GetString();
+
+	return true;
+}
+
+bool jconf::HotStandby()
+{
+	return prv->configValues[bHotStandby]->GetBool();
+}
+
 bool jconf::PreferIpv4()
 {
 	return prv->configValues[bPreferIpv4]->GetBool();
 }
 
+uint64_t jconf::GetDnsCacheTime()
+{
+	return prv->configValues[iDnsCacheTime]->GetUint64();
+}
+
 size_t jconf::GetThreadCount()
 {
 	return prv->configValues[aCpuThreadsConf]->Size();
@@ -224,6 +283,31 @@ uint64_t jconf::GetGiveUpLimit()
 	return prv->configValues[iGiveUpLimit]->GetUint64();
 }
 
+uint64_t jconf::GetTcpKeepaliveTime()
+{
+	return prv->configValues[iTcpKeepaliveTime]->GetUint64();
+}
+
+uint64_t jconf::GetTcpKeepaliveInterval()
+{
+	return prv->configValues[iTcpKeepaliveIntvl]->GetUint64();
+}
+
+uint64_t jconf::GetKeepalivedTime()
+{
+	return prv->configValues[iKeepalivedTime]->GetUint64();
+}
+
+uint64_t jconf::GetMinShareDiff()
+{
+	return prv->configValues[iMinShareDiff]->GetUint64();
+}
+
+uint64_t jconf::GetMaxSharesPerSec()
+{
+	return prv->configValues[iMaxSharesPerSec]->GetUint64();
+}
+
 uint64_t jconf::GetVerboseLevel()
 {
 	return prv->configValues[iVerboseLevel]->GetUint64();
@@ -234,11 +318,21 @@ uint64_t jconf::GetAutohashTime()
 	return prv->configValues[iAutohashTime]->GetUint64();
 }
 
+uint64_t jconf::GetKernelProfile()
+{
+	return prv->configValues[iKernelProfile]->GetUint64();
+}
+
 uint16_t jconf::GetHttpdPort()
 {
 	return prv->configValues[iHttpdPort]->GetUint();
 }
 
+uint16_t jconf::GetProxyPort()
+{
+	return prv->configValues[iProxyPort]->GetUint();
+}
+
 bool jconf::NiceHashMode()
 {
 	return prv->configValues[bNiceHashMode]->GetBool();
@@ -251,22 +345,12 @@ const char* jconf::GetOutputFile()
 
 bool jconf::check_cpu_features()
 {
-	constexpr int AESNI_BIT = 1 << 25;
-	constexpr int SSE2_BIT = 1 << 26;
-
-	int cpu_info[4];
-#ifdef _WIN32
-	__cpuid(cpu_info, 1);
-#else
-	__cpuid(1, cpu_info[0], cpu_info[1], cpu_info[2], cpu_info[3]);
-#endif
-
-	bHaveAes = (cpu_info[2] & AESNI_BIT) != 0;
+	bHaveAes = cpu_has_aes();
 
 	if(!bHaveAes)
 		printer::inst()->print_msg(L0, "Your CPU doesn't support hardware AES. Don't expect high hashrates.");
 
-	return (cpu_info[3] & SSE2_BIT) != 0;
+	return cpu_has_sse2();
 }
 
 bool jconf::parse_config(const char* sFilename)
@@ -393,6 +477,16 @@ bool jconf::parse_config(const char* sFilename)
 		}
 	}
 
+	pool_cfg p;
+	for(size_t i=1; i < GetPoolCount(); i++)
+	{
+		if(!GetPoolConfig(i, p))
+		{
+			printer::inst()->print_msg(L0, "Failover pool %llu has invalid config.", int_port(i));
+			return false;
+		}
+	}
+
 	if(GetSlowMemSetting() == unknown_value)
 	{
 		printer::inst()->print_msg(L0,
@@ -409,6 +503,29 @@ bool jconf::parse_config(const char* sFilename)
 		return false;
 	}
 
+	if(!prv->configValues[iTcpKeepaliveTime]->IsUint() || !prv->configValues[iTcpKeepaliveIntvl]->IsUint() ||
+		prv->configValues[iTcpKeepaliveTime]->GetUint() > 86400 || prv->configValues[iTcpKeepaliveIntvl]->GetUint() > 3600 ||
+		(GetTcpKeepaliveTime() != 0 && GetTcpKeepaliveInterval() == 0))
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. tcp_keepalive_time has to be in the range 0 to 86400 and tcp_keepalive_interval 1 to 3600.");
+		return false;
+	}
+
+	if(!prv->configValues[iKeepalivedTime]->IsUint64())
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. keepalived_time needs to be a positive integer.");
+		return false;
+	}
+
+	if(!prv->configValues[iMinShareDiff]->IsUint64() || !prv->configValues[iMaxSharesPerSec]->IsUint64())
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. min_share_diff and max_shares_per_sec need to be positive integers.");
+		return false;
+	}
+
 	if(!prv->configValues[iVerboseLevel]->IsUint64() || !prv->configValues[iAutohashTime]->IsUint64())
 	{
 		printer::inst()->print_msg(L0,
@@ -416,6 +533,20 @@ bool jconf::parse_config(const char* sFilename)
 		return false;
 	}
 
+	if(!prv->configValues[iKernelProfile]->IsUint64() || prv->configValues[iKernelProfile]->GetUint64() > 0xFFFFFFFF)
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. kernel_profile needs to be a non-negative integer.");
+		return false;
+	}
+
+	if(!prv->configValues[iDnsCacheTime]->IsUint64())
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. dns_cache_time needs to be a positive integer.");
+		return false;
+	}
+
 	if(!prv->configValues[iHttpdPort]->IsUint() || prv->configValues[iHttpdPort]->GetUint() > 0xFFFF)
 	{
 		printer::inst()->print_msg(L0,
@@ -423,6 +554,27 @@ bool jconf::parse_config(const char* sFilename)
 		return false;
 	}
 
+	if(!prv->configValues[iProxyPort]->IsUint() || prv->configValues[iProxyPort]->GetUint() > 0xFFFF)
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. proxy_port has to be in the range 0 to 65535.");
+		return false;
+	}
+
+	// The proxy hands out the nonce byte that a NiceHash pool already set, and our own threads
+	// only get the bottom 24 bits of the nonce, just like in NiceHash mode
+	if(GetProxyPort() != 0 && NiceHashMode())
+	{
+		printer::inst()->print_msg(L0, "Invalid config file. Proxy mode can't be used with nicehash_nonce.");
+		return false;
+	}
+
+	if(GetProxyPort() != 0 && n_thd >= 32)
+	{
+		printer::inst()->print_msg(L0, "You need to use less than 32 threads in proxy mode.");
+		return false;
+	}
+
 #ifdef CONF_NO_TLS
 	if(prv->configValues[bTlsMode]->GetBool())
 	{
@@ -19,6 +19,12 @@ public:
 		long long iCpuAff;
 	};
 
+	struct pool_cfg {
+		const char* sPoolAddr;
+		const char* sWalletAddr;
+		const char* sPasswd;
+	};
+
 	enum slow_mem_cfg {
 		always_use,
 		no_mlck,
@@ -40,20 +46,34 @@ public:
 	const char* GetPoolPwd();
 	const char* GetWalletAddress();
 
+	// Pool zero is the one above, the failover pools follow in config order
+	size_t GetPoolCount();
+	bool GetPoolConfig(size_t id, pool_cfg &cfg);
+	bool HotStandby();
+
 	uint64_t GetVerboseLevel();
 	uint64_t GetAutohashTime();
+	uint64_t GetKernelProfile();
 
 	const char* GetOutputFile();
 
 	uint64_t GetCallTimeout();
 	uint64_t GetNetRetry();
 	uint64_t GetGiveUpLimit();
+	uint64_t GetTcpKeepaliveTime();
+	uint64_t GetTcpKeepaliveInterval();
+	uint64_t GetKeepalivedTime();
+
+	uint64_t GetMinShareDiff();
+	uint64_t GetMaxSharesPerSec();
 
 	uint16_t GetHttpdPort();
+	uint16_t GetProxyPort();
 
 	bool NiceHashMode();
 
 	bool PreferIpv4();
+	uint64_t GetDnsCacheTime();
 
 	inline bool HaveHardwareAes() { return bHaveAes; }
 
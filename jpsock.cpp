@@ -27,9 +27,11 @@
 #include "jpsock.h"
 #include "executor.h"
 #include "jconf.h"
+#include "console.h"
+#include "hexcodec.h"
+#include "stratum.h"
 
-#include "rapidjson/document.h"
-#include "jext.h"
+#include "rapidjson/internal/itoa.h"
 #include "socks.h"
 #include "socket.h"
 
@@ -37,23 +39,6 @@
 
 using namespace rapidjson;
 
-struct jpsock::call_rsp
-{
-	bool bHaveResponse;
-	uint64_t iCallId;
-	Value* pCallData;
-	std::string sCallErr;
-
-	call_rsp(Value* val) : pCallData(val)
-	{
-		bHaveResponse = false;
-		iCallId = 0;
-		sCallErr.clear();
-	}
-};
-
-typedef GenericDocument<UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<>> MemDocument;
-
 /*
  *
  * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
@@ -63,45 +48,16 @@ typedef GenericDocument<UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<>> Me
  * doing it via an executor event.
  * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
  *
- * Call values and allocators are for the calling thread (executor). When processing
- * a call, the recv thread will make a copy of the call response and then erase its copy.
+ * The parser is only used by the reactor thread while it holds sock_mutex. Call
+ * replies are processed in place and what the executor needs from them is passed on in
+ * an event, so there is nothing to copy out of the network buffer.
  */
 
-struct jpsock::opaque_private
-{
-	Value  oCallValue;
-
-	MemoryPoolAllocator<> callAllocator;
-	MemoryPoolAllocator<> recvAllocator;
-	MemoryPoolAllocator<> parseAllocator;
-	MemDocument jsonDoc;
-	call_rsp oCallRsp;
-
-	opaque_private(uint8_t* bCallMem, uint8_t* bRecvMem, uint8_t* bParseMem) :
-		callAllocator(bCallMem, jpsock::iJsonMemSize),
-		recvAllocator(bRecvMem, jpsock::iJsonMemSize),
-		parseAllocator(bParseMem, jpsock::iJsonMemSize),
-		jsonDoc(&recvAllocator, jpsock::iJsonMemSize, &parseAllocator),
-		oCallRsp(nullptr)
-	{
-	}
-};
-
-struct jpsock::opq_json_val
-{
-	const Value* val;
-	opq_json_val(const Value* val) : val(val) {}
-};
-
 jpsock::jpsock(size_t id, bool tls) : pool_id(id)
 {
 	sock_init();
 
-	bJsonCallMem = (uint8_t*)malloc(iJsonMemSize);
-	bJsonRecvMem = (uint8_t*)malloc(iJsonMemSize);
-	bJsonParseMem = (uint8_t*)malloc(iJsonMemSize);
-
-	prv = new opaque_private(bJsonCallMem, bJsonRecvMem, bJsonParseMem);
+	parser = new stratum_parser();
 
 #ifndef CONF_NO_TLS
 	if(tls)
@@ -112,27 +68,41 @@ jpsock::jpsock(size_t id, bool tls) : pool_id(id)
 	sck = new plain_socket(this);
 #endif
 
-	oRecvThd = nullptr;
 	bRunning = false;
 	bLoggedIn = false;
+	bConnected = false;
+	bReplay = false;
+	bHaveSocketError = false;
 	iJobDiff = 0;
-
-	memset(&oCurrentJob, 0, sizeof(oCurrentJob));
+	iJobGen = 0;
+	iLoginTime = 0;
+	memset(bPrevBlockId, 0, sizeof(bPrevBlockId));
+
+	memset(oCalls, 0, sizeof(oCalls));
+	iNextCallId = 1;
+	iLastSendTime = 0;
+	iKeepaliveId = 0;
+	bKeepaliveOff = false;
+
+	iConnGen = 0;
+	iConnectTimer = reactor::invalid_timer;
+	iCallTimer = reactor::invalid_timer;
+	iRecvBufSize = iSockBufferSize;
+	bRecvBuf = (char*)malloc(iRecvBufSize);
+	iRecvPos = iScanPos = iRecvLen = 0;
+
+	iCurrentResume = 0;
 }
 
 jpsock::~jpsock()
 {
-	delete prv;
-	prv = nullptr;
+	delete parser;
+	parser = nullptr;
 
-	free(bJsonCallMem);
-	free(bJsonRecvMem);
-	free(bJsonParseMem);
-}
+	delete sck;
+	sck = nullptr;
 
-std::string&& jpsock::get_call_error()
-{
-	return std::move(prv->oCallRsp.sCallErr);
+	free(bRecvBuf);
 }
 
 bool jpsock::set_socket_error(const char* a)
@@ -185,432 +155,606 @@ bool jpsock::set_socket_error_strerr(const char* a, int res)
 	return set_socket_error(a, sock_gai_strerror(res, sSockErrText, sizeof(sSockErrText)));
 }
 
-void jpsock::jpsock_thread()
+// Needs sock_mutex. Tears down the connection and tells the executor - exactly once per connection.
+void jpsock::close_with_error()
 {
-	jpsock_thd_main();
-	executor::inst()->push_event(ex_event(std::move(sSocketError), pool_id));
+	if(!bRunning)
+		return;
+
+	sck->close();
+
+	reactor::inst()->del_timer(iConnectTimer);
+	reactor::inst()->del_timer(iCallTimer);
+	iConnectTimer = reactor::invalid_timer;
+	iCallTimer = reactor::invalid_timer;
 
-	// If a call is wating, send an error to end it
-	bool bCallWaiting = false;
-	std::unique_lock<std::mutex> mlock(call_mutex);
-	if(prv->oCallRsp.pCallData != nullptr)
+	// Results that were still waiting for a reply are lost
+	uint64_t iNow = reactor::get_ms_time();
+	for(size_t i = 0; i < iMaxCalls; i++)
 	{
-		prv->oCallRsp.bHaveResponse = true;
-		prv->oCallRsp.iCallId = 0;
-		prv->oCallRsp.pCallData = nullptr;
-		bCallWaiting = true;
+		if(oCalls[i].type == call_submit)
+		{
+			executor::inst()->push_event(ex_event(pool_result("[NETWORK ERROR]", oCalls[i].iActualDiff,
+				uint32_t(iNow - oCalls[i].iSendTime), true, oCalls[i].iProxyTag), pool_id));
+		}
+		oCalls[i].type = call_none;
 	}
-	mlock.unlock();
+	iKeepaliveId = 0;
 
-	if(bCallWaiting)
-		call_cond.notify_one();
+	set_socket_error("RECEIVE error: socket closed");
 
 	bRunning = false;
 	bLoggedIn = false;
+	bConnected = false;
 
-	std::unique_lock<std::mutex>(job_mutex);
-	memset(&oCurrentJob, 0, sizeof(oCurrentJob));
+	executor::inst()->push_event(ex_event(std::move(sSocketError), pool_id));
+
+	std::unique_lock<std::mutex> lck(job_mutex);
+	oCurrentJob.reset();
 }
 
-bool jpsock::jpsock_thd_main()
+void jpsock::on_sock_event(uint32_t iEvents)
 {
-	if(!sck->connect())
-		return false;
+	std::unique_lock<std::mutex> lck(sock_mutex);
 
-	executor::inst()->push_event(ex_event(EV_SOCK_READY, pool_id));
+	if(!bRunning)
+		return;
 
-	char buf[iSockBufferSize];
-	size_t datalen = 0;
+	if(!bConnected)
+	{
+		int ret = sck->handshake();
+		if(ret < 0)
+		{
+			close_with_error();
+			return;
+		}
+
+		if(ret == 0)
+			return;
+
+		bConnected = true;
+		reactor::inst()->del_timer(iConnectTimer);
+		iConnectTimer = reactor::invalid_timer;
+
+		executor::inst()->push_event(ex_event(EV_SOCK_READY, pool_id));
+
+		// TLS can have data sitting in its own buffers already
+		iEvents |= reactor::ev_read;
+	}
+
+	if((iEvents & reactor::ev_write) != 0 && !sck->flush())
+	{
+		close_with_error();
+		return;
+	}
+
+	if((iEvents & (reactor::ev_read | reactor::ev_error)) != 0 && !read_lines())
+		close_with_error();
+}
+
+bool jpsock::read_lines()
+{
 	while (true)
 	{
-		int ret = sck->recv(buf + datalen, sizeof(buf) - datalen);
+		if (iRecvLen == iRecvBufSize && !make_recv_room())
+			return false;
 
-		if(ret <= 0)
+		int ret = sck->recv(bRecvBuf + iRecvLen, iRecvBufSize - iRecvLen);
+
+		if(ret < 0)
 			return false;
 
-		datalen += ret;
+		if(ret == 0)
+			return true; // No more data for now
 
-		if (datalen >= sizeof(buf))
-		{
-			sck->close(false);
-			return set_socket_error("RECEIVE error: data overflow");
-		}
+		iRecvLen += ret;
 
 		char* lnend;
-		char* lnstart = buf;
-		while ((lnend = (char*)memchr(lnstart, '\n', datalen)) != nullptr)
+		while ((lnend = (char*)memchr(bRecvBuf + iScanPos, '\n', iRecvLen - iScanPos)) != nullptr)
 		{
+			char* lnstart = bRecvBuf + iRecvPos;
 			lnend++;
-			int lnlen = lnend - lnstart;
+			size_t lnlen = lnend - lnstart;
 
 			if (!process_line(lnstart, lnlen))
-			{
-				sck->close(false);
 				return false;
-			}
 
-			datalen -= lnlen;
-			lnstart = lnend;
+			iRecvPos += lnlen;
+			iScanPos = iRecvPos;
 		}
 
-		//Got leftover data? Move it to the front
-		if (datalen > 0 && buf != lnstart)
-			memmove(buf, lnstart, datalen);
+		iScanPos = iRecvLen;
+
+		// Everything got parsed, start from the front again
+		if (iRecvPos == iRecvLen)
+			iRecvPos = iScanPos = iRecvLen = 0;
 	}
 }
 
-bool jpsock::process_line(char* line, size_t len)
+// We ran out of space at the end of the buffer. If there are parsed lines in front of the partial one
+// we move it down (once per buffer, not once per read), otherwise the line is too long and we grow.
+bool jpsock::make_recv_room()
 {
-	prv->jsonDoc.SetNull();
-	prv->parseAllocator.Clear();
-	prv->callAllocator.Clear();
+	if (iRecvPos > 0)
+	{
+		iRecvLen -= iRecvPos;
+		iScanPos -= iRecvPos;
+		memmove(bRecvBuf, bRecvBuf + iRecvPos, iRecvLen);
+		iRecvPos = 0;
+		return true;
+	}
+
+	if (iRecvBufSize >= iMaxSockBufferSize)
+		return set_socket_error("RECEIVE error: data overflow");
+
+	char* bNewBuf = (char*)realloc(bRecvBuf, iRecvBufSize * 2);
+	if (bNewBuf == nullptr)
+		return set_socket_error("RECEIVE error: out of memory");
+
+	bRecvBuf = bNewBuf;
+	iRecvBufSize *= 2;
+	return true;
+}
 
+bool jpsock::process_line(char* line, size_t len)
+{
 	/*NULL terminate the line instead of '\n', parsing will add some more NULLs*/
 	line[len-1] = '\0';
 
 	//printf("RECV: %s\n", line);
 
-	if (prv->jsonDoc.ParseInsitu(line).HasParseError())
+	stratum_msg msg;
+	if (!parser->parse(line, msg))
 		return set_socket_error("PARSE error: Invalid JSON");
 
-	if (!prv->jsonDoc.IsObject())
+	if (!msg.bObject)
 		return set_socket_error("PARSE error: Invalid root");
 
-	const Value* mt;
-	if (prv->jsonDoc.HasMember("method"))
+	if (msg.method.type != jt_none)
 	{
-		mt = GetObjectMember(prv->jsonDoc, "method");
-
-		if(!mt->IsString())
+		if(msg.method.type != jt_string)
 			return set_socket_error("PARSE error: Protocol error 1");
 
-		if(strcmp(mt->GetString(), "job") != 0)
-			return set_socket_error("PARSE error: Unsupported server method ", mt->GetString());
+		if(!msg.method.is("job"))
+			return set_socket_error("PARSE error: Unsupported server method ", msg.method.str);
 
-		mt = GetObjectMember(prv->jsonDoc, "params");
-		if(mt == nullptr || !mt->IsObject())
+		if(msg.params.type != jt_object)
 			return set_socket_error("PARSE error: Protocol error 2");
 
-		opq_json_val v(mt);
-		return process_pool_job(&v);
+		return process_pool_job(msg.oParams);
 	}
 	else
 	{
-		uint64_t iCallId;
-		mt = GetObjectMember(prv->jsonDoc, "id");
-		if (mt == nullptr || !mt->IsUint64())
+		if (msg.id.type != jt_uint)
 			return set_socket_error("PARSE error: Protocol error 3");
 
-		iCallId = mt->GetUint64();
-
-		mt = GetObjectMember(prv->jsonDoc, "error");
-
 		const char* sError = nullptr;
 		size_t iErrorLn = 0;
-		if (mt == nullptr || mt->IsNull())
+		if (msg.error.type == jt_none || msg.error.type == jt_null)
 		{
 			/* If there was no error we need a result */
-			if ((mt = GetObjectMember(prv->jsonDoc, "result")) == nullptr)
+			if (msg.result.type == jt_none)
 				return set_socket_error("PARSE error: Protocol error 7");
 		}
 		else
 		{
-			if(!mt->IsObject())
+			if(msg.error.type != jt_object)
 				return set_socket_error("PARSE error: Protocol error 5");
 
-			const Value* msg = GetObjectMember(*mt, "message");
-
-			if(msg == nullptr || !msg->IsString())
+			if(msg.error_msg.type != jt_string)
 				return set_socket_error("PARSE error: Protocol error 6");
 
-			iErrorLn = msg->GetStringLength();
-			sError = msg->GetString();
+			iErrorLn = msg.error_msg.len;
+			sError = msg.error_msg.str;
 		}
 
-		std::unique_lock<std::mutex> mlock(call_mutex);
-		if (prv->oCallRsp.pCallData == nullptr)
-		{
-			/*Server sent us a call reply without us making a call*/
-			mlock.unlock();
-			return set_socket_error("PARSE error: Unexpected call response");
-		}
+		return process_call_reply(msg, sError, iErrorLn);
+	}
+}
 
-		prv->oCallRsp.bHaveResponse = true;
-		prv->oCallRsp.iCallId = iCallId;
+bool jpsock::process_call_reply(const stratum_msg& msg, const char* sError, size_t iErrorLn)
+{
+	uint64_t iCallId = msg.id.num;
+
+	call_slot& slot = oCalls[iCallId % iMaxCalls];
+	if (slot.type == call_none || slot.iCallId != iCallId)
+	{
+		// A recording has the replies to the calls that the recorded session made
+		if(bReplay)
+			return msg.job.type == jt_none || process_login(msg);
+
+		/*Server sent us a call reply without us making a call*/
+		return set_socket_error("PARSE error: Unexpected call response");
+	}
+
+	call_type type = slot.type;
+	uint64_t iActualDiff = slot.iActualDiff;
+	uint64_t iProxyTag = slot.iProxyTag;
+	uint32_t iCallTime = uint32_t(reactor::get_ms_time() - slot.iSendTime);
+	slot.type = call_none;
 
+	switch(type)
+	{
+	case call_login:
+		/*Normal error conditions (failed login etc..) will end here*/
 		if(sError != nullptr)
-		{
-			prv->oCallRsp.pCallData = nullptr;
-			prv->oCallRsp.sCallErr.assign(sError, iErrorLn);
-		}
+			return set_socket_error("LOGIN error: ", sError);
+		iLoginTime = iCallTime;
+		return process_login(msg);
+
+	case call_submit:
+		if(sError != nullptr)
+			executor::inst()->push_event(ex_event(pool_result(std::string(sError, iErrorLn), iActualDiff, iCallTime, false, iProxyTag), pool_id));
 		else
-			prv->oCallRsp.pCallData->CopyFrom(*mt, prv->callAllocator);
+			executor::inst()->push_event(ex_event(pool_result(iActualDiff, iCallTime, iProxyTag), pool_id));
+		return true;
 
-		mlock.unlock();
-		call_cond.notify_one();
+	case call_keepalive:
+		iKeepaliveId = 0;
+		if(sError != nullptr)
+		{
+			bKeepaliveOff = true;
+			printer::inst()->print_msg(L3, "Pool doesn't take keepalives (%.*s), not sending any more.", int(iErrorLn), sError);
+		}
+		return true;
 
+	default:
 		return true;
 	}
 }
 
-bool jpsock::process_pool_job(const opq_json_val* params)
+bool jpsock::replay_line(char* line, size_t len, std::string& sError)
 {
-	if (!params->val->IsObject())
+	std::unique_lock<std::mutex> lck(sock_mutex);
+
+	bReplay = true;
+	if(process_line(line, len))
+		return true;
+
+	sError = std::move(sSocketError);
+	sSocketError.clear();
+	bHaveSocketError = false;
+	return false;
+}
+
+bool jpsock::process_login(const stratum_msg& msg)
+{
+	if (msg.result.type != jt_object)
+		return set_socket_error("PARSE error: Login protocol error 1");
+
+	if (msg.miner_id.type != jt_string || msg.job.type == jt_none)
+		return set_socket_error("PARSE error: Login protocol error 2");
+
+	if (msg.miner_id.len >= sizeof(sMinerId))
+		return set_socket_error("PARSE error: Login protocol error 3");
+
+	if (msg.job.type != jt_object)
 		return set_socket_error("PARSE error: Job error 1");
 
-	const Value * blob, *jobid, *target;
-	jobid = GetObjectMember(*params->val, "job_id");
-	blob = GetObjectMember(*params->val, "blob");
-	target = GetObjectMember(*params->val, "target");
+	memset(sMinerId, 0, sizeof(sMinerId));
+	memcpy(sMinerId, msg.miner_id.str, msg.miner_id.len);
+	build_submit_template();
 
-	if (jobid == nullptr || blob == nullptr || target == nullptr ||
-		!jobid->IsString() || !blob->IsString() || !target->IsString())
-	{
-		return set_socket_error("PARSE error: Job error 2");
-	}
+	// Jobs from the last session are no good with the new miner id
+	iJobGen++;
 
-	if (jobid->GetStringLength() >= sizeof(pool_job::sJobID)) // Note >=
-		return set_socket_error("PARSE error: Job error 3");
+	// Executor needs to know that we are in before it gets the first job
+	bLoggedIn = true;
+	executor::inst()->push_event(ex_event(EV_POOL_LOGGED_IN, pool_id));
 
-	uint32_t iWorkLn = blob->GetStringLength() / 2;
-	if (iWorkLn > sizeof(pool_job::bWorkBlob))
-		return set_socket_error("PARSE error: Invalid job legth. Are you sure you are mining the correct coin?");
+	return process_pool_job(msg.oLoginJob);
+}
 
-	pool_job oPoolJob;
-	if (!hex2bin(blob->GetString(), iWorkLn * 2, oPoolJob.bWorkBlob))
-		return set_socket_error("PARSE error: Job error 4");
+bool jpsock::process_pool_job(const stratum_job& job)
+{
+	// This is the only place that writes to the job, from here on it is shared through oJob
+	pool_job* oPoolJob = pool_job::alloc();
+	job_ref oJob(oPoolJob);
 
-	oPoolJob.iWorkLen = iWorkLn;
-	memset(oPoolJob.sJobID, 0, sizeof(pool_job::sJobID));
-	memcpy(oPoolJob.sJobID, jobid->GetString(), jobid->GetStringLength()); //Bounds checking at proto error 3
+	const char* sError = stratum_parser::decode_job(job, *oPoolJob);
+	if (sError != nullptr)
+		return set_socket_error(sError);
 
-	size_t target_slen = target->GetStringLength();
-	if(target_slen <= 8)
-	{
-		uint32_t iTempInt = 0;
-		char sTempStr[] = "00000000"; // Little-endian CPU FTW
-		memcpy(sTempStr, target->GetString(), target_slen);
-		if(!hex2bin(sTempStr, 8, (unsigned char*)&iTempInt) || iTempInt == 0)
-			return set_socket_error("PARSE error: Invalid target");
+	uint32_t iWorkLn = oPoolJob->iWorkLen;
+	iJobDiff = t64_to_diff(oPoolJob->iTarget);
 
-		oPoolJob.iTarget = t32_to_t64(iTempInt);
-	}
-	else if(target_slen <= 16)
+	// Like the miner (nonce at 39), we assume a 7 byte header start, so the previous block id is at 7.
+	// If it changed, everything we found for the old block is stale.
+	if (iWorkLn >= 39 && memcmp(bPrevBlockId, oPoolJob->bWorkBlob + 7, sizeof(bPrevBlockId)) != 0)
 	{
-		oPoolJob.iTarget = 0;
-		char sTempStr[] = "0000000000000000";
-		memcpy(sTempStr, target->GetString(), target_slen);
-		if(!hex2bin(sTempStr, 16, (unsigned char*)&oPoolJob.iTarget) || oPoolJob.iTarget == 0)
-			return set_socket_error("PARSE error: Invalid target");
+		memcpy(bPrevBlockId, oPoolJob->bWorkBlob + 7, sizeof(bPrevBlockId));
+		iJobGen++;
 	}
-	else
-		return set_socket_error("PARSE error: Job error 5");
+	oPoolJob->iJobGen = iJobGen;
 
-	iJobDiff = t64_to_diff(oPoolJob.iTarget);
+	executor::inst()->push_event(ex_event(oJob, pool_id));
 
-	executor::inst()->push_event(ex_event(oPoolJob, pool_id));
-
-	std::unique_lock<std::mutex>(job_mutex);
-	oCurrentJob = oPoolJob;
+	std::unique_lock<std::mutex> lck(job_mutex);
+	oCurrentJob = std::move(oJob);
+	iCurrentResume = 0;
 	return true;
 }
 
 bool jpsock::connect(const char* sAddr, std::string& sConnectError)
 {
+	// A cold DNS cache means a wait for the resolver, the reactor shouldn't be stuck on sock_mutex meanwhile
+	pool_addr oAddr;
+	std::string sResolveError;
+	bool bResolved = resolve_pool_addr(sAddr, oAddr, sResolveError);
+
+	std::unique_lock<std::mutex> lck(sock_mutex);
+
 	bHaveSocketError = false;
 	sSocketError.clear();
 	iJobDiff = 0;
-
-	if(sck->set_hostname(sAddr))
+	iRecvPos = iScanPos = iRecvLen = 0;
+	iKeepaliveId = 0;
+	bKeepaliveOff = false;
+	iConnGen++;
+
+	if(!bResolved)
+		set_socket_error(sResolveError.c_str());
+	else if(sck->set_address(oAddr) && sck->connect())
 	{
 		bRunning = true;
-		oRecvThd = new std::thread(&jpsock::jpsock_thread, this);
+
+		size_t iGen = iConnGen;
+		iConnectTimer = reactor::inst()->add_timer(jconf::inst()->GetCallTimeout() * 1000, [this, iGen]() {
+			std::unique_lock<std::mutex> lck(sock_mutex);
+			if(iGen != iConnGen || !bRunning || bConnected)
+				return;
+
+			iConnectTimer = reactor::invalid_timer;
+			set_socket_error("CONNECT error: Timeout while connecting");
+			close_with_error();
+		});
+
 		return true;
 	}
 
+	sck->close();
 	sConnectError = std::move(sSocketError);
 	return false;
 }
 
 void jpsock::disconnect()
 {
-	sck->close(false);
+	std::unique_lock<std::mutex> lck(sock_mutex);
+	set_socket_error("RECEIVE error: socket closed");
+	close_with_error();
+}
+
+// Needs sock_mutex. Returns the call id, or 0 if we have no room for another call.
+uint64_t jpsock::start_call(call_type type, uint64_t iActualDiff, uint64_t iProxyTag)
+{
+	uint64_t iCallId = iNextCallId;
+	call_slot& slot = oCalls[iCallId % iMaxCalls];
+
+	if(slot.type != call_none)
+		return 0;
 
-	if(oRecvThd != nullptr)
+	iNextCallId++;
+	slot.iCallId = iCallId;
+	slot.iSendTime = reactor::get_ms_time();
+	slot.iActualDiff = iActualDiff;
+	slot.iProxyTag = iProxyTag;
+	slot.type = type;
+
+	if(iCallTimer == reactor::invalid_timer)
 	{
-		oRecvThd->join();
-		delete oRecvThd;
-		oRecvThd = nullptr;
+		size_t iGen = iConnGen;
+		iCallTimer = reactor::inst()->add_timer(jconf::inst()->GetCallTimeout() * 1000,
+			[this, iGen]() { check_call_timeout(iGen); });
 	}
 
-	sck->close(true);
+	return iCallId;
 }
 
-bool jpsock::cmd_ret_wait(const char* sPacket, opq_json_val& poResult)
+// Needs sock_mutex
+bool jpsock::send_call(uint64_t iCallId, const char* sPacket, size_t iPacketLen)
 {
-	//printf("SEND: %s\n", sPacket);
-
-	/*Set up the call rsp for the call reply*/
-	prv->oCallValue.SetNull();
-	prv->callAllocator.Clear();
-
-	std::unique_lock<std::mutex> mlock(call_mutex);
-	prv->oCallRsp = call_rsp(&prv->oCallValue);
-	mlock.unlock();
+	//printf("SEND: %.*s", (int)iPacketLen, sPacket);
 
-	if(!sck->send(sPacket))
+	if(!sck->send(sPacket, iPacketLen))
 	{
-		disconnect(); //This will join the other thread;
+		// The caller reports this one, don't report it again as a lost result
+		oCalls[iCallId % iMaxCalls].type = call_none;
+		close_with_error();
 		return false;
 	}
 
-	//Success is true if the server approves, result is true if there was no socket error
-	bool bSuccess;
-	mlock.lock();
-	bool bResult = call_cond.wait_for(mlock, std::chrono::seconds(jconf::inst()->GetCallTimeout()),
-		[&]() { return prv->oCallRsp.bHaveResponse; });
+	iLastSendTime = reactor::get_ms_time();
+	return true;
+}
 
-	bSuccess = prv->oCallRsp.pCallData != nullptr;
-	prv->oCallRsp.pCallData = nullptr;
-	mlock.unlock();
+void jpsock::check_call_timeout(size_t iGen)
+{
+	std::unique_lock<std::mutex> lck(sock_mutex);
 
-	if(bHaveSocketError)
-		return false;
+	if(iGen != iConnGen || !bRunning)
+		return;
+
+	iCallTimer = reactor::invalid_timer;
+
+	bool bHaveCalls = false;
+	uint64_t iOldest = 0;
+	for(size_t i = 0; i < iMaxCalls; i++)
+	{
+		if(oCalls[i].type != call_none && (!bHaveCalls || oCalls[i].iSendTime < iOldest))
+		{
+			iOldest = oCalls[i].iSendTime;
+			bHaveCalls = true;
+		}
+	}
+
+	if(!bHaveCalls)
+		return;
+
+	uint64_t iTimeout = jconf::inst()->GetCallTimeout() * 1000;
+	uint64_t iAge = reactor::get_ms_time() - iOldest;
 
 	//This means that there was no socket error, but the server is not taking to us
-	if(!bResult)
+	if(iAge >= iTimeout)
 	{
 		set_socket_error("CALL error: Timeout while waiting for a reply");
-		disconnect();
-		return false;
+		close_with_error();
+		return;
 	}
 
-	if(bSuccess)
-		poResult.val = &prv->oCallValue;
-
-	return bSuccess;
+	iCallTimer = reactor::inst()->add_timer(iTimeout - iAge, [this, iGen]() { check_call_timeout(iGen); });
 }
 
 bool jpsock::cmd_login(const char* sLogin, const char* sPassword)
 {
 	char cmd_buffer[1024];
 
-	snprintf(cmd_buffer, sizeof(cmd_buffer), "{\"method\":\"login\",\"params\":{\"login\":\"%s\",\"pass\":\"%s\",\"agent\":\"" AGENTID_STR "\"},\"id\":1}\n",
-		sLogin, sPassword);
-
-	opq_json_val oResult(nullptr);
+	std::unique_lock<std::mutex> lck(sock_mutex);
 
-	/*Normal error conditions (failed login etc..) will end here*/
-	if (!cmd_ret_wait(cmd_buffer, oResult))
+	// Every way out of here without a login in flight ends up as a socket error, so the executor retries.
+	// Not connected means this connection is already gone and has reported it, or that a newer one is
+	// still on its way up and will send its own EV_SOCK_READY - either way there is nothing to close.
+	if(!bConnected)
 		return false;
 
-	if (!oResult.val->IsObject())
+	uint64_t iCallId = start_call(call_login, 0, 0);
+	if(iCallId == 0)
 	{
-		set_socket_error("PARSE error: Login protocol error 1");
-		disconnect();
+		set_socket_error("LOGIN error: no free call slot");
+		close_with_error();
 		return false;
 	}
 
-	const Value* id = GetObjectMember(*oResult.val, "id");
-	const Value* job = GetObjectMember(*oResult.val, "job");
+	int len = snprintf(cmd_buffer, sizeof(cmd_buffer), "{\"method\":\"login\",\"params\":{\"login\":\"%s\",\"pass\":\"%s\",\"agent\":\"" AGENTID_STR "\"},\"id\":%llu}\n",
+		sLogin, sPassword, int_port(iCallId));
 
-	if (id == nullptr || job == nullptr || !id->IsString())
+	if(len < 0 || size_t(len) >= sizeof(cmd_buffer))
 	{
-		set_socket_error("PARSE error: Login protocol error 2");
-		disconnect();
+		oCalls[iCallId % iMaxCalls].type = call_none;
+		set_socket_error("LOGIN error: Login or password too long");
+		close_with_error();
 		return false;
 	}
 
-	if (id->GetStringLength() >= sizeof(sMinerId))
-	{
-		set_socket_error("PARSE error: Login protocol error 3");
-		disconnect();
-		return false;
-	}
+	/*The reply is handled by the reactor, a failed login will end the connection*/
+	return send_call(iCallId, cmd_buffer, len);
+}
 
-	memset(sMinerId, 0, sizeof(sMinerId));
-	memcpy(sMinerId, id->GetString(), id->GetStringLength());
+/*
+ * The submit packet only changes in a few places, so we render it once per login:
+ * {"method":"submit","params":{"id":"<miner id>","nonce":"<8>","result":"<64>","job_id":"
+ * Nonce and result get patched in place, the job id and call id are appended after that.
+ * Needs sock_mutex.
+ */
+void jpsock::build_submit_template()
+{
+	static const char sHead[] = "{\"method\":\"submit\",\"params\":{\"id\":\"";
+	static const char sNonce[] = "\",\"nonce\":\"";
+	static const char sResult[] = "\",\"result\":\"";
+	static const char sJobId[] = "\",\"job_id\":\"";
+
+	char* p = sSubmitBuf;
+	size_t iMinerIdLen = strlen(sMinerId);
+
+	memcpy(p, sHead, sizeof(sHead) - 1);
+	p += sizeof(sHead) - 1;
+	memcpy(p, sMinerId, iMinerIdLen);
+	p += iMinerIdLen;
+	memcpy(p, sNonce, sizeof(sNonce) - 1);
+	p += sizeof(sNonce) - 1;
+
+	iSubmitNonceOff = p - sSubmitBuf;
+	memset(p, '0', 8);
+	p += 8;
+	memcpy(p, sResult, sizeof(sResult) - 1);
+	p += sizeof(sResult) - 1;
+
+	iSubmitResultOff = p - sSubmitBuf;
+	memset(p, '0', 64);
+	p += 64;
+	memcpy(p, sJobId, sizeof(sJobId) - 1);
+	p += sizeof(sJobId) - 1;
+
+	iSubmitFixedLen = p - sSubmitBuf;
+}
 
-	opq_json_val v(job);
-	if(!process_pool_job(&v))
-	{
-		disconnect();
+bool jpsock::cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bResult, uint64_t iProxyTag)
+{
+	static const char sTail[] = "\"},\"id\":";
+
+	uint64_t iHashVal = ((const uint64_t*)bResult)[3];
+	uint64_t iActualDiff = iHashVal != 0 ? t64_to_diff(iHashVal) : 0xFFFFFFFFFFFFFFFFULL;
+	size_t iJobIdLen = strnlen(sJobId, sizeof(pool_job::sJobID) - 1);
+
+	std::unique_lock<std::mutex> lck(sock_mutex);
+
+	if(!bRunning || !bLoggedIn)
 		return false;
-	}
 
-	bLoggedIn = true;
+	uint64_t iCallId = start_call(call_submit, iActualDiff, iProxyTag);
+	if(iCallId == 0)
+		return false;
 
-	return true;
+	hex_encode((const uint8_t*)&iNonce, 4, sSubmitBuf + iSubmitNonceOff);
+	hex_encode(bResult, 32, sSubmitBuf + iSubmitResultOff);
+
+	char* p = sSubmitBuf + iSubmitFixedLen;
+	memcpy(p, sJobId, iJobIdLen);
+	p += iJobIdLen;
+	memcpy(p, sTail, sizeof(sTail) - 1);
+	p += sizeof(sTail) - 1;
+	p = internal::u64toa(iCallId, p);
+	*p++ = '}';
+	*p++ = '\n';
+
+	return send_call(iCallId, sSubmitBuf, p - sSubmitBuf);
 }
 
-bool jpsock::cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bResult)
+bool jpsock::cmd_keepalive(uint64_t iIdleMs)
 {
-	char cmd_buffer[1024];
-	char sNonce[9];
-	char sResult[65];
+	char cmd_buffer[160];
 
-	bin2hex((unsigned char*)&iNonce, 4, sNonce);
-	sNonce[8] = '\0';
+	std::unique_lock<std::mutex> lck(sock_mutex);
 
-	bin2hex(bResult, 32, sResult);
-	sResult[64] = '\0';
+	if(!bRunning || !bLoggedIn || bKeepaliveOff || iKeepaliveId != 0)
+		return false;
 
-	snprintf(cmd_buffer, sizeof(cmd_buffer), "{\"method\":\"submit\",\"params\":{\"id\":\"%s\",\"job_id\":\"%s\",\"nonce\":\"%s\",\"result\":\"%s\"},\"id\":1}\n",
-		sMinerId, sJobId, sNonce, sResult);
+	uint64_t iNow = reactor::get_ms_time();
+	if(iNow - iLastSendTime < iIdleMs)
+		return false;
 
-	opq_json_val oResult(nullptr);
-	return cmd_ret_wait(cmd_buffer, oResult);
-}
+	// Times out like any other call, a pool that doesn't answer this is as good as gone
+	uint64_t iCallId = start_call(call_keepalive, 0, 0);
+	if(iCallId == 0)
+		return false;
 
-bool jpsock::get_current_job(pool_job& job)
-{
-	std::unique_lock<std::mutex>(job_mutex);
+	int len = snprintf(cmd_buffer, sizeof(cmd_buffer), "{\"method\":\"keepalived\",\"params\":{\"id\":\"%s\"},\"id\":%llu}\n",
+		sMinerId, int_port(iCallId));
 
-	if(oCurrentJob.iWorkLen == 0)
+	if(!send_call(iCallId, cmd_buffer, len))
 		return false;
 
-	oCurrentJob.iResumeCnt++;
-	job = oCurrentJob;
+	iKeepaliveId = iCallId;
 	return true;
 }
 
-inline unsigned char hf_hex2bin(char c, bool &err)
+bool jpsock::get_current_job(job_ref& job, uint32_t& iResumeCnt)
 {
-	if (c >= '0' && c <= '9')
-		return c - '0';
-	else if (c >= 'a' && c <= 'f')
-		return c - 'a' + 0xA;
-	else if (c >= 'A' && c <= 'F')
-		return c - 'A' + 0xA;
-
-	err = true;
-	return 0;
-}
+	std::unique_lock<std::mutex> lck(job_mutex);
 
-bool jpsock::hex2bin(const char* in, unsigned int len, unsigned char* out)
-{
-	bool error = false;
-	for (unsigned int i = 0; i < len; i += 2)
-	{
-		out[i / 2] = (hf_hex2bin(in[i], error) << 4) | hf_hex2bin(in[i + 1], error);
-		if (error) return false;
-	}
+	if(!oCurrentJob)
+		return false;
+
+	iResumeCnt = ++iCurrentResume;
+	job = oCurrentJob;
 	return true;
 }
 
-inline char hf_bin2hex(unsigned char c)
+bool jpsock::hex2bin(const char* in, unsigned int len, unsigned char* out)
 {
-	if (c <= 0x9)
-		return '0' + c;
-	else
-		return 'a' - 0xA + c;
+	return hex_decode(in, len, out);
 }
 
 void jpsock::bin2hex(const unsigned char* in, unsigned int len, char* out)
 {
-	for (unsigned int i = 0; i < len; i++)
-	{
-		out[i * 2] = hf_bin2hex((in[i] & 0xF0) >> 4);
-		out[i * 2 + 1] = hf_bin2hex(in[i] & 0x0F);
-	}
+	hex_encode(in, len, out);
 }
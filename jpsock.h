@@ -1,27 +1,36 @@
 #pragma once
 #include <mutex>
 #include <atomic>
-#include <condition_variable>
-#include <thread>
 #include <string>
 
 #include "msgstruct.h"
+#include "reactor.h"
 
 /* Our pool can have two kinds of errors:
 	- Parsing or connection error
 	Those are fatal errors (we drop the connection if we encounter them).
 	After they are constructed from const char* strings from various places.
 	(can be from read-only mem), we passs them in an exectutor message
-	once the recv thread expires.
+	once the connection is closed.
 	- Call error
 	This error happens when the "server says no". Usually because the job was
 	outdated, or we somehow got the hash wrong. It isn't fatal.
 	We parse it in-situ in the network buffer, after that we copy it to a
-	std::string. Executor will move the buffer via an r-value ref.
+	std::string and pass it to the executor with the call result.
+
+	Lines are parsed with a SAX handler that only picks up the few values we need,
+	so no DOM is ever built (see stratum.h).
+
+	There are no threads here. All socket events and timers are serviced by the
+	reactor thread, calls are made by the executor. Both sides hold sock_mutex.
+	Calls don't wait for the reply, the reply is delivered as an executor event.
 */
 class base_socket;
+class stratum_parser;
+struct stratum_job;
+struct stratum_msg;
 
-class jpsock
+class jpsock : public sock_handler
 {
 public:
 	jpsock(size_t id, bool tls);
@@ -31,7 +40,14 @@ public:
 	void disconnect();
 
 	bool cmd_login(const char* sLogin, const char* sPassword);
-	bool cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bResult);
+	bool cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bResult, uint64_t iProxyTag = 0);
+	// Sends "keepalived" if we didn't send anything for iIdleMs
+	bool cmd_keepalive(uint64_t iIdleMs);
+
+	// Takes a pool line from a recording instead of the socket, for the job replay. Replies to the
+	// calls of the recorded session are taken as they come, a login reply logs us in. False with the
+	// reason in sError on a line that a live connection would have dropped on.
+	bool replay_line(char* line, size_t len, std::string& sError);
 
 	static bool hex2bin(const char* in, unsigned int len, unsigned char* out);
 	static void bin2hex(const unsigned char* in, unsigned int len, char* out);
@@ -39,16 +55,21 @@ public:
 	inline bool is_running() { return bRunning; }
 	inline bool is_logged_in() { return bLoggedIn; }
 
-	std::string&& get_call_error();
-	bool have_sock_error() { return bHaveSocketError; }
-
 	inline static uint64_t t32_to_t64(uint32_t t) { return 0xFFFFFFFFFFFFFFFFULL / (0xFFFFFFFFULL / ((uint64_t)t)); }
 	inline static uint64_t t64_to_diff(uint64_t t) { return 0xFFFFFFFFFFFFFFFFULL / t; }
 	inline static uint64_t diff_to_t64(uint64_t d) { return 0xFFFFFFFFFFFFFFFFULL / d; }
 
 	inline uint64_t get_current_diff() { return iJobDiff; }
 
-	bool get_current_job(pool_job& job);
+	// Round trip of the last login call, in ms
+	inline uint32_t get_login_time() { return iLoginTime; }
+
+	// Goes up with every new block and every new login. Results for jobs from
+	// an older generation would only be rejected by the pool.
+	inline uint64_t get_job_gen() { return iJobGen; }
+
+	// Every call counts as a resume, so that threads restarting the job don't repeat nonces
+	bool get_current_job(job_ref& job, uint32_t& iResumeCnt);
 
 	size_t pool_id;
 
@@ -58,41 +79,85 @@ public:
 	bool set_socket_error_strerr(const char* a);
 	bool set_socket_error_strerr(const char* a, int res);
 
+	void on_sock_event(uint32_t iEvents);
+
 private:
 	std::atomic<bool> bRunning;
 	std::atomic<bool> bLoggedIn;
+	bool bConnected;
+	bool bReplay;
 
-	uint8_t* bJsonRecvMem;
-	uint8_t* bJsonParseMem;
-	uint8_t* bJsonCallMem;
-
-	static constexpr size_t iJsonMemSize = 4096;
+	// The receive buffer starts small and grows to fit the largest message we see
 	static constexpr size_t iSockBufferSize = 4096;
-
-	struct call_rsp;
-	struct opaque_private;
-	struct opq_json_val;
-
-	void jpsock_thread();
-	bool jpsock_thd_main();
+	static constexpr size_t iMaxSockBufferSize = 1024 * 1024;
+
+	enum call_type { call_none, call_login, call_submit, call_keepalive };
+
+	// Calls in flight, indexed by call id. Replies normally come back in order,
+	// so we will run out of calls only if the pool stops talking to us.
+	struct call_slot
+	{
+		uint64_t iCallId;
+		uint64_t iSendTime;
+		uint64_t iActualDiff;
+		uint64_t iProxyTag;
+		call_type type;
+	};
+	static constexpr size_t iMaxCalls = 256;
+	call_slot oCalls[iMaxCalls];
+	uint64_t iNextCallId;
+
+	// Keepalives are calls like the others, but there is at most one in flight, and none at
+	// all if the pool said it doesn't know them. iKeepaliveId is zero when none is out.
+	uint64_t iLastSendTime;
+	uint64_t iKeepaliveId;
+	bool bKeepaliveOff;
+
+	uint64_t start_call(call_type type, uint64_t iActualDiff, uint64_t iProxyTag);
+	bool send_call(uint64_t iCallId, const char* sPacket, size_t iPacketLen);
+	void check_call_timeout(size_t iGen);
+
+	void close_with_error();
+	bool read_lines();
+	bool make_recv_room();
 	bool process_line(char* line, size_t len);
-	bool process_pool_job(const opq_json_val* params);
-	bool cmd_ret_wait(const char* sPacket, opq_json_val& poResult);
+	bool process_call_reply(const stratum_msg& msg, const char* sError, size_t iErrorLn);
+	bool process_login(const stratum_msg& msg);
+	bool process_pool_job(const stratum_job& job);
 
 	char sMinerId[64];
+
+	// Miner id and job id are under 64 chars each, call id is at most 20 digits
+	void build_submit_template();
+	char sSubmitBuf[384];
+	size_t iSubmitNonceOff;
+	size_t iSubmitResultOff;
+	size_t iSubmitFixedLen;
 	std::atomic<uint64_t> iJobDiff;
+	std::atomic<uint64_t> iJobGen;
+	std::atomic<uint32_t> iLoginTime;
+	uint8_t bPrevBlockId[32];
 
 	std::string sSocketError;
 	std::atomic<bool> bHaveSocketError;
 
-	std::mutex call_mutex;
-	std::condition_variable call_cond;
-	std::thread* oRecvThd;
+	std::mutex sock_mutex;
+	size_t iConnGen;
+	size_t iConnectTimer;
+	size_t iCallTimer;
+
+	// Lines are parsed in place. Data between iRecvPos and iRecvLen is the partial line we are
+	// still waiting for, we already know that there is no '\n' before iScanPos.
+	char* bRecvBuf;
+	size_t iRecvBufSize;
+	size_t iRecvPos;
+	size_t iScanPos;
+	size_t iRecvLen;
 
 	std::mutex job_mutex;
-	pool_job oCurrentJob;
+	job_ref oCurrentJob;
+	uint32_t iCurrentResume;
 
-	opaque_private* prv;
+	stratum_parser* parser;
 	base_socket* sck;
 };
-
@@ -62,69 +62,76 @@ void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id)
 #include "executor.h"
 #include "minethd.h"
 #include "jconf.h"
+#include "tsc_clock.h"
+#include "hashcheck.h"
 #include "crypto/cryptonight.h"
 
+// 8 sec at 0.5 sec, 2.7 min at 5 sec, 64 min at 1 min and 32 hours at 15 min
+const telemetry::level telemetry::oLevels[telemetry::iLevelCnt] = {
+	{ 500, 16 }, { 5000, 32 }, { 60000, 64 }, { 900000, 128 }
+};
+const size_t telemetry::iSamplesPerThd = 16 + 32 + 64 + 128;
+
 telemetry::telemetry(size_t iThd)
 {
-	ppHashCounts = new uint64_t*[iThd];
-	ppTimestamps = new uint64_t*[iThd];
-	iBucketTop = new uint32_t[iThd];
+	pSamples = new sample[iThd * iSamplesPerThd];
+	pTop = new uint32_t[iThd * iLevelCnt];
+	pCount = new uint32_t[iThd * iLevelCnt];
 
-	for (size_t i = 0; i < iThd; i++)
-	{
-		ppHashCounts[i] = new uint64_t[iBucketSize];
-		ppTimestamps[i] = new uint64_t[iBucketSize];
-		iBucketTop[i] = 0;
-		memset(ppHashCounts[0], 0, sizeof(uint64_t) * iBucketSize);
-		memset(ppTimestamps[0], 0, sizeof(uint64_t) * iBucketSize);
-	}
+	memset(pSamples, 0, sizeof(sample) * iThd * iSamplesPerThd);
+	memset(pTop, 0, sizeof(uint32_t) * iThd * iLevelCnt);
+	memset(pCount, 0, sizeof(uint32_t) * iThd * iLevelCnt);
+}
+
+telemetry::~telemetry()
+{
+	delete[] pSamples;
+	delete[] pTop;
+	delete[] pCount;
 }
 
 double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread)
 {
-	using namespace std::chrono;
-	uint64_t iTimeNow = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
+	uint64_t iTimeNow = tsc_clock::now_ms();
 
-	uint64_t iEarliestHashCnt = 0;
-	uint64_t iEarliestStamp = 0;
-	uint64_t iLastestStamp = 0;
-	uint64_t iLastestHashCnt = 0;
-	bool bHaveFullSet = false;
+	// Finest level that reaches far enough back
+	size_t lv = 0, iOffset = 0;
+	while(lv < iLevelCnt - 1 && iLastMilisec / oLevels[lv].iPeriod + 2 >= oLevels[lv].iSize)
+		iOffset += oLevels[lv++].iSize;
 
-	//Start at 1, buckettop points to next empty
-	for (size_t i = 1; i < iBucketSize; i++)
-	{
-		size_t idx = (iBucketTop[iThread] - i) & iBucketMask; //overflow expected here
+	const level& l = oLevels[lv];
+	if(iLastMilisec / l.iPeriod + 2 >= l.iSize)
+		return nan(""); // Longer than we keep
 
-		if (ppTimestamps[iThread][idx] == 0)
-			break; //That means we don't have the data yet
+	sample* ring = pSamples + iThread * iSamplesPerThd + iOffset;
+	size_t iTop = pTop[iThread * iLevelCnt + lv];
+	size_t iCount = pCount[iThread * iLevelCnt + lv];
 
-		if (iLastestStamp == 0)
-		{
-			iLastestStamp = ppTimestamps[iThread][idx];
-			iLastestHashCnt = ppHashCounts[iThread][idx];
-		}
+	if (iCount == 0)
+		return nan(""); //That means we don't have the data yet
 
-		if (iTimeNow - ppTimestamps[iThread][idx] > iLastMilisec)
-		{
-			bHaveFullSet = true;
-			break; //We are out of the requested time period
-		}
+	// Samples are in distinct periods, so j slots back is at least (j-1) periods old. This one
+	// is outside the window, if we have it, and the oldest sample inside it is a step or two newer.
+	size_t j = iLastMilisec / l.iPeriod + 2;
+	if(j > iCount - 1)
+		j = iCount - 1;
 
-		iEarliestStamp = ppTimestamps[iThread][idx];
-		iEarliestHashCnt = ppHashCounts[iThread][idx];
-	}
+	while(j > 0 && iTimeNow - ring[(iTop + l.iSize - j) % l.iSize].iTimestamp > iLastMilisec)
+		j--;
 
-	if (!bHaveFullSet || iEarliestStamp == 0 || iLastestStamp == 0)
+	// We need a sample from before the window to know that it is full
+	if(j == iCount - 1)
 		return nan("");
 
-	//Don't think that can happen, but just in case
-	if (iLastestStamp - iEarliestStamp == 0)
+	const sample& oLatest = ring[iTop];
+	const sample& oEarliest = ring[(iTop + l.iSize - j) % l.iSize];
+
+	if (iTimeNow - oLatest.iTimestamp > iLastMilisec || oLatest.iTimestamp - oEarliest.iTimestamp == 0)
 		return nan("");
 
 	double fHashes, fTime;
-	fHashes = iLastestHashCnt - iEarliestHashCnt;
-	fTime = iLastestStamp - iEarliestStamp;
+	fHashes = oLatest.iHashCount - oEarliest.iHashCount;
+	fTime = oLatest.iTimestamp - oEarliest.iTimestamp;
 	fTime /= 1000.0;
 
 	return fHashes / fTime;
@@ -132,21 +139,39 @@ double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread)
 
 void telemetry::push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp)
 {
-	size_t iTop = iBucketTop[iThd];
-	ppHashCounts[iThd][iTop] = iHashCount;
-	ppTimestamps[iThd][iTop] = iTimestamp;
+	if(iTimestamp == 0)
+		return; // Thread hasn't started hashing yet
+
+	sample* ring = pSamples + iThd * iSamplesPerThd;
+	for(size_t lv = 0; lv < iLevelCnt; lv++)
+	{
+		const level& l = oLevels[lv];
+		uint32_t& iTop = pTop[iThd * iLevelCnt + lv];
+		uint32_t& iCount = pCount[iThd * iLevelCnt + lv];
 
-	iBucketTop[iThd] = (iTop + 1) & iBucketMask;
+		// Same period as the newest sample, just bring it up to date
+		if(iCount == 0 || ring[iTop].iTimestamp / l.iPeriod != iTimestamp / l.iPeriod)
+		{
+			if(iCount != 0)
+				iTop = (iTop + 1) % l.iSize;
+			if(iCount < l.iSize)
+				iCount++;
+		}
+
+		ring[iTop].iHashCount = iHashCount;
+		ring[iTop].iTimestamp = iTimestamp;
+		ring += l.iSize;
+	}
 }
 
 minethd::minethd(miner_work& pWork, size_t iNo, bool double_work, bool no_prefetch)
 {
 	oWork = pWork;
-	bQuit = 0;
+	bQuit = false;
 	iThreadNo = (uint8_t)iNo;
 	iJobNo = 0;
-	iHashCount = 0;
-	iTimestamp = 0;
+	pStats = pThdStats + iNo;
+	pProfile = pThdProfile + iNo;
 	bNoPrefetch = no_prefetch;
 
 	if(double_work)
@@ -158,7 +183,38 @@ minethd::minethd(miner_work& pWork, size_t iNo, bool double_work, bool no_prefet
 std::atomic<uint64_t> minethd::iGlobalJobNo;
 std::atomic<uint64_t> minethd::iConsumeCnt; //Threads get jobs as they are initialized
 minethd::miner_work minethd::oGlobalWork;
+minethd::thd_stats* minethd::pThdStats = nullptr;
+uint32_t minethd::iProfileRate = 0;
+minethd::thd_profile* minethd::pThdProfile = nullptr;
 uint64_t minethd::iThreadCount = 0;
+std::atomic<uint64_t> minethd::iShareTat;
+std::atomic<uint64_t> minethd::iRateLimited;
+uint64_t minethd::iShareInterval = 0;
+
+bool minethd::share_rate_ok()
+{
+	if(iShareInterval == 0)
+		return true;
+
+	using namespace std::chrono;
+	uint64_t iNow = time_point_cast<microseconds>(steady_clock::now()).time_since_epoch().count();
+	uint64_t iTat = iShareTat.load(std::memory_order_relaxed);
+
+	while(true)
+	{
+		uint64_t iBase = iTat > iNow ? iTat : iNow;
+
+		// We allow a burst of one second's worth of shares
+		if(iBase - iNow + iShareInterval > 1000000)
+		{
+			iRateLimited.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if(iShareTat.compare_exchange_weak(iTat, iBase + iShareInterval, std::memory_order_relaxed))
+			return true;
+	}
+}
 
 cryptonight_ctx* minethd_alloc_ctx()
 {
@@ -197,7 +253,7 @@ cryptonight_ctx* minethd_alloc_ctx()
 	return nullptr; //Should never happen
 }
 
-bool minethd::self_test()
+bool minethd::self_test(size_t iRandomRounds, uint64_t iSeed)
 {
 	alloc_msg msg = { 0 };
 	size_t res;
@@ -234,7 +290,7 @@ bool minethd::self_test()
 	if(res == 0 && fatal)
 		return false;
 
-	cryptonight_ctx *ctx0, *ctx1, *ctx2, *ctx3, *ctx4;
+	cryptonight_ctx *ctx0, *ctx1;
 	if((ctx0 = minethd_alloc_ctx()) == nullptr)
 		return false;
 
@@ -243,27 +299,6 @@ bool minethd::self_test()
 		cryptonight_free_ctx(ctx0);
 		return false;
 	}
-	if((ctx2 = minethd_alloc_ctx()) == nullptr)
-	{
-		cryptonight_free_ctx(ctx0);
-		cryptonight_free_ctx(ctx1);
-		return false;
-	}
-	if((ctx3 = minethd_alloc_ctx()) == nullptr)
-	{
-		cryptonight_free_ctx(ctx0);
-		cryptonight_free_ctx(ctx1);
-		cryptonight_free_ctx(ctx2);
-		return false;
-	}
-	if((ctx4 = minethd_alloc_ctx()) == nullptr)
-	{
-		cryptonight_free_ctx(ctx0);
-		cryptonight_free_ctx(ctx1);
-		cryptonight_free_ctx(ctx2);
-		cryptonight_free_ctx(ctx3);
-		return false;
-	}
 
 	bool bHasLp = ctx0->ctx_info[0] == 1 && ctx1->ctx_info[0] == 1;
 	size_t n = jconf::inst()->GetThreadCount();
@@ -277,44 +312,23 @@ bool minethd::self_test()
 			printer::inst()->print_msg(L0, "Wrong config. You are running in slow memory mode with no_prefetch.");
 			cryptonight_free_ctx(ctx0);
 			cryptonight_free_ctx(ctx1);
-			cryptonight_free_ctx(ctx2);
-			cryptonight_free_ctx(ctx3);
-			cryptonight_free_ctx(ctx4);
 			return false;
 		}
 	}
 
-	unsigned char out[32*8];
-	bool bResult = true;
-
-	if(jconf::inst()->HaveHardwareAes())
-	{
-		//cryptonight_hash_ctx("This is a test", 14, out, ctx0);
-		//bResult = memcmp(out, "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54\xae\x10\x58\x02\xc5\xf5\xd8\xa9\xb3\x25\x36\x49\xc0\xbe\x66\x05", 32) == 0;
-
-		//cryptonight_hash_ctx_np("This is a test", 14, out, ctx0);
-		//bResult &= memcmp(out, "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54\xae\x10\x58\x02\xc5\xf5\xd8\xa9\xb3\x25\x36\x49\xc0\xbe\x66\x05", 32) == 0;
-
-		uint8_t results[32*8];
-		cryptonight_hash_ctx_np("nada", 4, results, ctx0);
-		for(int z=1; z<7;z++)
-			cryptonight_hash_ctx_np("nado", 4, results + 32*z, ctx0);
+	cryptonight_ctx* ctx[2] = {ctx0, ctx1};
+	bool bHaveAes = jconf::inst()->HaveHardwareAes();
+	bool bResult = hashcheck::known_answers(ctx, bHaveAes);
 
-		cryptonight_ctx* ctx[8] = {ctx0, ctx1, ctx2, ctx3, ctx4, ctx4, ctx4, ctx4};
-		cryptonight_double_hash_ctx("nadanadonadonadonadonadonadonado", 4, out, ctx);
-		bResult = memcmp(out, results, 32*2) == 0;
-	}
-	else
+	if(bResult && iRandomRounds > 0)
 	{
-		cryptonight_hash_ctx_soft("This is a test", 14, out, ctx0);
-		bResult = memcmp(out, "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54\xae\x10\x58\x02\xc5\xf5\xd8\xa9\xb3\x25\x36\x49\xc0\xbe\x66\x05", 32) == 0;
+		if(iSeed == 0)
+			iSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+		bResult = hashcheck::differential(ctx, bHaveAes, iRandomRounds, iSeed);
 	}
 
 	cryptonight_free_ctx(ctx0);
 	cryptonight_free_ctx(ctx1);
-	cryptonight_free_ctx(ctx2);
-	cryptonight_free_ctx(ctx3);
-	cryptonight_free_ctx(ctx4);
 
 	if(!bResult)
 		printer::inst()->print_msg(L0,
@@ -324,20 +338,59 @@ bool minethd::self_test()
 }
 
 std::vector<minethd*>* minethd::thread_starter(miner_work& pWork)
+{
+	std::vector<jconf::thd_cfg> vCfg(jconf::inst()->GetThreadCount());
+	for (size_t i = 0; i < vCfg.size(); i++)
+		jconf::inst()->GetThreadConfig(i, vCfg[i]);
+
+	return thread_starter(pWork, vCfg);
+}
+
+std::vector<minethd*>* minethd::thread_starter(miner_work& pWork, const std::vector<jconf::thd_cfg>& vCfg)
 {
 	iGlobalJobNo = 0;
 	iConsumeCnt = 0;
+	iShareTat = 0;
+	iRateLimited = 0;
+
+	uint64_t iMaxShares = jconf::inst()->GetMaxSharesPerSec();
+	iShareInterval = iMaxShares > 0 ? 1000000 / iMaxShares : 0;
+	if(iMaxShares > 1000000)
+		iShareInterval = 1;
+
 	std::vector<minethd*>* pvThreads = new std::vector<minethd*>;
 
 	//Launch the requested number of single and double threads, to distribute
 	//load evenly we need to alternate single and double threads
-	size_t i, n = jconf::inst()->GetThreadCount();
+	size_t i, n = vCfg.size();
 	pvThreads->reserve(n);
 
-	jconf::thd_cfg cfg;
+	tsc_clock::init();
+	pThdStats = (thd_stats*)_mm_malloc(sizeof(thd_stats) * n, alignof(thd_stats));
 	for (i = 0; i < n; i++)
 	{
-		jconf::inst()->GetThreadConfig(i, cfg);
+		new (pThdStats + i) thd_stats();
+		pThdStats[i].iSeq = 0;
+		pThdStats[i].iHashCount = 0;
+		pThdStats[i].iTicks = 0;
+		pThdStats[i].iJobNo = 0;
+		pThdStats[i].iJobTicks = 0;
+	}
+
+	iProfileRate = (uint32_t)jconf::inst()->GetKernelProfile();
+	pThdProfile = (thd_profile*)_mm_malloc(sizeof(thd_profile) * n, alignof(thd_profile));
+	for (i = 0; i < n; i++)
+	{
+		new (pThdProfile + i) thd_profile();
+		pThdProfile[i].iSeq = 0;
+		pThdProfile[i].iHashes = 0;
+		for(size_t j = 0; j < CN_PHASE_CNT; j++)
+			pThdProfile[i].iTicks[j] = 0;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		const jconf::thd_cfg& cfg = vCfg[i];
 
 		minethd* thd = new minethd(pWork, i, cfg.bDoubleMode, cfg.bNoPrefetch);
 
@@ -361,6 +414,47 @@ std::vector<minethd*>* minethd::thread_starter(miner_work& pWork)
 	return pvThreads;
 }
 
+void minethd::stop_threads(std::vector<minethd*>* pvThreads)
+{
+	for (minethd* thd : *pvThreads)
+		thd->bQuit = true;
+
+	// Kicks them out of the hash loop, or the stall wait, and they see bQuit on the way round
+	miner_work oWork;
+	switch_work(oWork);
+
+	for (minethd* thd : *pvThreads)
+	{
+		thd->oWorkThd.join();
+		delete thd;
+	}
+	delete pvThreads;
+
+	_mm_free(pThdStats);
+	_mm_free(pThdProfile);
+	pThdStats = nullptr;
+	pThdProfile = nullptr;
+	iThreadCount = 0;
+}
+
+void minethd::get_stats(uint64_t& iHashCount, uint64_t& iTimestamp)
+{
+	uint64_t iTicks;
+	pStats->read(iHashCount, iTicks);
+	iTimestamp = iTicks != 0 ? tsc_clock::to_ms(iTicks) : 0;
+}
+
+void minethd::get_job_switch(uint64_t& iJobNo, uint64_t& iTicks)
+{
+	iJobNo = pStats->iJobNo.load(std::memory_order_acquire);
+	iTicks = pStats->iJobTicks.load(std::memory_order_relaxed);
+}
+
+void minethd::get_profile(uint64_t& iHashes, uint64_t* pTicks)
+{
+	pProfile->read(iHashes, pTicks);
+}
+
 void minethd::switch_work(miner_work& pWork)
 {
 	// iConsumeCnt is a basic lock-like polling mechanism just in case we happen to push work
@@ -377,9 +471,12 @@ void minethd::switch_work(miner_work& pWork)
 
 void minethd::consume_work()
 {
-	memcpy(&oWork, &oGlobalWork, sizeof(miner_work));
+	oWork = oGlobalWork;
 	iJobNo++;
 	iConsumeCnt++;
+
+	pStats->iJobTicks.store(tsc_clock::now(), std::memory_order_relaxed);
+	pStats->iJobNo.store(iJobNo, std::memory_order_release);
 }
 
 void minethd::work_main()
@@ -389,11 +486,17 @@ void minethd::work_main()
 	uint64_t* piHashVal;
 	uint32_t* piNonce;
 	job_result result;
+	uint8_t bWorkBlob[sizeof(pool_job::bWorkBlob)];
+	uint32_t iWorkSize;
+	uint64_t iPhases[CN_PHASE_CNT] = {0};
+	uint64_t iProfiled = 0;
+	uint32_t iProfileLeft = iProfileRate;
 
 	ctx = minethd_alloc_ctx();
 
 	piHashVal = (uint64_t*)(result.bResult + 24);
-	piNonce = (uint32_t*)(oWork.bWorkBlob + 39);
+	piNonce = (uint32_t*)(bWorkBlob + 39);
+	oPerf.open();
 	iConsumeCnt++;
 
 	bool bHaveAes = jconf::inst()->HaveHardwareAes();
@@ -412,43 +515,56 @@ void minethd::work_main()
 			continue;
 		}
 
+		// Our own copy of the blob, this is the only one we write nonces into
+		iWorkSize = oWork.oJob->iWorkLen;
+		memcpy(bWorkBlob, oWork.oJob->bWorkBlob, iWorkSize);
+
 		if(oWork.bNiceHash)
 			result.iNonce = calc_nicehash_nonce(*piNonce, oWork.iResumeCnt);
 		else
 			result.iNonce = calc_start_nonce(oWork.iResumeCnt);
 
 		assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
-		memcpy(result.sJobID, oWork.sJobID, sizeof(job_result::sJobID));
+		memcpy(result.sJobID, oWork.oJob->sJobID, sizeof(job_result::sJobID));
+		result.iJobGen = oWork.oJob->iJobGen;
 
 		while(iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
 		{
-			if ((iCount & 0x7) == 0) //Store stats every 16 hashes
-			{
-				using namespace std::chrono;
-				uint64_t iStamp = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
-				iHashCount.store(iCount, std::memory_order_relaxed);
-				iTimestamp.store(iStamp, std::memory_order_relaxed);
-			}
+			if ((iCount & 0x7) == 0) //Store stats every 8 hashes
+				pStats->publish(iCount, tsc_clock::now());
 			iCount++;
 
 			*piNonce = ++result.iNonce;
 
-			if(bHaveAes)
+			if(iProfileRate != 0 && --iProfileLeft == 0)
+			{
+				iProfileLeft = iProfileRate;
+				if(!bHaveAes)
+					cryptonight_hash_ctx_soft_prof(bWorkBlob, iWorkSize, result.bResult, ctx, iPhases);
+				else if(bNoPrefetch)
+					cryptonight_hash_ctx_np_prof(bWorkBlob, iWorkSize, result.bResult, ctx, iPhases);
+				else
+					cryptonight_hash_ctx_prof(bWorkBlob, iWorkSize, result.bResult, ctx, iPhases);
+				pProfile->publish(++iProfiled, iPhases);
+			}
+			else if(bHaveAes)
 			{
 				if(bNoPrefetch)
-					cryptonight_hash_ctx_np(oWork.bWorkBlob, oWork.iWorkSize, result.bResult, ctx);
+					cryptonight_hash_ctx_np(bWorkBlob, iWorkSize, result.bResult, ctx);
 				else
-					cryptonight_hash_ctx(oWork.bWorkBlob, oWork.iWorkSize, result.bResult, ctx);
+					cryptonight_hash_ctx(bWorkBlob, iWorkSize, result.bResult, ctx);
 			}
 			else
-				cryptonight_hash_ctx_soft(oWork.bWorkBlob, oWork.iWorkSize, result.bResult, ctx);
+				cryptonight_hash_ctx_soft(bWorkBlob, iWorkSize, result.bResult, ctx);
 
-			if (*piHashVal < oWork.iTarget)
+			if (*piHashVal < oWork.iTarget && share_rate_ok())
 				executor::inst()->push_event(ex_event(result, oWork.iPoolId));
 
 			std::this_thread::yield();
 		}
 
+		// Exact count at the switch, the job replay measures the work on each job from it
+		pStats->publish(iCount, tsc_clock::now());
 		consume_work();
 	}
 
@@ -464,17 +580,20 @@ void minethd::double_work_main()
 	uint64_t *piHashVal[hashes];
 	uint32_t *piNonce[hashes];
 	uint8_t bDoubleHashOut[32*hashes];
-	uint8_t	bDoubleWorkBlob[sizeof(miner_work::bWorkBlob) * 5];
+	uint8_t	bDoubleWorkBlob[sizeof(pool_job::bWorkBlob) * 5];
+	uint32_t iWorkSize;
+	uint64_t iPhases[CN_PHASE_CNT] = {0};
+	uint64_t iProfiled = 0;
+	uint32_t iProfileLeft = iProfileRate;
 	uint32_t iNonce;
 	job_result res;
 
 	for(int i=0; i<hashes; i++){
 		ctx[i] = minethd_alloc_ctx();
 		piHashVal[i] = (uint64_t*)(bDoubleHashOut + (32*i) + 24);
-		piNonce[i] = nullptr;
 	}
-	piNonce[0] = (uint32_t*)(bDoubleWorkBlob + 39);
 
+	oPerf.open();
 	iConsumeCnt++;
 
 	while (bQuit == 0)
@@ -489,13 +608,16 @@ void minethd::double_work_main()
 				std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 			consume_work();
-			for(int i=0; i<hashes; i++){
-				memcpy(bDoubleWorkBlob + i*oWork.iWorkSize, oWork.bWorkBlob, oWork.iWorkSize);
-				piNonce[i] = (uint32_t*)(bDoubleWorkBlob + i*oWork.iWorkSize + 39);
-			}
 			continue;
 		}
 
+		// The lanes sit back to back, each with its own copy of the blob
+		iWorkSize = oWork.oJob->iWorkLen;
+		for(int i=0; i<hashes; i++){
+			memcpy(bDoubleWorkBlob + i*iWorkSize, oWork.oJob->bWorkBlob, iWorkSize);
+			piNonce[i] = (uint32_t*)(bDoubleWorkBlob + i*iWorkSize + 39);
+		}
+
 		if(oWork.bNiceHash)
 			iNonce = calc_nicehash_nonce(*piNonce[0], oWork.iResumeCnt);
 		else
@@ -505,33 +627,34 @@ void minethd::double_work_main()
 
 		while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
 		{
-			if ((iCount & 0x7) == 0) //Store stats every 16 hashes
-			{
-				using namespace std::chrono;
-				uint64_t iStamp = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
-				iHashCount.store(iCount, std::memory_order_relaxed);
-				iTimestamp.store(iStamp, std::memory_order_relaxed);
-			}
+			if ((iCount & 0x7) == 0) //Store stats every 8 hashes
+				pStats->publish(iCount, tsc_clock::now());
 
 			iCount += hashes;
 
 			for(int i=0; i<hashes; i++)
 				*piNonce[i] = ++iNonce;
-			cryptonight_double_hash_ctx(bDoubleWorkBlob, oWork.iWorkSize, bDoubleHashOut, ctx);
+			if(iProfileRate != 0 && --iProfileLeft == 0)
+			{
+				iProfileLeft = iProfileRate;
+				cryptonight_double_hash_ctx_prof(bDoubleWorkBlob, iWorkSize, bDoubleHashOut, ctx, iPhases);
+				iProfiled += hashes;
+				pProfile->publish(iProfiled, iPhases);
+			}
+			else
+				cryptonight_double_hash_ctx(bDoubleWorkBlob, iWorkSize, bDoubleHashOut, ctx);
 
 			for(int i=0;i<hashes;i++){
-				if (*piHashVal[i] < oWork.iTarget)
-					executor::inst()->push_event(ex_event(job_result(oWork.sJobID, iNonce-(hashes-i-1), bDoubleHashOut + 32*i), oWork.iPoolId));
+				if (*piHashVal[i] < oWork.iTarget && share_rate_ok())
+					executor::inst()->push_event(ex_event(job_result(oWork.oJob->sJobID, oWork.oJob->iJobGen, iNonce-(hashes-i-1), bDoubleHashOut + 32*i), oWork.iPoolId));
 			}
 
 			std::this_thread::yield();
 		}
 
+		// Exact count at the switch, the job replay measures the work on each job from it
+		pStats->publish(iCount, tsc_clock::now());
 		consume_work();
-		for(int i=0; i<hashes; i++){
-			memcpy(bDoubleWorkBlob + i*oWork.iWorkSize, oWork.bWorkBlob, oWork.iWorkSize);
-			if(i>0) {piNonce[i] = (uint32_t*)(bDoubleWorkBlob + i*oWork.iWorkSize + 39);}
-		}
 	}
 
 	for(int i=0; i<hashes; i++)
@@ -1,100 +1,101 @@
 #pragma once
 #include <thread>
 #include <atomic>
-
+#include "msgstruct.h"
+#include "crypto/cryptonight.h"
+#include "perfcnt.h"
+#include "jconf.h"
+#include <vector>
+
+/*
+	Hash counts are cumulative, so the rate over a window is just the difference between the
+	newest sample and the oldest one inside the window. We keep the samples at a few resolutions,
+	one sample per period in each, with the newest one in every level overwritten until its period
+	is over. That way the sample we need is always a fixed number of slots back - a window query
+	is a couple of steps no matter how long the window is, and a day of history costs a few KB.
+*/
 class telemetry
 {
 public:
 	telemetry(size_t iThd);
+	~telemetry();
 	void push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp);
 	double calc_telemetry_data(size_t iLastMilisec, size_t iThread);
 
 private:
-	constexpr static size_t iBucketSize = 2 << 11; //Power of 2 to simplify calculations
-	constexpr static size_t iBucketMask = iBucketSize - 1;
-	uint32_t* iBucketTop;
-	uint64_t** ppHashCounts;
-	uint64_t** ppTimestamps;
+	struct sample
+	{
+		uint64_t iHashCount;
+		uint64_t iTimestamp;
+	};
+
+	struct level
+	{
+		uint64_t iPeriod; // ms
+		size_t iSize;
+	};
+
+	// Finest first, each one covers (iSize - 2) periods worth of window
+	constexpr static size_t iLevelCnt = 4;
+	static const level oLevels[iLevelCnt];
+	static const size_t iSamplesPerThd;
+
+	// All levels of one thread are in one block, pSamples[thd * iSamplesPerThd + level offset]
+	sample* pSamples;
+	// Index of the newest sample and number of samples, per thread and level
+	uint32_t* pTop;
+	uint32_t* pCount;
 };
 
 class minethd
 {
 public:
+	// What a thread is told to work on. The job itself is shared and read only, see pool_job,
+	// so handing this out to every thread is a pointer copy and a few scalars.
 	struct miner_work
 	{
-		char        sJobID[64];
-		uint8_t     bWorkBlob[112];
-		uint32_t    iWorkSize;
-		uint32_t    iResumeCnt;
+		job_ref     oJob;
 		uint64_t    iTarget;
+		uint32_t    iResumeCnt;
 		bool        bNiceHash;
 		bool        bStall;
 		size_t      iPoolId;
 
-		miner_work() : iWorkSize(0), bStall(true), iPoolId(0) { }
+		miner_work() : iTarget(0), iResumeCnt(0), bNiceHash(false), bStall(true), iPoolId(0) { }
 
-		miner_work(const char* sJobID, const uint8_t* bWork, uint32_t iWorkSize, uint32_t iResumeCnt,
-			uint64_t iTarget, bool bNiceHash, size_t iPoolId) : iWorkSize(iWorkSize), iResumeCnt(iResumeCnt),
-			iTarget(iTarget), bNiceHash(bNiceHash), bStall(false), iPoolId(iPoolId)
+		miner_work(job_ref oJob, uint32_t iResumeCnt, uint64_t iTarget, bool bNiceHash, size_t iPoolId) :
+			oJob(std::move(oJob)), iTarget(iTarget), iResumeCnt(iResumeCnt), bNiceHash(bNiceHash), bStall(false),
+			iPoolId(iPoolId)
 		{
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(this->sJobID, sJobID, sizeof(miner_work::sJobID));
-			memcpy(this->bWorkBlob, bWork, iWorkSize);
+			assert(this->oJob);
 		}
+	};
 
-		miner_work(miner_work const&) = delete;
-
-		miner_work& operator=(miner_work const& from)
-		{
-			assert(this != &from);
-
-			iWorkSize = from.iWorkSize;
-			iResumeCnt = from.iResumeCnt;
-			iTarget = from.iTarget;
-			bNiceHash = from.bNiceHash;
-			bStall = from.bStall;
-			iPoolId = from.iPoolId;
+	static void switch_work(miner_work& pWork);
+	static std::vector<minethd*>* thread_starter(miner_work& pWork);
+	// Any layout, not just the one in the config, for the benchmark
+	static std::vector<minethd*>* thread_starter(miner_work& pWork, const std::vector<jconf::thd_cfg>& vCfg);
+	// Stops, joins and deletes the threads
+	static void stop_threads(std::vector<minethd*>* pvThreads);
+	// Known answers for every kernel, then iRandomRounds of random blobs (seed 0 - pick one)
+	static bool self_test(size_t iRandomRounds = 0, uint64_t iSeed = 0);
 
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
+	// Results found above max_shares_per_sec that were never queued
+	static inline uint64_t get_rate_limited() { return iRateLimited.load(std::memory_order_relaxed); }
 
-			return *this;
-		}
+	// Hashes done so far and when (ms, zero until the thread starts hashing)
+	void get_stats(uint64_t& iHashCount, uint64_t& iTimestamp);
 
-		miner_work(miner_work&& from) : iWorkSize(from.iWorkSize), iTarget(from.iTarget),
-			bStall(from.bStall), iPoolId(from.iPoolId)
-		{
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
-		}
+	// The last switch_work this thread picked up (counting from 1 after thread_starter) and when, in tsc_clock ticks
+	void get_job_switch(uint64_t& iJobNo, uint64_t& iTicks);
 
-		miner_work& operator=(miner_work&& from)
-		{
-			assert(this != &from);
+	// kernel_profile - TSC ticks of each CN_PHASE_* summed over the iHashes we timed so far
+	static inline bool is_profiling() { return iProfileRate != 0; }
+	static inline uint32_t get_profile_rate() { return iProfileRate; }
+	void get_profile(uint64_t& iHashes, uint64_t* pTicks);
 
-			iWorkSize = from.iWorkSize;
-			iResumeCnt = from.iResumeCnt;
-			iTarget = from.iTarget;
-			bNiceHash = from.bNiceHash;
-			bStall = from.bStall;
-			iPoolId = from.iPoolId;
-
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
-
-			return *this;
-		}
-	};
-
-	static void switch_work(miner_work& pWork);
-	static std::vector<minethd*>* thread_starter(miner_work& pWork);
-	static bool self_test();
-
-	std::atomic<uint64_t> iHashCount;
-	std::atomic<uint64_t> iTimestamp;
+	// Hardware counters of this thread, false if we couldn't get any
+	inline bool get_counters(perf_counters::sample& out) { return oPerf.read(out); }
 
 private:
 	minethd(miner_work& pWork, size_t iNo, bool double_work, bool no_prefetch);
@@ -114,9 +115,98 @@ private:
 	void double_work_main();
 	void consume_work();
 
+	// Written by the miner thread every few hashes, read by the executor every tick. Each thread
+	// has its own cache line in one array, so the miner's hot data never shares a line with
+	// anything the executor reads. The seqlock lets the reader get count and time as a pair.
+	struct alignas(64) thd_stats
+	{
+		std::atomic<uint32_t> iSeq;
+		std::atomic<uint64_t> iHashCount;
+		std::atomic<uint64_t> iTicks; // tsc_clock, zero until the first hash
+
+		// Job the thread is on and when it picked that up, for the job replay
+		std::atomic<uint64_t> iJobNo;
+		std::atomic<uint64_t> iJobTicks;
+
+		inline void publish(uint64_t iCount, uint64_t iNow)
+		{
+			uint32_t iS = iSeq.load(std::memory_order_relaxed);
+			iSeq.store(iS + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			iHashCount.store(iCount, std::memory_order_relaxed);
+			iTicks.store(iNow, std::memory_order_relaxed);
+			iSeq.store(iS + 2, std::memory_order_release);
+		}
+
+		inline void read(uint64_t& iCount, uint64_t& iNow)
+		{
+			uint32_t iS1, iS2;
+			do
+			{
+				iS1 = iSeq.load(std::memory_order_acquire);
+				iCount = iHashCount.load(std::memory_order_relaxed);
+				iNow = iTicks.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				iS2 = iSeq.load(std::memory_order_relaxed);
+			}
+			while((iS1 & 1) != 0 || iS1 != iS2);
+		}
+	};
+
+	static thd_stats* pThdStats;
+	thd_stats* pStats;
+
+	// Same idea, published after every timed hash
+	struct alignas(64) thd_profile
+	{
+		std::atomic<uint32_t> iSeq;
+		std::atomic<uint64_t> iHashes;
+		std::atomic<uint64_t> iTicks[CN_PHASE_CNT];
+
+		inline void publish(uint64_t iCount, const uint64_t* pTicks)
+		{
+			uint32_t iS = iSeq.load(std::memory_order_relaxed);
+			iSeq.store(iS + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			iHashes.store(iCount, std::memory_order_relaxed);
+			for(size_t i = 0; i < CN_PHASE_CNT; i++)
+				iTicks[i].store(pTicks[i], std::memory_order_relaxed);
+			iSeq.store(iS + 2, std::memory_order_release);
+		}
+
+		inline void read(uint64_t& iCount, uint64_t* pTicks)
+		{
+			uint32_t iS1, iS2;
+			do
+			{
+				iS1 = iSeq.load(std::memory_order_acquire);
+				iCount = iHashes.load(std::memory_order_relaxed);
+				for(size_t i = 0; i < CN_PHASE_CNT; i++)
+					pTicks[i] = iTicks[i].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				iS2 = iSeq.load(std::memory_order_relaxed);
+			}
+			while((iS1 & 1) != 0 || iS1 != iS2);
+		}
+	};
+
+	static uint32_t iProfileRate;
+	static thd_profile* pThdProfile;
+	thd_profile* pProfile;
+
+	perf_counters oPerf;
+
 	static std::atomic<uint64_t> iGlobalJobNo;
 	static std::atomic<uint64_t> iConsumeCnt;
 	static uint64_t iThreadCount;
+
+	// Share rate limit, as a virtual schedule (GCRA). iShareTat is the time in us when the
+	// bucket is empty again, every share pushes it back by iShareInterval. No lock is taken,
+	// threads that lose the race to move it just try again.
+	static bool share_rate_ok();
+	static std::atomic<uint64_t> iShareTat;
+	static std::atomic<uint64_t> iRateLimited;
+	static uint64_t iShareInterval;
 	uint64_t iJobNo;
 
 	static miner_work oGlobalWork;
@@ -125,7 +215,7 @@ private:
 	std::thread oWorkThd;
 	uint8_t iThreadNo;
 
-	bool bQuit;
+	std::atomic<bool> bQuit;
 	bool bNoPrefetch;
 };
 
@@ -0,0 +1,624 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+
+#include "mock_pool.h"
+#include "jpsock.h"
+#include "jconf.h"
+#include "console.h"
+#include "hexcodec.h"
+
+#include "rapidjson/document.h"
+#include "jext.h"
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#endif // _WIN32
+
+const char* mock_pool::usage()
+{
+	return "mock_pool CONFIG [--port P] [--job-interval MS] [--block-every N] [--diff D] [--latency MS] "
+		"[--jitter MS] [--drop PRC] [--error PRC] [--duration S] [--seed N] [--record FILE]";
+}
+
+template <typename T>
+static bool parse_uint(const char* sArg, const char* sVal, T& iOut, uint64_t iMin, uint64_t iMax)
+{
+	char* sEnd;
+	unsigned long long iVal = strtoull(sVal, &sEnd, 10);
+	if(*sVal == '\0' || *sEnd != '\0' || iVal < iMin || iVal > iMax)
+	{
+		printer::inst()->print_msg(L0, "Invalid value for %s: %s", sArg, sVal);
+		return false;
+	}
+	iOut = (T)iVal;
+	return true;
+}
+
+static bool parse_prc(const char* sArg, const char* sVal, double& fOut)
+{
+	char* sEnd;
+	double fVal = strtod(sVal, &sEnd);
+	if(*sVal == '\0' || *sEnd != '\0' || !(fVal >= 0.0 && fVal <= 100.0))
+	{
+		printer::inst()->print_msg(L0, "Invalid value for %s: %s", sArg, sVal);
+		return false;
+	}
+	fOut = fVal;
+	return true;
+}
+
+bool mock_pool::parse_args(int argc, char* argv[], options& opt)
+{
+	for(int i = 0; i < argc; i++)
+	{
+		const char* sArg = argv[i];
+		bool bHaveVal = i + 1 < argc;
+		bool bOk = true;
+
+		if(!bHaveVal)
+			bOk = false;
+		else if(strcasecmp(sArg, "--port") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iPort, 1, 65535);
+		else if(strcasecmp(sArg, "--job-interval") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iJobInterval, 1, 0xFFFFFFFF);
+		else if(strcasecmp(sArg, "--block-every") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iBlockEvery, 1, 0xFFFFFFFF);
+		else if(strcasecmp(sArg, "--diff") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iDiff, 1, 0xFFFFFFFF);
+		else if(strcasecmp(sArg, "--latency") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iLatency, 0, 3600000);
+		else if(strcasecmp(sArg, "--jitter") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iJitter, 0, 3600000);
+		else if(strcasecmp(sArg, "--drop") == 0)
+			bOk = parse_prc(sArg, argv[++i], opt.fDropPrc);
+		else if(strcasecmp(sArg, "--error") == 0)
+			bOk = parse_prc(sArg, argv[++i], opt.fErrorPrc);
+		else if(strcasecmp(sArg, "--duration") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iDuration, 0, 0xFFFFFFFF);
+		else if(strcasecmp(sArg, "--seed") == 0)
+			bOk = parse_uint(sArg, argv[++i], opt.iSeed, 0, 0xFFFFFFFFFFFFFFFFULL);
+		else if(strcasecmp(sArg, "--record") == 0)
+			opt.sRecordFile = argv[++i];
+		else
+			bOk = false;
+
+		if(!bOk)
+		{
+			printer::inst()->print_msg(L0, "Unknown or incomplete mock_pool option %s", sArg);
+			printer::inst()->print_msg(L0, "Usage: %s", usage());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+mock_pool::mock_pool(const options& opt) : opt(opt), iPort(opt.iPort), hListen(INVALID_SOCKET), iNextConnId(1),
+	iJobPos(0), iJobNo(0), iBlockNo(0), iRandState(opt.iSeed), fRecord(nullptr),
+	iStartMs(0)
+{
+	memset(bPrevBlockId, 0, sizeof(bPrevBlockId));
+
+	if(iRandState == 0)
+		iRandState = std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+}
+
+// xorshift64, the pool doesn't need anything better
+uint64_t mock_pool::next_rand()
+{
+	iRandState ^= iRandState << 13;
+	iRandState ^= iRandState >> 7;
+	iRandState ^= iRandState << 17;
+	return iRandState;
+}
+
+bool mock_pool::chance(double fPrc)
+{
+	return fPrc > 0.0 && (next_rand() % 1000000) < (uint64_t)(fPrc * 10000.0);
+}
+
+bool mock_pool::start()
+{
+	char sSockErr[256];
+
+	// Where the miner with the same config will look for its pool
+	if(iPort == 0)
+	{
+		const char* sAddr = jconf::inst()->GetPoolAddress();
+		const char* sPort = strrchr(sAddr, ':');
+		iPort = sPort != nullptr ? (uint16_t)strtoul(sPort + 1, nullptr, 10) : 0;
+		if(iPort == 0)
+		{
+			printer::inst()->print_msg(L0, "MOCK POOL error: no port in pool_address %s, use --port.", sAddr);
+			return false;
+		}
+	}
+
+	if(!share_check::inst()->start())
+		return false;
+
+	if(opt.sRecordFile != nullptr && (fRecord = fopen(opt.sRecordFile, "wb")) == nullptr)
+	{
+		printer::inst()->print_msg(L0, "MOCK POOL error: can't write %s.", opt.sRecordFile);
+		return false;
+	}
+
+	sock_init();
+
+	hListen = sock_listen(iPort);
+	if(hListen == INVALID_SOCKET)
+	{
+		printer::inst()->print_msg(L0, "MOCK POOL error: can't listen on port %u: %s", (unsigned int)iPort,
+			sock_strerror(sSockErr, sizeof(sSockErr)));
+		return false;
+	}
+
+	iStartMs = reactor::get_ms_time();
+	{
+		std::unique_lock<std::mutex> lck(pool_mutex);
+		new_job();
+	}
+
+	reactor::inst()->start();
+	reactor::inst()->add_socket(hListen, this, false);
+	reactor::inst()->add_timer(opt.iJobInterval, [this]() { on_job_timer(); });
+
+	printer::inst()->print_msg(L0, "Mock pool listening on port %u, difficulty %llu, a job every %u ms, a new block every %u jobs.",
+		(unsigned int)iPort, int_port(opt.iDiff), (unsigned int)opt.iJobInterval, (unsigned int)opt.iBlockEvery);
+	if(opt.iLatency != 0 || opt.iJitter != 0 || opt.fDropPrc > 0.0 || opt.fErrorPrc > 0.0)
+		printer::inst()->print_msg(L0, "Injecting %u ms latency (+%u ms jitter), dropping %.2f%% of calls, rejecting %.2f%% of good shares.",
+			(unsigned int)opt.iLatency, (unsigned int)opt.iJitter, opt.fDropPrc, opt.fErrorPrc);
+	return true;
+}
+
+void mock_pool::on_job_timer()
+{
+	std::unique_lock<std::mutex> lck(pool_mutex);
+	new_job();
+	reactor::inst()->add_timer(opt.iJobInterval, [this]() { on_job_timer(); });
+}
+
+// Needs pool_mutex
+void mock_pool::new_job()
+{
+	if(iJobNo % opt.iBlockEvery == 0)
+	{
+		iBlockNo++;
+		for(size_t i=0; i < sizeof(bPrevBlockId); i += 8)
+		{
+			uint64_t r = next_rand();
+			memcpy(bPrevBlockId + i, &r, 8);
+		}
+	}
+	iJobNo++;
+
+	iJobPos = (iJobPos + 1) % iJobHistory;
+	job_entry& job = oJobs[iJobPos];
+	job.iJobNo = iJobNo;
+	job.iBlockNo = iBlockNo;
+	job.iTarget = jpsock::t32_to_t64(uint32_t(0xFFFFFFFFULL / opt.iDiff));
+	job.oNonces.clear();
+
+	// A block header as the miner expects it - versions, varint timestamp (5 bytes for the
+	// next few centuries), previous block id, nonce at 39, then the tree root and tx count
+	uint8_t* b = job.bBlob;
+	b[0] = 7;
+	b[1] = 7;
+	uint64_t iTime = (uint64_t)time(nullptr);
+	for(size_t i=2; i < 7; i++, iTime >>= 7)
+		b[i] = uint8_t(iTime & 0x7F) | (i < 6 ? 0x80 : 0);
+	memcpy(b + 7, bPrevBlockId, 32);
+	memset(b + 39, 0, 4);
+	for(size_t i=43; i < 75; i += 8)
+	{
+		uint64_t r = next_rand();
+		memcpy(b + i, &r, 8);
+	}
+	b[75] = 1;
+
+	std::string sLine = "{\"jsonrpc\":\"2.0\",\"method\":\"job\",\"params\":";
+	job_params(job, sLine);
+	sLine.append("}\n");
+	oStats.iJobs++;
+
+	if(fRecord != nullptr)
+	{
+		fprintf(fRecord, "%llu %s", int_port(reactor::get_ms_time() - iStartMs), sLine.c_str());
+		fflush(fRecord);
+	}
+
+	for(auto& it : mClients)
+	{
+		if(it.second->bLoggedIn)
+			send_line(it.second, std::string(sLine));
+	}
+}
+
+void mock_pool::job_params(const job_entry& job, std::string& out)
+{
+	char sHex[sizeof(job_entry::bBlob) * 2];
+	uint32_t iTarget32 = uint32_t(0xFFFFFFFFULL / opt.iDiff);
+	char sTarget[8];
+	char sJobId[32];
+
+	hex_encode(job.bBlob, sizeof(job.bBlob), sHex);
+	hex_encode((const uint8_t*)&iTarget32, 4, sTarget);
+	snprintf(sJobId, sizeof(sJobId), "%llu", int_port(job.iJobNo));
+
+	out.append("{\"blob\":\"");
+	out.append(sHex, sizeof(sHex));
+	out.append("\",\"job_id\":\"");
+	out.append(sJobId);
+	out.append("\",\"target\":\"");
+	out.append(sTarget, sizeof(sTarget));
+	out.append("\"}");
+}
+
+void mock_pool::on_sock_event(uint32_t iEvents)
+{
+	std::unique_lock<std::mutex> lck(pool_mutex);
+	accept_clients();
+}
+
+// Needs pool_mutex
+void mock_pool::accept_clients()
+{
+	while(true)
+	{
+		SOCKET s = accept(hListen, nullptr, nullptr);
+		if(s == INVALID_SOCKET)
+			return; // Would block, or the client is already gone
+
+		if(!sock_set_nonblock(s))
+		{
+			sock_close(s);
+			continue;
+		}
+		sock_set_nodelay(s);
+
+		client* c = new client(this, s, iNextConnId++);
+		mClients[c->iConnId] = c;
+		oStats.iConnects++;
+
+		if(!reactor::inst()->add_socket(s, c, false))
+		{
+			mClients.erase(c->iConnId);
+			sock_close(s);
+			delete c;
+		}
+	}
+}
+
+void mock_pool::client::on_sock_event(uint32_t iEvents)
+{
+	pool->on_client_event(this, iEvents);
+}
+
+bool mock_pool::client::on_line(char* line, size_t len)
+{
+	return pool->process_line(this, line, len);
+}
+
+void mock_pool::on_client_event(client* c, uint32_t iEvents)
+{
+	std::unique_lock<std::mutex> lck(pool_mutex);
+
+	if(!c->handle_events(iEvents))
+		drop_client(c);
+}
+
+// Needs pool_mutex, reactor thread only. Lines still waiting on their latency find the client gone.
+void mock_pool::drop_client(client* c)
+{
+	c->close();
+	mClients.erase(c->iConnId);
+
+	if(c->bLoggedIn)
+		printer::inst()->print_msg(L3, "Mock pool miner %llu disconnected.", int_port(c->iConnId));
+
+	delete c;
+}
+
+// Needs pool_mutex. Right away, or once the injected latency is over.
+void mock_pool::send_line(client* c, std::string&& sLine)
+{
+	if(opt.iLatency == 0 && opt.iJitter == 0)
+	{
+		c->send(sLine.data(), sLine.size());
+		return;
+	}
+
+	uint64_t iNow = reactor::get_ms_time();
+	uint64_t iDelay = opt.iLatency + (opt.iJitter != 0 ? next_rand() % (opt.iJitter + 1) : 0);
+
+	// Timers that are due at the same time fire in the order they were added
+	uint64_t iDue = iNow + iDelay;
+	if(iDue < c->iLastSendMs)
+		iDue = c->iLastSendMs;
+	c->iLastSendMs = iDue;
+
+	uint64_t iConnId = c->iConnId;
+	std::string sCopy(std::move(sLine));
+	reactor::inst()->add_timer(size_t(iDue - iNow), [this, iConnId, sCopy]() {
+		std::unique_lock<std::mutex> lck(pool_mutex);
+		auto it = mClients.find(iConnId);
+		if(it != mClients.end())
+			it->second->send(sCopy.data(), sCopy.size());
+	});
+}
+
+bool mock_pool::process_line(client* c, char* line, size_t len)
+{
+	MemoryPoolAllocator<> oAlloc(bParseMem, sizeof(bParseMem));
+	Document oDoc(&oAlloc);
+
+	if(oDoc.ParseInsitu(line).HasParseError() || !oDoc.IsObject())
+		return false;
+
+	const Value* pId = GetObjectMember(oDoc, "id");
+	const Value* pMethod = GetObjectMember(oDoc, "method");
+	if(pMethod == nullptr || !pMethod->IsString())
+		return false;
+
+	uint64_t iCallId = pId != nullptr && pId->IsUint64() ? pId->GetUint64() : 0;
+	const char* sMethod = pMethod->GetString();
+
+	// The pool went away in the middle of a call
+	if(chance(opt.fDropPrc))
+	{
+		oStats.iDrops++;
+		printer::inst()->print_msg(L3, "Mock pool dropping miner %llu.", int_port(c->iConnId));
+		return false;
+	}
+
+	if(strcmp(sMethod, "login") == 0)
+		return cmd_login(c, iCallId);
+
+	if(strcmp(sMethod, "submit") == 0)
+	{
+		if(!c->bLoggedIn)
+			return send_reply(c, iCallId, "Unauthenticated");
+
+		oStats.iShares++;
+
+		const Value* pParams = GetObjectMember(oDoc, "params");
+		if(pParams == nullptr || !pParams->IsObject())
+		{
+			oStats.iMalformed++;
+			return send_reply(c, iCallId, "Invalid share");
+		}
+
+		const Value* pJobId = GetObjectMember(*pParams, "job_id");
+		const Value* pNonce = GetObjectMember(*pParams, "nonce");
+		const Value* pResult = GetObjectMember(*pParams, "result");
+
+		if(pJobId == nullptr || !pJobId->IsString() ||
+			pNonce == nullptr || !pNonce->IsString() || pNonce->GetStringLength() != 8 ||
+			pResult == nullptr || !pResult->IsString() || pResult->GetStringLength() != 64)
+		{
+			oStats.iMalformed++;
+			return send_reply(c, iCallId, "Invalid share");
+		}
+
+		return cmd_submit(c, iCallId, pJobId->GetString(), pNonce->GetString(), pResult->GetString());
+	}
+
+	if(strcmp(sMethod, "keepalived") == 0)
+	{
+		char sReply[128];
+		int len = snprintf(sReply, sizeof(sReply),
+			"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":null,\"result\":{\"status\":\"KEEPALIVED\"}}\n", int_port(iCallId));
+		send_line(c, std::string(sReply, len));
+		return true;
+	}
+
+	return send_reply(c, iCallId, "Unsupported method");
+}
+
+bool mock_pool::cmd_login(client* c, uint64_t iCallId)
+{
+	char sHead[128];
+	int iHeadLen = snprintf(sHead, sizeof(sHead),
+		"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":null,\"result\":{\"id\":\"%llu\",\"job\":",
+		int_port(iCallId), int_port(c->iConnId));
+
+	std::string sReply(sHead, iHeadLen);
+	job_params(oJobs[iJobPos], sReply);
+	sReply.append(",\"status\":\"OK\"}}\n");
+
+	if(!c->bLoggedIn)
+	{
+		c->bLoggedIn = true;
+		oStats.iLogins++;
+		printer::inst()->print_msg(L3, "Mock pool miner %llu logged in.", int_port(c->iConnId));
+	}
+
+	send_line(c, std::move(sReply));
+	return true;
+}
+
+// The checks in the order a pool does them - cheap ones first, the hash last
+bool mock_pool::cmd_submit(client* c, uint64_t iCallId, const char* sJobId, const char* sNonce, const char* sResult)
+{
+	uint32_t iNonce;
+	uint8_t bResult[32];
+	if(!hex_decode(sNonce, 8, (uint8_t*)&iNonce) || !hex_decode(sResult, 64, bResult))
+	{
+		oStats.iMalformed++;
+		return send_reply(c, iCallId, "Invalid share");
+	}
+
+	char* sEnd;
+	uint64_t iShareJobNo = strtoull(sJobId, &sEnd, 10);
+	job_entry* job = nullptr;
+	for(size_t i=0; i < iJobHistory && *sEnd == '\0'; i++)
+	{
+		if(oJobs[i].iJobNo != 0 && oJobs[i].iJobNo == iShareJobNo)
+		{
+			job = &oJobs[i];
+			break;
+		}
+	}
+
+	if(job == nullptr || job->iBlockNo != iBlockNo)
+	{
+		oStats.iStale++;
+		return send_reply(c, iCallId, "Block expired");
+	}
+
+	if(!job->oNonces.insert(iNonce).second)
+	{
+		oStats.iDuplicate++;
+		return send_reply(c, iCallId, "Duplicate share");
+	}
+
+	// Hashing takes a while, the job timer and the other clients shouldn't wait for it
+	share_check::share oShare;
+	memcpy(oShare.bBlob, job->bBlob, sizeof(job_entry::bBlob));
+	oShare.iBlobLen = sizeof(job_entry::bBlob);
+	oShare.iNonce = iNonce;
+	memcpy(oShare.bResult, bResult, sizeof(bResult));
+	oShare.iTarget = job->iTarget;
+
+	uint64_t iConnId = c->iConnId;
+	oShare.fnDone = [this, iConnId, iCallId](share_check::verdict v, uint32_t iVerifyUs) {
+		on_share_checked(iConnId, iCallId, v, iVerifyUs);
+	};
+
+	share_check::inst()->push(std::move(oShare));
+	return true;
+}
+
+// Reactor thread, the hash is done. The share counts even if the miner left meanwhile.
+void mock_pool::on_share_checked(uint64_t iConnId, uint64_t iCallId, share_check::verdict v, uint32_t iVerifyUs)
+{
+	std::unique_lock<std::mutex> lck(pool_mutex);
+	oStats.oVerifyUs.add(iVerifyUs);
+
+	const char* sError = nullptr;
+	if(v == share_check::share_bad_hash)
+	{
+		oStats.iBadHash++;
+		sError = "Incorrect hash";
+	}
+	else if(v == share_check::share_low_diff)
+	{
+		oStats.iLowDiff++;
+		sError = "Low difficulty share";
+	}
+	else if(chance(opt.fErrorPrc))
+	{
+		oStats.iErrors++;
+		sError = "Injected error";
+	}
+	else
+	{
+		oStats.iAccepted++;
+		oStats.iDiffAccepted += opt.iDiff;
+	}
+
+	auto it = mClients.find(iConnId);
+	if(it != mClients.end())
+		send_reply(it->second, iCallId, sError);
+}
+
+bool mock_pool::send_reply(client* c, uint64_t iCallId, const char* sError)
+{
+	char sReply[256];
+	int len;
+
+	if(sError == nullptr)
+		len = snprintf(sReply, sizeof(sReply),
+			"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":null,\"result\":{\"status\":\"OK\"}}\n", int_port(iCallId));
+	else
+		len = snprintf(sReply, sizeof(sReply),
+			"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":{\"code\":-1,\"message\":\"%s\"}}\n", int_port(iCallId), sError);
+
+	send_line(c, std::string(sReply, len));
+	return true;
+}
+
+void mock_pool::print_report(double fSeconds)
+{
+	std::unique_lock<std::mutex> lck(pool_mutex);
+	const stats& s = oStats;
+	char buffer[256];
+
+	printer::inst()->print_str("-----------------------------------------------------\n");
+	printer::inst()->print_str("MOCK POOL\n");
+	snprintf(buffer, sizeof(buffer), "Connections    : %llu (%llu logins, %llu dropped on purpose, %u open)\n",
+		int_port(s.iConnects), int_port(s.iLogins), int_port(s.iDrops), (unsigned int)mClients.size());
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Jobs           : %llu (block %llu)\n", int_port(s.iJobs), int_port(iBlockNo));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Shares         : %llu received, %llu accepted, %llu rejected on purpose\n",
+		int_port(s.iShares), int_port(s.iAccepted), int_port(s.iErrors));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Rejected       : %llu stale, %llu duplicate, %llu low difficulty, %llu bad hash, %llu malformed\n",
+		int_port(s.iStale), int_port(s.iDuplicate), int_port(s.iLowDiff), int_port(s.iBadHash), int_port(s.iMalformed));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Verify (us)    : p50 %u, p99 %u, max %u\n",
+		s.oVerifyUs.percentile(50), s.oVerifyUs.percentile(99), s.oVerifyUs.max());
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Pool hashrate  : %.1f H/s over %.0f s\n",
+		fSeconds > 0.0 ? s.iDiffAccepted / fSeconds : 0.0, fSeconds);
+	printer::inst()->print_str(buffer);
+	printer::inst()->print_str("-----------------------------------------------------\n");
+}
+
+bool mock_pool::run(const options& opt)
+{
+	// The reactor may still call into it while we exit, so it is never deleted
+	mock_pool* pool = new mock_pool(opt);
+	if(!pool->start())
+		return false;
+
+	uint64_t iReportTime = jconf::inst()->GetAutohashTime();
+	uint64_t iStart = reactor::get_ms_time();
+	uint64_t iNextReport = iStart + iReportTime * 1000;
+
+	while(true)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		uint64_t iNow = reactor::get_ms_time();
+
+		if(opt.iDuration != 0 && iNow - iStart >= opt.iDuration * 1000ULL)
+			break;
+
+		if(iReportTime != 0 && iNow >= iNextReport)
+		{
+			pool->print_report((iNow - iStart) / 1000.0);
+			iNextReport = iNow + iReportTime * 1000;
+		}
+	}
+
+	pool->print_report((reactor::get_ms_time() - iStart) / 1000.0);
+	return true;
+}
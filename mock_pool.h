@@ -0,0 +1,141 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "msgstruct.h"
+#include "downstream.h"
+#include "histogram.h"
+#include "share_check.h"
+
+/*
+	mock_pool - a stand-in for the pool side of jpsock, to test submit latency, reconnects and high
+	share rates without a real pool. It speaks login, job, submit and keepalived like a Monero-style
+	pool, makes up its own jobs, and checks every share with our own cryptonight kernel.
+
+	Everything the pool does can be made worse on purpose: replies and jobs can be held back by a
+	fixed latency plus random jitter (a connection never sees its lines out of order), connections can
+	be dropped instead of answering a call, and good shares can be answered with an error anyway.
+
+	It runs on the reactor like the proxy. Shares are hashed by share_check, so the job timer and the
+	other clients never wait for a hash.
+	With --record every job goes to a file in the format the job replay reads.
+*/
+class mock_pool : public sock_handler
+{
+public:
+	struct options
+	{
+		uint16_t iPort = 0; // zero - the port of pool_address in the config
+		uint32_t iJobInterval = 30000; // ms between jobs
+		uint32_t iBlockEvery = 4; // every n-th job is on a new block
+		uint64_t iDiff = 1000;
+		uint32_t iLatency = 0; // ms added to everything we send
+		uint32_t iJitter = 0; // random ms on top of that
+		double fDropPrc = 0.0; // chance of dropping the connection instead of answering a call
+		double fErrorPrc = 0.0; // chance of rejecting a good share
+		uint32_t iDuration = 0; // s, zero - until killed
+		uint64_t iSeed = 0; // zero - pick one
+		const char* sRecordFile = nullptr;
+	};
+
+	// What follows "mock_pool config.txt" on the command line
+	static bool parse_args(int argc, char* argv[], options& opt);
+	static const char* usage();
+
+	// Only returns if it couldn't start or --duration is over
+	static bool run(const options& opt);
+
+	void on_sock_event(uint32_t iEvents);
+
+private:
+	mock_pool(const options& opt);
+
+	struct client final : public downstream
+	{
+		mock_pool* pool;
+
+		// When the last delayed line goes out, the next one can't go before it
+		uint64_t iLastSendMs = 0;
+
+		client(mock_pool* p, SOCKET s, uint64_t id) : downstream(s, id), pool(p) {}
+		void on_sock_event(uint32_t iEvents);
+		bool on_line(char* line, size_t len);
+	};
+
+	struct job_entry
+	{
+		uint64_t iJobNo = 0; // zero - unused
+		uint64_t iBlockNo;
+		uint64_t iTarget;
+		uint8_t bBlob[76];
+		std::unordered_set<uint32_t> oNonces; // Shares we already have
+	};
+
+	struct stats
+	{
+		uint64_t iConnects = 0;
+		uint64_t iLogins = 0;
+		uint64_t iDrops = 0; // injected
+		uint64_t iJobs = 0;
+		uint64_t iShares = 0;
+		uint64_t iAccepted = 0;
+		uint64_t iErrors = 0; // injected
+		uint64_t iStale = 0;
+		uint64_t iDuplicate = 0;
+		uint64_t iLowDiff = 0;
+		uint64_t iBadHash = 0;
+		uint64_t iMalformed = 0;
+		uint64_t iDiffAccepted = 0;
+		histogram oVerifyUs;
+	};
+
+	bool start();
+	void on_job_timer();
+	void new_job();
+	void print_report(double fSeconds);
+
+	void accept_clients();
+	void on_client_event(client* c, uint32_t iEvents);
+	void drop_client(client* c);
+
+	void send_line(client* c, std::string&& sLine);
+	bool process_line(client* c, char* line, size_t len);
+	bool cmd_login(client* c, uint64_t iCallId);
+	bool cmd_submit(client* c, uint64_t iCallId, const char* sJobId, const char* sNonce, const char* sResult);
+	void on_share_checked(uint64_t iConnId, uint64_t iCallId, share_check::verdict v, uint32_t iVerifyUs);
+	bool send_reply(client* c, uint64_t iCallId, const char* sError);
+
+	void job_params(const job_entry& job, std::string& out);
+	uint64_t next_rand();
+	bool chance(double fPrc);
+
+	const options& opt;
+	uint16_t iPort;
+
+	// Everything below is for the reactor thread and whoever holds pool_mutex
+	std::mutex pool_mutex;
+	SOCKET hListen;
+	std::unordered_map<uint64_t, client*> mClients;
+	uint64_t iNextConnId;
+
+	// Shares for the jobs before the current one are still good as long as the block is the same
+	constexpr static size_t iJobHistory = 4;
+	job_entry oJobs[iJobHistory];
+	size_t iJobPos; // The current one
+	uint64_t iJobNo;
+	uint64_t iBlockNo;
+	uint8_t bPrevBlockId[32];
+
+	uint64_t iRandState;
+
+	FILE* fRecord;
+	uint64_t iStartMs;
+
+	stats oStats;
+
+	uint8_t bParseMem[8192];
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+/*
+ * Multi-producer, single-consumer queue (Dmitry Vyukov's intrusive MPSC list). A push is one
+ * atomic exchange and a store, no locks, and it only makes a system call if the consumer is
+ * asleep. The consumer walks the list on its own - once it is awake it drains everything that
+ * was queued without touching any shared state but the node links, and only goes to sleep
+ * (on a futex, or a condition variable where we don't have one) when the list is empty.
+ *
+ * Same interface as thdq, except that only one thread may pop. pop_all() takes everything that is
+ * queued in one go, so a busy consumer never looks at the sleep flag between events.
+ */
+template <typename T>
+class mpscq
+{
+public:
+	mpscq() : head_(&stub_), tail_(&stub_), sleeping_(0)
+	{
+		stub_.next.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~mpscq()
+	{
+		T item;
+		while (try_pop(item)) {}
+	}
+
+	void push(const T& item)
+	{
+		push_node(new node(item));
+	}
+
+	void push(T&& item)
+	{
+		push_node(new node(std::move(item)));
+	}
+
+	T pop()
+	{
+		T item;
+		pop(item);
+		return item;
+	}
+
+	void pop(T& item)
+	{
+		while (!try_pop(item))
+			wait();
+	}
+
+	// Consumer only. Waits until there is something, then moves every item that is linked in by now
+	// into items, oldest first.
+	void pop_all(std::vector<T>& items)
+	{
+		items.clear();
+
+		T item;
+		while (true)
+		{
+			while (try_pop(item))
+				items.push_back(std::move(item));
+
+			if (!items.empty())
+				return;
+
+			wait();
+		}
+	}
+
+	// Consumer only
+	bool try_pop(T& item)
+	{
+		node* tail = tail_;
+		node* next = tail->next.load(std::memory_order_acquire);
+
+		if (tail == &stub_)
+		{
+			if (next == nullptr)
+				return false;
+
+			// Skip over the stub, it never carries an item
+			tail_ = tail = next;
+			next = tail->next.load(std::memory_order_acquire);
+		}
+
+		if (next != nullptr)
+		{
+			tail_ = next;
+			item = std::move(tail->item);
+			delete tail;
+			return true;
+		}
+
+		// tail is the last node we can see. If it isn't the head a producer is halfway through
+		// linking a new one in, which won't take long.
+		if (tail != head_.load(std::memory_order_acquire))
+			return false;
+
+		// Put the stub behind the last node so that we can take that one out
+		push_node(&stub_);
+
+		next = tail->next.load(std::memory_order_acquire);
+		if (next == nullptr)
+			return false;
+
+		tail_ = next;
+		item = std::move(tail->item);
+		delete tail;
+		return true;
+	}
+
+private:
+	struct node
+	{
+		std::atomic<node*> next;
+		T item;
+
+		node() {}
+		node(const T& i) : item(i) {}
+		node(T&& i) : item(std::move(i)) {}
+	};
+
+	void push_node(node* n)
+	{
+		n->next.store(nullptr, std::memory_order_relaxed);
+		node* prev = head_.exchange(n, std::memory_order_seq_cst);
+		prev->next.store(n, std::memory_order_seq_cst);
+
+		if (n != &stub_ && sleeping_.load(std::memory_order_seq_cst) != 0 && sleeping_.exchange(0) != 0)
+			wake();
+	}
+
+	// The consumer announces that it is going to sleep and then looks at the queue again.
+	// A producer links its node in before it looks at the flag, so one of the two sees the other.
+	void wait()
+	{
+		sleeping_.store(1, std::memory_order_seq_cst);
+
+		node* tail = tail_;
+		if (tail->next.load(std::memory_order_seq_cst) != nullptr || tail != head_.load(std::memory_order_seq_cst))
+		{
+			sleeping_.store(0, std::memory_order_relaxed);
+			return;
+		}
+
+#if defined(__linux__)
+		syscall(SYS_futex, (int*)&sleeping_, FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+		std::unique_lock<std::mutex> lck(mutex_);
+		while (sleeping_.load() != 0)
+			cond_.wait(lck);
+#endif
+	}
+
+	void wake()
+	{
+#if defined(__linux__)
+		syscall(SYS_futex, (int*)&sleeping_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+		std::unique_lock<std::mutex> lck(mutex_);
+		cond_.notify_one();
+#endif
+	}
+
+	// Producers only touch head_, the consumer owns tail_. Keep them on separate cache lines.
+	// This is padding rather than alignas, the queue lives in objects that come from plain
+	// new, which doesn't honour extended alignment before C++17.
+	std::atomic<node*> head_;
+	char pad0_[64];
+	node* tail_;
+	node stub_;
+	char pad1_[64];
+	std::atomic<int32_t> sleeping_;
+
+#if !defined(__linux__)
+	std::mutex mutex_;
+	std::condition_variable cond_;
+#endif
+};
@@ -2,44 +2,161 @@
 #include <string>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+
+#ifdef __GNUC__
+#include <mm_malloc.h>
+#else
+#include <malloc.h>
+#endif
 
 // Structures that we use to pass info between threads constructors are here just to make
 // the stack allocation take up less space, heap is a shared resouce that needs locks too of course
 
-struct pool_job
+/*
+   A job as the pool sent it. The parser fills it in once, after that it is never written to
+   again and the socket, the executor and every miner thread share it through a job_ref. The
+   blob only gets copied one more time, into the nonce buffers of each miner thread.
+   Jobs are aligned to and padded out to whole cache lines (four of them), so a miner reading
+   one never pulls in a line that somebody else writes to - other than the reference count,
+   which only changes when a thread switches jobs.
+*/
+class job_ref;
+struct alignas(64) pool_job
 {
 	char		sJobID[64];
 	uint8_t		bWorkBlob[112];
 	uint64_t	iTarget;
+	uint64_t	iJobGen; // See jpsock::get_job_gen
 	uint32_t	iWorkLen;
-	uint32_t	iResumeCnt;
 
-	pool_job() : iWorkLen(0), iResumeCnt(0) {}
-	pool_job(const char* sJobID, uint64_t iTarget, const uint8_t* bWorkBlob, uint32_t iWorkLen) :
-		iTarget(iTarget), iWorkLen(iWorkLen), iResumeCnt(0)
+	// Hand the result to a job_ref straight away, it owns the job from then on
+	static pool_job* alloc()
+	{
+		pool_job* job = (pool_job*)_mm_malloc(sizeof(pool_job), alignof(pool_job));
+		if(job == nullptr)
+			throw std::bad_alloc();
+		return new (job) pool_job();
+	}
+
+	// For the rare case when somebody needs a changed job
+	pool_job* copy() const
+	{
+		pool_job* job = alloc();
+		memcpy(job->sJobID, sJobID, sizeof(sJobID));
+		memcpy(job->bWorkBlob, bWorkBlob, iWorkLen);
+		job->iTarget = iTarget;
+		job->iJobGen = iJobGen;
+		job->iWorkLen = iWorkLen;
+		return job;
+	}
+
+private:
+	friend class job_ref;
+
+	pool_job() : iTarget(0), iJobGen(0), iWorkLen(0), iRefCnt(0) {}
+	pool_job(const pool_job&) = delete;
+	pool_job& operator=(const pool_job&) = delete;
+
+	std::atomic<uint32_t> iRefCnt;
+};
+
+class job_ref
+{
+public:
+	job_ref() : job(nullptr) {}
+	explicit job_ref(pool_job* job) : job(job) { if(job) job->iRefCnt.store(1, std::memory_order_relaxed); }
+	job_ref(const job_ref& from) : job(from.job) { acquire(); }
+	job_ref(job_ref&& from) : job(from.job) { from.job = nullptr; }
+	~job_ref() { release(); }
+
+	job_ref& operator=(const job_ref& from)
+	{
+		if(job != from.job)
+		{
+			release();
+			job = from.job;
+			acquire();
+		}
+		return *this;
+	}
+
+	job_ref& operator=(job_ref&& from)
+	{
+		if(this != &from)
+		{
+			release();
+			job = from.job;
+			from.job = nullptr;
+		}
+		return *this;
+	}
+
+	inline void reset() { release(); job = nullptr; }
+
+	inline const pool_job* get() const { return job; }
+	inline const pool_job* operator->() const { return job; }
+	inline const pool_job& operator*() const { return *job; }
+	inline explicit operator bool() const { return job != nullptr; }
+
+private:
+	// Jobs only travel between threads through queues and mutexes, which order the writes for us
+	inline void acquire()
 	{
-		assert(iWorkLen <= sizeof(pool_job::bWorkBlob));
-		memcpy(this->sJobID, sJobID, sizeof(pool_job::sJobID));
-		memcpy(this->bWorkBlob, bWorkBlob, iWorkLen);
+		if(job != nullptr)
+			job->iRefCnt.fetch_add(1, std::memory_order_relaxed);
 	}
+
+	inline void release()
+	{
+		if(job != nullptr && job->iRefCnt.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			job->~pool_job();
+			_mm_free(job);
+		}
+	}
+
+	pool_job* job;
 };
 
 struct job_result
 {
 	uint8_t		bResult[32];
 	char		sJobID[64];
+	uint64_t	iJobGen;
+	uint64_t	iProxyTag; // Non-zero for shares from proxy miners, see proxy.h
 	uint32_t	iNonce;
 
 	job_result() {}
-	job_result(const char* sJobID, uint32_t iNonce, const uint8_t* bResult) : iNonce(iNonce)
+	job_result(const char* sJobID, uint64_t iJobGen, uint32_t iNonce, const uint8_t* bResult, uint64_t iProxyTag = 0) :
+		iJobGen(iJobGen), iProxyTag(iProxyTag), iNonce(iNonce)
 	{
 		memcpy(this->sJobID, sJobID, sizeof(job_result::sJobID));
 		memcpy(this->bResult, bResult, sizeof(job_result::bResult));
 	}
 };
 
-enum ex_event_name { EV_INVALID_VAL, EV_SOCK_READY, EV_SOCK_ERROR,
-	EV_POOL_HAVE_JOB, EV_MINER_HAVE_RESULT, EV_PERF_TICK, EV_RECONNECT,
+// Pool's verdict on one of our results, or a network error if the connection dropped before it replied
+struct pool_result
+{
+	std::string	sError;
+	uint64_t	iActualDiff;
+	uint64_t	iProxyTag;
+	uint32_t	iCallTime;
+	bool		bSuccess;
+	bool		bNetError;
+
+	pool_result(uint64_t iActualDiff, uint32_t iCallTime, uint64_t iProxyTag) : iActualDiff(iActualDiff),
+		iProxyTag(iProxyTag), iCallTime(iCallTime), bSuccess(true), bNetError(false) {}
+	pool_result(std::string&& err, uint64_t iActualDiff, uint32_t iCallTime, bool bNetError, uint64_t iProxyTag) :
+		sError(std::move(err)), iActualDiff(iActualDiff), iProxyTag(iProxyTag), iCallTime(iCallTime), bSuccess(false),
+		bNetError(bNetError) {}
+};
+
+enum ex_event_name { EV_INVALID_VAL, EV_SOCK_READY, EV_SOCK_ERROR, EV_POOL_LOGGED_IN,
+	EV_POOL_HAVE_JOB, EV_POOL_RESULT, EV_MINER_HAVE_RESULT, EV_PERF_TICK, EV_RECONNECT, EV_POOL_KEEPALIVE,
 	EV_SWITCH_POOL, EV_DEV_POOL_EXIT, EV_USR_HASHRATE, EV_USR_RESULTS, EV_USR_CONNSTAT,
 	EV_HASHRATE_LOOP, EV_HTML_HASHRATE, EV_HTML_RESULTS, EV_HTML_CONNSTAT };
 
@@ -60,15 +177,17 @@ struct ex_event
 
 	union
 	{
-		pool_job oPoolJob;
+		job_ref oPoolJob;
 		job_result oJobResult;
 		std::string sSocketError;
+		pool_result oPoolResult;
 	};
 
 	ex_event() { iName = EV_INVALID_VAL; iPoolId = 0;}
 	ex_event(std::string&& err, size_t id) : iName(EV_SOCK_ERROR), iPoolId(id), sSocketError(std::move(err)) { }
 	ex_event(job_result dat, size_t id) : iName(EV_MINER_HAVE_RESULT), iPoolId(id), oJobResult(dat) {}
-	ex_event(pool_job dat, size_t id) : iName(EV_POOL_HAVE_JOB), iPoolId(id), oPoolJob(dat) {}
+	ex_event(job_ref dat, size_t id) : iName(EV_POOL_HAVE_JOB), iPoolId(id), oPoolJob(std::move(dat)) {}
+	ex_event(pool_result&& dat, size_t id) : iName(EV_POOL_RESULT), iPoolId(id), oPoolResult(std::move(dat)) {}
 	ex_event(ex_event_name ev, size_t id = 0) : iName(ev), iPoolId(id) {}
 
 	// Delete the copy operators to make sure we are moving only what is needed
@@ -85,11 +204,14 @@ struct ex_event
 		case EV_SOCK_ERROR:
 			new (&sSocketError) std::string(std::move(from.sSocketError));
 			break;
+		case EV_POOL_RESULT:
+			new (&oPoolResult) pool_result(std::move(from.oPoolResult));
+			break;
 		case EV_MINER_HAVE_RESULT:
 			oJobResult = from.oJobResult;
 			break;
 		case EV_POOL_HAVE_JOB:
-			oPoolJob = from.oPoolJob;
+			new (&oPoolJob) job_ref(std::move(from.oPoolJob));
 			break;
 		default:
 			break;
@@ -100,8 +222,7 @@ struct ex_event
 	{
 		assert(this != &from);
 
-		if(iName == EV_SOCK_ERROR)
-			sSocketError.~basic_string();
+		destroy();
 
 		iName = from.iName;
 		iPoolId = from.iPoolId;
@@ -112,11 +233,14 @@ struct ex_event
 			new (&sSocketError) std::string();
 			sSocketError = std::move(from.sSocketError);
 			break;
+		case EV_POOL_RESULT:
+			new (&oPoolResult) pool_result(std::move(from.oPoolResult));
+			break;
 		case EV_MINER_HAVE_RESULT:
 			oJobResult = from.oJobResult;
 			break;
 		case EV_POOL_HAVE_JOB:
-			oPoolJob = from.oPoolJob;
+			new (&oPoolJob) job_ref(std::move(from.oPoolJob));
 			break;
 		default:
 			break;
@@ -126,8 +250,18 @@ struct ex_event
 	}
 
 	~ex_event()
+	{
+		destroy();
+	}
+
+private:
+	inline void destroy()
 	{
 		if(iName == EV_SOCK_ERROR)
 			sSocketError.~basic_string();
+		else if(iName == EV_POOL_RESULT)
+			oPoolResult.~pool_result();
+		else if(iName == EV_POOL_HAVE_JOB)
+			oPoolJob.~job_ref();
 	}
 };
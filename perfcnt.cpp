@@ -0,0 +1,144 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "perfcnt.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int open_counter(uint32_t iType, uint64_t iConfig, int iGroupFd)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = iType;
+	attr.config = iConfig;
+	attr.exclude_kernel = 1; // Hashing is all user space, and it gets us past perf_event_paranoid=2
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, iGroupFd, 0);
+}
+
+static uint64_t cache_miss(uint64_t iCache)
+{
+	return iCache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
+perf_counters::perf_counters() : iGroupSize(0), bReady(false)
+{
+	for(size_t i = 0; i < COUNTER_CNT; i++)
+	{
+		iFds[i] = -1;
+		iGroupPos[i] = 0;
+	}
+}
+
+perf_counters::~perf_counters()
+{
+	close_all();
+}
+
+void perf_counters::close_all()
+{
+	bReady.store(false, std::memory_order_relaxed);
+#if defined(__linux__)
+	// Members first, the leader goes last
+	for(size_t i = COUNTER_CNT; i-- > 0; )
+	{
+		if(iFds[i] >= 0)
+			close(iFds[i]);
+		iFds[i] = -1;
+	}
+#endif
+	iGroupSize = 0;
+}
+
+bool perf_counters::open()
+{
+#if defined(__linux__)
+	const struct { uint32_t iType; uint64_t iConfig; } oEvents[COUNTER_CNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL) },
+		{ PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES }
+	};
+
+	close_all();
+
+	// Cycles lead the group, without them none of the rest means much
+	iFds[CYCLES] = open_counter(oEvents[CYCLES].iType, oEvents[CYCLES].iConfig, -1);
+	if(iFds[CYCLES] < 0)
+		return false;
+	iGroupPos[CYCLES] = iGroupSize++;
+
+	for(size_t i = CYCLES + 1; i < COUNTER_CNT; i++)
+	{
+		iFds[i] = open_counter(oEvents[i].iType, oEvents[i].iConfig, iFds[CYCLES]);
+		if(iFds[i] >= 0)
+			iGroupPos[i] = iGroupSize++;
+	}
+
+	bReady.store(true, std::memory_order_release);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool perf_counters::read(sample& out)
+{
+	if(!bReady.load(std::memory_order_acquire))
+		return false;
+
+#if defined(__linux__)
+	// nr, time_enabled, time_running, then a value for each member in the order they were opened
+	uint64_t buf[3 + COUNTER_CNT];
+	ssize_t iLen = ::read(iFds[CYCLES], buf, sizeof(buf));
+	if(iLen < ssize_t(sizeof(uint64_t) * (3 + iGroupSize)) || buf[0] != iGroupSize)
+		return false;
+
+	uint64_t iEnabled = buf[1], iRunning = buf[2];
+	for(size_t i = 0; i < COUNTER_CNT; i++)
+	{
+		out.bHave[i] = iFds[i] >= 0 && iRunning != 0;
+		out.iValue[i] = 0;
+		if(!out.bHave[i])
+			continue;
+
+		// Scale up if the group had to share the PMU with somebody
+		uint64_t iVal = buf[3 + iGroupPos[i]];
+		out.iValue[i] = iRunning == iEnabled ? iVal : uint64_t(double(iVal) * iEnabled / iRunning);
+	}
+
+	out.iTimeEnabled = iEnabled;
+	return true;
+#else
+	return false;
+#endif
+}
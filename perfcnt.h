@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/*
+	Hardware performance counters of one thread, through perf_event_open. They are opened as one
+	group so that all of them count over the same time, and read with a single system call.
+
+	Counters that the CPU (or a VM, or perf_event_paranoid) won't give us are simply missing. If
+	we can't even count cycles, or we aren't on Linux, there is nothing at all and read() says so.
+*/
+class perf_counters
+{
+public:
+	enum counter { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, REF_CYCLES, COUNTER_CNT };
+
+	struct sample
+	{
+		uint64_t iValue[COUNTER_CNT];
+		bool bHave[COUNTER_CNT];
+		uint64_t iTimeEnabled; // ns the thread was on a CPU, values are scaled to it
+	};
+
+	perf_counters();
+	~perf_counters();
+
+	// Counts the calling thread from now on
+	bool open();
+
+	// Any thread, false if we have no counters
+	bool read(sample& out);
+
+private:
+	void close_all();
+
+	int iFds[COUNTER_CNT];
+	size_t iGroupPos[COUNTER_CNT];
+	size_t iGroupSize;
+	std::atomic<bool> bReady;
+};
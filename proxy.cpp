@@ -0,0 +1,430 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "proxy.h"
+#include "executor.h"
+#include "jpsock.h"
+#include "jconf.h"
+#include "console.h"
+#include "hexcodec.h"
+
+#include "rapidjson/document.h"
+#include "jext.h"
+
+// The nonce is at 39, and the top byte is the one we hand out
+constexpr size_t iNonceByteOff = 42;
+
+proxy* proxy::oInst = nullptr;
+
+proxy::proxy() : hListen(INVALID_SOCKET), iClientCnt(0), iNextConnId(1), iJobNonceOff(0), iJobParamsOff(0),
+	iJobPos(0), iNextTag(1), iAccepted(0), iRejected(0)
+{
+	memset(vClients, 0, sizeof(vClients));
+	memset(oJobs, 0, sizeof(oJobs));
+}
+
+bool proxy::start()
+{
+	char sSockErr[256];
+	uint16_t iPort = jconf::inst()->GetProxyPort();
+
+	if(!share_check::inst()->start())
+		return false;
+
+	sock_init();
+
+	hListen = sock_listen(iPort);
+	if(hListen == INVALID_SOCKET)
+	{
+		printer::inst()->print_msg(L0, "PROXY error: can't listen on port %u: %s", (unsigned int)iPort,
+			sock_strerror(sSockErr, sizeof(sSockErr)));
+		return false;
+	}
+
+	reactor::inst()->add_socket(hListen, this, false);
+	printer::inst()->print_msg(L1, "Proxy listening on port %u.", (unsigned int)iPort);
+	return true;
+}
+
+void proxy::on_sock_event(uint32_t iEvents)
+{
+	std::unique_lock<std::mutex> lck(proxy_mutex);
+	accept_clients();
+}
+
+// Needs proxy_mutex
+void proxy::accept_clients()
+{
+	while(true)
+	{
+		SOCKET s = accept(hListen, nullptr, nullptr);
+		if(s == INVALID_SOCKET)
+			return; // Would block, or the client is already gone
+
+		uint8_t iNonceByte = 0;
+		for(size_t i=1; i <= iMaxClients; i++)
+		{
+			if(vClients[i] == nullptr)
+			{
+				iNonceByte = (uint8_t)i;
+				break;
+			}
+		}
+
+		if(iNonceByte == 0)
+		{
+			printer::inst()->print_msg(L2, "Proxy is full (%u miners), connection refused.", (unsigned int)iMaxClients);
+			sock_close(s);
+			continue;
+		}
+
+		if(!sock_set_nonblock(s))
+		{
+			sock_close(s);
+			continue;
+		}
+		sock_set_nodelay(s);
+
+		client* c = new client(s, iNextConnId++, iNonceByte);
+		vClients[iNonceByte] = c;
+		iClientCnt++;
+
+		if(!reactor::inst()->add_socket(s, c, false))
+		{
+			vClients[iNonceByte] = nullptr;
+			iClientCnt--;
+			sock_close(s);
+			delete c;
+		}
+	}
+}
+
+void proxy::client::on_sock_event(uint32_t iEvents)
+{
+	proxy::inst()->on_client_event(this, iEvents);
+}
+
+// Downstream lines are short and rare (a login and the shares), so they are simply parsed into a DOM
+bool proxy::client::on_line(char* line, size_t len)
+{
+	return proxy::inst()->process_line(this, line, len);
+}
+
+void proxy::on_client_event(client* c, uint32_t iEvents)
+{
+	std::unique_lock<std::mutex> lck(proxy_mutex);
+
+	if(!c->handle_events(iEvents))
+		drop_client(c);
+}
+
+// Needs proxy_mutex, reactor thread only
+void proxy::drop_client(client* c)
+{
+	c->close();
+
+	vClients[c->iNonceByte] = nullptr;
+	iClientCnt--;
+
+	if(c->bLoggedIn)
+		printer::inst()->print_msg(L3, "Proxy miner %u disconnected.", (unsigned int)c->iNonceByte);
+
+	delete c;
+}
+
+bool proxy::process_line(client* c, char* line, size_t len)
+{
+	MemoryPoolAllocator<> oAlloc(bParseMem, sizeof(bParseMem));
+	Document oDoc(&oAlloc);
+
+	if(oDoc.ParseInsitu(line).HasParseError() || !oDoc.IsObject())
+		return false;
+
+	const Value* pId = GetObjectMember(oDoc, "id");
+	const Value* pMethod = GetObjectMember(oDoc, "method");
+	if(pMethod == nullptr || !pMethod->IsString())
+		return false;
+
+	uint64_t iCallId = pId != nullptr && pId->IsUint64() ? pId->GetUint64() : 0;
+	const char* sMethod = pMethod->GetString();
+
+	if(strcmp(sMethod, "login") == 0)
+		return cmd_login(c, iCallId);
+
+	if(strcmp(sMethod, "submit") == 0)
+	{
+		if(!c->bLoggedIn)
+			return send_reply(c, iCallId, "Unauthenticated");
+
+		const Value* pParams = GetObjectMember(oDoc, "params");
+		if(pParams == nullptr || !pParams->IsObject())
+			return send_reply(c, iCallId, "Invalid share");
+
+		const Value* pJobId = GetObjectMember(*pParams, "job_id");
+		const Value* pNonce = GetObjectMember(*pParams, "nonce");
+		const Value* pResult = GetObjectMember(*pParams, "result");
+
+		if(pJobId == nullptr || !pJobId->IsString() || pJobId->GetStringLength() >= sizeof(job_entry::sJobID) ||
+			pNonce == nullptr || !pNonce->IsString() || pNonce->GetStringLength() != 8 ||
+			pResult == nullptr || !pResult->IsString() || pResult->GetStringLength() != 64)
+			return send_reply(c, iCallId, "Invalid share");
+
+		return cmd_submit(c, iCallId, pJobId->GetString(), pNonce->GetString(), pResult->GetString());
+	}
+
+	if(strcmp(sMethod, "keepalived") == 0)
+	{
+		char sReply[128];
+		int len = snprintf(sReply, sizeof(sReply),
+			"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":null,\"result\":{\"status\":\"KEEPALIVED\"}}\n", int_port(iCallId));
+		c->send(sReply, len);
+		return true;
+	}
+
+	return send_reply(c, iCallId, "Unsupported method");
+}
+
+bool proxy::cmd_login(client* c, uint64_t iCallId)
+{
+	if(sJobLine.empty())
+		return send_reply(c, iCallId, "No job from the pool yet, try again later");
+
+	char sHead[128];
+	int iHeadLen = snprintf(sHead, sizeof(sHead),
+		"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":null,\"result\":{\"id\":\"%u\",\"job\":",
+		int_port(iCallId), (unsigned int)c->iNonceByte);
+
+	static const char sTail[] = ",\"status\":\"OK\"}}\n";
+
+	// Params without the "}\n" that closes the job line
+	size_t iParamsLen = sJobLine.size() - iJobParamsOff - 2;
+
+	std::string sReply;
+	sReply.reserve(iHeadLen + iParamsLen + sizeof(sTail));
+	sReply.append(sHead, iHeadLen);
+	sReply.append(sJobLine, iJobParamsOff, iParamsLen);
+	sReply.append(sTail, sizeof(sTail) - 1);
+	hex_encode(&c->iNonceByte, 1, &sReply[iHeadLen + iJobNonceOff - iJobParamsOff]);
+
+	if(!c->bLoggedIn)
+	{
+		c->bLoggedIn = true;
+		printer::inst()->print_msg(L3, "Proxy miner %u logged in.", (unsigned int)c->iNonceByte);
+	}
+
+	c->send(sReply.data(), sReply.size());
+	return true;
+}
+
+bool proxy::cmd_submit(client* c, uint64_t iCallId, const char* sJobId, const char* sNonce, const char* sResult)
+{
+	uint32_t iNonce;
+	uint8_t bResult[32];
+	if(!hex_decode(sNonce, 8, (uint8_t*)&iNonce) || !hex_decode(sResult, 64, bResult))
+		return send_reply(c, iCallId, "Invalid share");
+
+	// Miners that don't keep the nonce byte would be mining on someone else's slice
+	if((iNonce >> 24) != c->iNonceByte)
+		return send_reply(c, iCallId, "Nonce out of range, turn nicehash_nonce on");
+
+	const job_entry* job = nullptr;
+	for(size_t i=0; i < iJobHistory; i++)
+	{
+		if(oJobs[i].iPoolId != 0 && strcmp(oJobs[i].sJobID, sJobId) == 0)
+		{
+			job = &oJobs[i];
+			break;
+		}
+	}
+
+	if(job == nullptr)
+		return send_reply(c, iCallId, "Block expired");
+
+	// The job entry can be reused before the hash is done, so the share takes a copy of it
+	share_check::share oShare;
+	memcpy(oShare.bBlob, job->bBlob, job->iWorkLen);
+	oShare.iBlobLen = job->iWorkLen;
+	oShare.iNonce = iNonce;
+	memcpy(oShare.bResult, bResult, sizeof(bResult));
+	oShare.iTarget = job->iTarget;
+
+	uint64_t iConnId = c->iConnId;
+	uint8_t iNonceByte = c->iNonceByte;
+	job_entry oJob = *job;
+	oShare.fnDone = [this, iConnId, iNonceByte, iCallId, oJob, iNonce, bResult](share_check::verdict v, uint32_t) {
+		on_share_checked(iConnId, iNonceByte, iCallId, oJob, iNonce, bResult, v);
+	};
+
+	share_check::inst()->push(std::move(oShare));
+	return true;
+}
+
+void proxy::on_share_checked(uint64_t iConnId, uint8_t iNonceByte, uint64_t iCallId, const job_entry& job,
+	uint32_t iNonce, const uint8_t* bResult, share_check::verdict v)
+{
+	std::unique_lock<std::mutex> lck(proxy_mutex);
+
+	// The miner may have left while we were hashing
+	client* c = vClients[iNonceByte];
+	if(c == nullptr || c->iConnId != iConnId)
+		return;
+
+	if(v != share_check::share_ok)
+	{
+		iRejected++;
+		send_reply(c, iCallId, v == share_check::share_bad_hash ? "Incorrect hash" : "Low difficulty share");
+		return;
+	}
+
+	uint64_t iTag = iNextTag++;
+	mPending[iTag] = { iConnId, iCallId, iNonceByte };
+
+	// The executor submits it like one of our own, the verdict comes back through on_result
+	executor::inst()->push_event(ex_event(job_result(job.sJobID, job.iJobGen, iNonce, bResult, iTag), job.iPoolId));
+}
+
+bool proxy::send_reply(client* c, uint64_t iCallId, const char* sError)
+{
+	char sReply[256];
+	int len;
+
+	if(sError == nullptr)
+		len = snprintf(sReply, sizeof(sReply),
+			"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":null,\"result\":{\"status\":\"OK\"}}\n", int_port(iCallId));
+	else
+	{
+		// Pool errors are passed on as they are, minus anything that would need escaping
+		char sMsg[129];
+		size_t n;
+		for(n=0; n < sizeof(sMsg) - 1 && sError[n] != '\0'; n++)
+		{
+			char ch = sError[n];
+			sMsg[n] = (ch == '"' || ch == '\\' || (unsigned char)ch < 0x20) ? '\'' : ch;
+		}
+		sMsg[n] = '\0';
+
+		len = snprintf(sReply, sizeof(sReply),
+			"{\"id\":%llu,\"jsonrpc\":\"2.0\",\"error\":{\"code\":-1,\"message\":\"%s\"}}\n", int_port(iCallId), sMsg);
+	}
+
+	c->send(sReply, len);
+	return true;
+}
+
+void proxy::on_job(const pool_job& oPoolJob, size_t pool_id)
+{
+	static const char sHead[] = "{\"jsonrpc\":\"2.0\",\"method\":\"job\",\"params\":";
+	static const char sBlob[] = "{\"blob\":\"";
+
+	if(oPoolJob.iWorkLen <= iNonceByteOff)
+		return;
+
+	// The pool's nonce bytes are cleared, the top one is filled in per client
+	uint8_t bBlob[sizeof(pool_job::bWorkBlob)];
+	memcpy(bBlob, oPoolJob.bWorkBlob, oPoolJob.iWorkLen);
+	memset(bBlob + 39, 0, 4);
+
+	// Send the short form of the target if it survives the round trip
+	char sTarget[17];
+	size_t iTargetLen = 8;
+	uint32_t iTarget32 = uint32_t(0xFFFFFFFFULL / (0xFFFFFFFFFFFFFFFFULL / oPoolJob.iTarget));
+	if(iTarget32 != 0 && jpsock::t32_to_t64(iTarget32) == oPoolJob.iTarget)
+		hex_encode((const uint8_t*)&iTarget32, 4, sTarget);
+	else
+	{
+		hex_encode((const uint8_t*)&oPoolJob.iTarget, 8, sTarget);
+		iTargetLen = 16;
+	}
+
+	std::unique_lock<std::mutex> lck(proxy_mutex);
+
+	job_entry& job = oJobs[iJobPos];
+	iJobPos = (iJobPos + 1) % iJobHistory;
+	memcpy(job.sJobID, oPoolJob.sJobID, sizeof(job.sJobID));
+	job.iJobGen = oPoolJob.iJobGen;
+	job.iPoolId = pool_id;
+	memcpy(job.bBlob, bBlob, oPoolJob.iWorkLen);
+	job.iWorkLen = oPoolJob.iWorkLen;
+	job.iTarget = oPoolJob.iTarget;
+
+	size_t iJobIdLen = strnlen(oPoolJob.sJobID, sizeof(pool_job::sJobID) - 1);
+
+	sJobLine.clear();
+	sJobLine.append(sHead, sizeof(sHead) - 1);
+	iJobParamsOff = sJobLine.size();
+	sJobLine.append(sBlob, sizeof(sBlob) - 1);
+
+	size_t iBlobOff = sJobLine.size();
+	sJobLine.resize(iBlobOff + oPoolJob.iWorkLen * 2);
+	hex_encode(bBlob, oPoolJob.iWorkLen, &sJobLine[iBlobOff]);
+	iJobNonceOff = iBlobOff + iNonceByteOff * 2;
+
+	sJobLine.append("\",\"job_id\":\"");
+	sJobLine.append(oPoolJob.sJobID, iJobIdLen);
+	sJobLine.append("\",\"target\":\"");
+	sJobLine.append(sTarget, iTargetLen);
+	sJobLine.append("\"}}\n");
+
+	for(size_t i=1; i <= iMaxClients; i++)
+	{
+		client* c = vClients[i];
+		if(c == nullptr || !c->bLoggedIn)
+			continue;
+
+		hex_encode(&c->iNonceByte, 1, &sJobLine[iJobNonceOff]);
+		c->send(sJobLine.data(), sJobLine.size());
+	}
+}
+
+void proxy::on_result(uint64_t iTag, const char* sError)
+{
+	std::unique_lock<std::mutex> lck(proxy_mutex);
+
+	auto it = mPending.find(iTag);
+	if(it == mPending.end())
+		return;
+
+	pending_share share = it->second;
+	mPending.erase(it);
+
+	if(sError == nullptr)
+		iAccepted++;
+	else
+		iRejected++;
+
+	// The miner may have left (and someone else may have its nonce byte by now)
+	client* c = vClients[share.iNonceByte];
+	if(c != nullptr && c->iConnId == share.iConnId)
+		send_reply(c, share.iCallId, sError);
+}
+
+void proxy::get_stats(size_t& iClients, uint64_t& iAcc, uint64_t& iRej)
+{
+	std::unique_lock<std::mutex> lck(proxy_mutex);
+	iClients = iClientCnt;
+	iAcc = iAccepted;
+	iRej = iRejected;
+}
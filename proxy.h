@@ -0,0 +1,124 @@
+#pragma once
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "msgstruct.h"
+#include "downstream.h"
+#include "share_check.h"
+
+/* Stratum proxy. Downstream miners log in to us instead of the pool and we forward their
+	shares over our own pool connection, so the pool sees one login no matter how many
+	miners are behind it.
+
+	The nonce space is split the NiceHash way: every downstream miner gets its own value
+	of the top nonce byte (byte 42 of the blob) and has to keep it, which is what miners
+	do with nicehash_nonce switched on. Value 0 belongs to our own threads, which is why
+	we can't do this behind a NiceHash pool - it already owns that byte.
+
+	A job is rendered into a line once when the pool sends it. The only thing that differs
+	between clients is the hex of the nonce byte, which is patched in place right before
+	each send, so fanning out a job doesn't parse or allocate anything.
+
+	Shares are hashed by share_check before they go to the pool, so a miner with broken
+	hashes gets its errors from us and doesn't get our pool login banned.
+
+	Client sockets and the listening socket are serviced by the reactor thread, jobs and
+	pool verdicts come from the executor. Both sides hold proxy_mutex. Clients are only
+	ever deleted on the reactor thread, the executor just marks them dead.
+*/
+class proxy : public sock_handler
+{
+public:
+	static proxy* inst()
+	{
+		if (oInst == nullptr) oInst = new proxy;
+		return oInst;
+	};
+
+	// Nonce byte 0 is ours
+	constexpr static size_t iMaxClients = 255;
+
+	bool start();
+
+	// A new job from the active user pool
+	void on_job(const pool_job& oPoolJob, size_t pool_id);
+	// Pool's verdict on a share, sError is nullptr if it was accepted
+	void on_result(uint64_t iTag, const char* sError);
+
+	void get_stats(size_t& iClients, uint64_t& iAccepted, uint64_t& iRejected);
+
+	void on_sock_event(uint32_t iEvents);
+
+private:
+	proxy();
+	static proxy* oInst;
+
+	struct client final : public downstream
+	{
+		uint8_t iNonceByte;
+
+		client(SOCKET s, uint64_t id, uint8_t nb) : downstream(s, id), iNonceByte(nb) {}
+		void on_sock_event(uint32_t iEvents);
+		bool on_line(char* line, size_t len);
+	};
+
+	struct job_entry
+	{
+		char sJobID[64];
+		uint64_t iJobGen;
+		size_t iPoolId;
+		// The job as the clients got it, with the nonce cleared, to check their shares against
+		uint8_t bBlob[sizeof(pool_job::bWorkBlob)];
+		uint32_t iWorkLen;
+		uint64_t iTarget;
+	};
+
+	struct pending_share
+	{
+		uint64_t iConnId;
+		uint64_t iCallId;
+		uint8_t iNonceByte;
+	};
+
+	void accept_clients();
+	void on_client_event(client* c, uint32_t iEvents);
+	void drop_client(client* c);
+
+	bool process_line(client* c, char* line, size_t len);
+	bool cmd_login(client* c, uint64_t iCallId);
+	bool cmd_submit(client* c, uint64_t iCallId, const char* sJobId, const char* sNonce, const char* sResult);
+	void on_share_checked(uint64_t iConnId, uint8_t iNonceByte, uint64_t iCallId, const job_entry& job,
+		uint32_t iNonce, const uint8_t* bResult, share_check::verdict v);
+	bool send_reply(client* c, uint64_t iCallId, const char* sError);
+
+	std::mutex proxy_mutex;
+	SOCKET hListen;
+
+	client* vClients[iMaxClients + 1];
+	size_t iClientCnt;
+	uint64_t iNextConnId;
+
+	// Current job line and the offset of the nonce byte hex in it. The params object is
+	// the part of the line between iJobParamsOff and the last two characters ("}\n"),
+	// login replies embed it as well.
+	std::string sJobLine;
+	size_t iJobNonceOff;
+	size_t iJobParamsOff;
+
+	// Shares that come in for the job before the current one are still fine if the block
+	// didn't change, so keep a few
+	constexpr static size_t iJobHistory = 4;
+	job_entry oJobs[iJobHistory];
+	size_t iJobPos;
+
+	std::unordered_map<uint64_t, pending_share> mPending;
+	uint64_t iNextTag;
+
+	uint64_t iAccepted;
+	uint64_t iRejected;
+
+	// Parser memory for the client lines, they are tiny
+	uint8_t bParseMem[8192];
+};
@@ -0,0 +1,343 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <chrono>
+#include <assert.h>
+
+#include "reactor.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+reactor* reactor::oInst = nullptr;
+
+#if defined(__linux__)
+// epoll hands back one 64 bit value per event, the fd goes in the low half and the tag in the high one
+static inline uint64_t event_data(int fd, uint32_t iTag)
+{
+	return (uint64_t(iTag) << 32) | uint32_t(fd);
+}
+#endif
+
+reactor::reactor()
+{
+	sock_init();
+
+#if defined(__linux__)
+	hEpoll = epoll_create1(EPOLL_CLOEXEC);
+	hWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	assert(hEpoll != -1 && hWakeFd != -1);
+
+	epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.u64 = event_data(hWakeFd, 0);
+	epoll_ctl(hEpoll, EPOLL_CTL_ADD, hWakeFd, &ev);
+#else
+	// No eventfd here, so we wake ourselves up with a datagram sent to our own loopback socket
+	sockaddr_in addr = { 0 };
+	socklen_t addrlen = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	hWakeSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	assert(hWakeSock != INVALID_SOCKET);
+	bind(hWakeSock, (sockaddr*)&addr, sizeof(addr));
+	getsockname(hWakeSock, (sockaddr*)&addr, &addrlen);
+	::connect(hWakeSock, (sockaddr*)&addr, addrlen);
+	sock_set_nonblock(hWakeSock);
+#endif
+}
+
+void reactor::start()
+{
+	if(my_thd != nullptr)
+		return;
+
+	my_thd = new std::thread(&reactor::reactor_main, this);
+}
+
+uint64_t reactor::get_ms_time()
+{
+	using namespace std::chrono;
+	return time_point_cast<milliseconds>(steady_clock::now()).time_since_epoch().count();
+}
+
+void reactor::wake()
+{
+#if defined(__linux__)
+	uint64_t one = 1;
+	if(write(hWakeFd, &one, sizeof(one)) != sizeof(one))
+		return; // Counter is already non-zero, reactor will wake up anyway
+#else
+	char c = 0;
+	::send(hWakeSock, &c, 1, 0);
+#endif
+}
+
+void reactor::drain_wake()
+{
+#if defined(__linux__)
+	uint64_t cnt;
+	if(read(hWakeFd, &cnt, sizeof(cnt)) != sizeof(cnt))
+		return;
+#else
+	char buf[64];
+	while(::recv(hWakeSock, buf, sizeof(buf), 0) > 0) {}
+#endif
+}
+
+bool reactor::add_socket(SOCKET s, sock_handler* h, bool bWantWrite)
+{
+	std::unique_lock<std::mutex> lck(sock_mutex);
+	uint32_t iTag = iNextTag++;
+	if(iTag == 0)
+		iTag = iNextTag++;
+	mSockets[s] = { h, bWantWrite, iTag };
+
+#if defined(__linux__)
+	epoll_event ev = { 0 };
+	ev.events = EPOLLIN | (bWantWrite ? EPOLLOUT : 0);
+	ev.data.u64 = event_data(s, iTag);
+	if(epoll_ctl(hEpoll, EPOLL_CTL_ADD, s, &ev) != 0)
+	{
+		mSockets.erase(s);
+		return false;
+	}
+#else
+	lck.unlock();
+	if(!is_reactor_thread())
+		wake();
+#endif
+	return true;
+}
+
+void reactor::set_want_write(SOCKET s, bool bWantWrite)
+{
+	std::unique_lock<std::mutex> lck(sock_mutex);
+	auto it = mSockets.find(s);
+	if(it == mSockets.end() || it->second.bWantWrite == bWantWrite)
+		return;
+
+	it->second.bWantWrite = bWantWrite;
+
+#if defined(__linux__)
+	epoll_event ev = { 0 };
+	ev.events = EPOLLIN | (bWantWrite ? EPOLLOUT : 0);
+	ev.data.u64 = event_data(s, it->second.iTag);
+	epoll_ctl(hEpoll, EPOLL_CTL_MOD, s, &ev);
+#else
+	lck.unlock();
+	if(!is_reactor_thread())
+		wake();
+#endif
+}
+
+// Needs to be called before the socket is closed
+void reactor::del_socket(SOCKET s)
+{
+	std::unique_lock<std::mutex> lck(sock_mutex);
+	if(mSockets.erase(s) == 0)
+		return;
+
+#if defined(__linux__)
+	epoll_event ev = { 0 };
+	epoll_ctl(hEpoll, EPOLL_CTL_DEL, s, &ev);
+#else
+	lck.unlock();
+	if(!is_reactor_thread())
+		wake();
+#endif
+}
+
+size_t reactor::add_timer(size_t iMilisec, timer_fn&& fn)
+{
+	std::unique_lock<std::mutex> lck(timer_mutex);
+
+	size_t id = iNextTimerId++;
+	if(id == invalid_timer)
+		id = iNextTimerId++;
+
+	uint64_t deadline = get_ms_time() + iMilisec;
+	auto res = mTimers.emplace(std::make_pair(deadline, id), std::move(fn));
+	mTimerDeadlines[id] = deadline;
+	bool bFirst = res.first == mTimers.begin();
+	lck.unlock();
+
+	// Only need to interrupt the wait if we moved the next deadline forward
+	if(bFirst && !is_reactor_thread())
+		wake();
+
+	return id;
+}
+
+void reactor::del_timer(size_t iTimerId)
+{
+	std::unique_lock<std::mutex> lck(timer_mutex);
+	auto it = mTimerDeadlines.find(iTimerId);
+	if(it == mTimerDeadlines.end())
+		return;
+
+	mTimers.erase(std::make_pair(it->second, iTimerId));
+	mTimerDeadlines.erase(it);
+}
+
+int reactor::next_timeout()
+{
+	std::unique_lock<std::mutex> lck(timer_mutex);
+	if(mTimers.empty())
+		return -1;
+
+	uint64_t now = get_ms_time();
+	uint64_t deadline = mTimers.begin()->first.first;
+	return deadline > now ? int(deadline - now) : 0;
+}
+
+void reactor::run_timers()
+{
+	uint64_t now = get_ms_time();
+	while(true)
+	{
+		std::unique_lock<std::mutex> lck(timer_mutex);
+		auto it = mTimers.begin();
+		if(it == mTimers.end() || it->first.first > now)
+			break;
+
+		timer_fn fn = std::move(it->second);
+		mTimerDeadlines.erase(it->first.second);
+		mTimers.erase(it);
+		lck.unlock();
+
+		fn();
+	}
+}
+
+void reactor::dispatch(SOCKET s, uint32_t iTag, uint32_t iEvents)
+{
+	std::unique_lock<std::mutex> lck(sock_mutex);
+	auto it = mSockets.find(s);
+	if(it == mSockets.end() || it->second.iTag != iTag)
+		return; // Removed (and maybe reused) while we were waiting
+
+	sock_handler* h = it->second.h;
+	lck.unlock();
+
+	h->on_sock_event(iEvents);
+}
+
+#if defined(__linux__)
+void reactor::reactor_main()
+{
+	constexpr size_t iMaxEvents = 64;
+	epoll_event evs[iMaxEvents];
+
+	my_id = std::this_thread::get_id();
+
+	while(true)
+	{
+		int n = epoll_wait(hEpoll, evs, iMaxEvents, next_timeout());
+
+		for(int i = 0; i < n; i++)
+		{
+			SOCKET s = SOCKET(evs[i].data.u64 & 0xFFFFFFFF);
+			uint32_t iTag = uint32_t(evs[i].data.u64 >> 32);
+			if(iTag == 0 && s == hWakeFd)
+			{
+				drain_wake();
+				continue;
+			}
+
+			uint32_t iEvents = 0;
+			if(evs[i].events & EPOLLIN)
+				iEvents |= ev_read;
+			if(evs[i].events & EPOLLOUT)
+				iEvents |= ev_write;
+			if(evs[i].events & (EPOLLERR | EPOLLHUP))
+				iEvents |= ev_error;
+
+			dispatch(s, iTag, iEvents);
+		}
+
+		run_timers();
+	}
+}
+#else
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+void reactor::reactor_main()
+{
+	std::vector<pollfd> vFds;
+	std::vector<uint32_t> vTags;
+
+	my_id = std::this_thread::get_id();
+
+	while(true)
+	{
+		vFds.clear();
+		vTags.clear();
+		vFds.push_back({ hWakeSock, POLLIN, 0 });
+		vTags.push_back(0);
+
+		std::unique_lock<std::mutex> lck(sock_mutex);
+		for(auto& it : mSockets)
+		{
+			vFds.push_back({ it.first, short(POLLIN | (it.second.bWantWrite ? POLLOUT : 0)), 0 });
+			vTags.push_back(it.second.iTag);
+		}
+		lck.unlock();
+
+		int n = poll(vFds.data(), vFds.size(), next_timeout());
+
+		if(n > 0)
+		{
+			if(vFds[0].revents != 0)
+				drain_wake();
+
+			for(size_t i = 1; i < vFds.size(); i++)
+			{
+				short rev = vFds[i].revents;
+				if(rev == 0)
+					continue;
+
+				uint32_t iEvents = 0;
+				if(rev & POLLIN)
+					iEvents |= ev_read;
+				if(rev & POLLOUT)
+					iEvents |= ev_write;
+				if(rev & (POLLERR | POLLHUP | POLLNVAL))
+					iEvents |= ev_error;
+
+				dispatch(vFds[i].fd, vTags[i], iEvents);
+			}
+		}
+
+		run_timers();
+	}
+}
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+#include <stdint.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+
+#include "socks.h"
+
+/* Anything that owns a socket registered with the reactor. Callbacks are always
+   made on the reactor thread, and may arrive spuriously (e.g. after the socket was
+   removed from another thread), so handlers need to check their own state. */
+class sock_handler
+{
+public:
+	virtual ~sock_handler() {}
+	virtual void on_sock_event(uint32_t iEvents) = 0;
+};
+
+/*
+ * One thread that services every socket we have open with epoll (or poll() where
+ * epoll is not available) and runs the network timers. Sockets are level-triggered,
+ * we always wait for readability and only ask for writability while connecting or
+ * when we have queued data that the kernel didn't take.
+ */
+class reactor
+{
+public:
+	static reactor* inst()
+	{
+		if (oInst == nullptr) oInst = new reactor;
+		return oInst;
+	};
+
+	constexpr static uint32_t ev_read = 1;
+	constexpr static uint32_t ev_write = 2;
+	constexpr static uint32_t ev_error = 4;
+
+	void start();
+
+	bool add_socket(SOCKET s, sock_handler* h, bool bWantWrite);
+	void set_want_write(SOCKET s, bool bWantWrite);
+	void del_socket(SOCKET s);
+
+	typedef std::function<void()> timer_fn;
+	constexpr static size_t invalid_timer = 0;
+
+	// Timer callbacks run on the reactor thread, a timer fires once
+	size_t add_timer(size_t iMilisec, timer_fn&& fn);
+	void del_timer(size_t iTimerId);
+
+	inline bool is_reactor_thread() { return std::this_thread::get_id() == my_id; }
+
+	static uint64_t get_ms_time();
+
+private:
+	reactor();
+	static reactor* oInst;
+
+	void reactor_main();
+	void wake();
+	void drain_wake();
+	int next_timeout();
+	void run_timers();
+	void dispatch(SOCKET s, uint32_t iTag, uint32_t iEvents);
+
+	// Every add_socket gets a new tag and the events carry it. If the socket was closed and its
+	// number reused while an event was on its way, the tag tells us the event isn't for the new one.
+	struct sock_entry
+	{
+		sock_handler* h;
+		bool bWantWrite;
+		uint32_t iTag;
+	};
+
+	std::mutex sock_mutex;
+	std::unordered_map<SOCKET, sock_entry> mSockets;
+	uint32_t iNextTag = 1; // zero is the wake up fd
+
+	std::mutex timer_mutex;
+	std::map<std::pair<uint64_t, size_t>, timer_fn> mTimers;
+	std::unordered_map<size_t, uint64_t> mTimerDeadlines;
+	size_t iNextTimerId = 1;
+
+	std::thread* my_thd = nullptr;
+	std::atomic<std::thread::id> my_id;
+
+#if defined(__linux__)
+	int hEpoll;
+	int hWakeFd;
+#else
+	SOCKET hWakeSock;
+#endif
+};
@@ -0,0 +1,508 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "replay.h"
+#include "minethd.h"
+#include "executor.h"
+#include "jpsock.h"
+#include "console.h"
+#include "tsc_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#endif // _WIN32
+
+// How long the threads get to pick up a job before we give up on them
+constexpr uint64_t iSwitchTimeoutMs = 10000;
+
+const char* replay::usage()
+{
+	return "replay CONFIG RECORDING [--speed X] [--fast N [--check]]";
+}
+
+bool replay::parse_args(int argc, char* argv[], options& opt)
+{
+	for(int i = 0; i < argc; i++)
+	{
+		const char* sArg = argv[i];
+		bool bHaveVal = i + 1 < argc;
+
+		if(strcasecmp(sArg, "--speed") == 0 && bHaveVal)
+		{
+			const char* sVal = argv[++i];
+			char* sEnd;
+			opt.fSpeed = strtod(sVal, &sEnd);
+			if(*sVal == '\0' || *sEnd != '\0' || !(opt.fSpeed > 0.0))
+			{
+				printer::inst()->print_msg(L0, "Invalid value for %s: %s", sArg, sVal);
+				return false;
+			}
+		}
+		else if(strcasecmp(sArg, "--fast") == 0 && bHaveVal)
+		{
+			const char* sVal = argv[++i];
+			char* sEnd;
+			unsigned long iVal = strtoul(sVal, &sEnd, 10);
+			if(*sVal == '\0' || *sEnd != '\0' || iVal == 0 || iVal > 0x3FFFF)
+			{
+				printer::inst()->print_msg(L0, "Invalid value for %s: %s", sArg, sVal);
+				return false;
+			}
+			opt.iFastHashes = (uint32_t)iVal;
+		}
+		else if(strcasecmp(sArg, "--check") == 0)
+			opt.bCheck = true;
+		else if(sArg[0] != '-' && opt.sFile == nullptr)
+			opt.sFile = sArg;
+		else
+		{
+			printer::inst()->print_msg(L0, "Unknown or incomplete replay option %s", sArg);
+			printer::inst()->print_msg(L0, "Usage: %s", usage());
+			return false;
+		}
+	}
+
+	if(opt.sFile == nullptr)
+	{
+		printer::inst()->print_msg(L0, "No recording to replay.");
+		printer::inst()->print_msg(L0, "Usage: %s", usage());
+		return false;
+	}
+
+	// Only the fixed work is the same from run to run
+	if(opt.bCheck && opt.iFastHashes == 0)
+	{
+		printer::inst()->print_msg(L0, "--check needs --fast.");
+		return false;
+	}
+
+	return true;
+}
+
+replay::replay(const options& opt) : opt(opt), pvThreads(nullptr), pool(new jpsock(executor::usr_pool_id, false)),
+	ctx(nullptr), iJobsFed(0), bNiceHash(executor::usr_nicehash()), iMessages(0), iBadLines(0),
+	iAccepted(0), iStale(0), iInvalid(0), iFixedWork(0), iCreditedHashes(0)
+{
+}
+
+replay::~replay()
+{
+	delete pool;
+	if(ctx != nullptr)
+		cryptonight_free_ctx(ctx);
+}
+
+bool replay::load()
+{
+	FILE* f = fopen(opt.sFile, "rb");
+	if(f == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Unable to open %s.", opt.sFile);
+		return false;
+	}
+
+	std::string sLine;
+	size_t iLineNo = 0;
+	int c;
+	do
+	{
+		c = fgetc(f);
+		if(c != '\n' && c != EOF)
+		{
+			sLine += (char)c;
+			continue;
+		}
+
+		iLineNo++;
+		while(!sLine.empty() && (sLine.back() == '\r' || sLine.back() == ' ' || sLine.back() == '\t'))
+			sLine.pop_back();
+
+		if(!sLine.empty() && sLine[0] != '#')
+		{
+			char* sEnd;
+			line l;
+			l.iOffsetMs = strtoull(sLine.c_str(), &sEnd, 10);
+			bool bHaveTime = sEnd != sLine.c_str() && (*sEnd == ' ' || *sEnd == '\t');
+			while(*sEnd == ' ' || *sEnd == '\t')
+				sEnd++;
+
+			if(!bHaveTime || *sEnd == '\0' || (!vLines.empty() && l.iOffsetMs < vLines.back().iOffsetMs))
+			{
+				printer::inst()->print_msg(L0, "%s:%u: expected \"<ms> <message>\" with the times in order.",
+					opt.sFile, (unsigned)iLineNo);
+				fclose(f);
+				return false;
+			}
+
+			l.sJson = sEnd;
+			vLines.push_back(std::move(l));
+		}
+		sLine.clear();
+	}
+	while(c != EOF);
+
+	fclose(f);
+
+	if(vLines.empty())
+	{
+		printer::inst()->print_msg(L0, "%s has nothing to replay.", opt.sFile);
+		return false;
+	}
+	return true;
+}
+
+// The line goes to the pool like one from its socket, its jobs to the executor like in ex_main
+bool replay::feed(line& l)
+{
+	uint64_t iStart = tsc_clock::now();
+
+	// Results for the job we are replacing have to reach on_result before the pool moves the job
+	// generation on, or the ones found in time would count as stale
+	drain_events();
+
+	// The pool works on the line in place, keep the recording as it was. The last char is where the
+	// newline would be.
+	std::vector<char> vBuf(l.sJson.begin(), l.sJson.end());
+	vBuf.push_back('\n');
+
+	std::string sError;
+	iMessages++;
+	if(!pool->replay_line(vBuf.data(), vBuf.size(), sError))
+	{
+		printer::inst()->print_msg(L1, "Bad line at %llu ms: %s", int_port(l.iOffsetMs), sError.c_str());
+		iBadLines++;
+		return true;
+	}
+
+	// Submit replies and the like don't bring a job
+	if(drain_events() == 0)
+		return true;
+
+	// The first switch_work also waits for the threads to start
+	if(iJobsFed > 1)
+		oFeedUs.add((uint32_t)((tsc_clock::now() - iStart) * 1000 / tsc_clock::ticks_per_ms()));
+	return wait_switch(iStart);
+}
+
+// Every thread has to pick the job up before we feed the next one
+bool replay::wait_switch(uint64_t iStartTicks)
+{
+	size_t iThreads = pvThreads->size();
+	uint64_t iDeadline = tsc_clock::now_ms() + iSwitchTimeoutMs;
+
+	for(size_t i = 0; i < iThreads; i++)
+	{
+		uint64_t iJobNo, iTicks;
+		while(pvThreads->at(i)->get_job_switch(iJobNo, iTicks), iJobNo < iJobsFed)
+		{
+			drain_events();
+			if(tsc_clock::now_ms() > iDeadline)
+			{
+				printer::inst()->print_msg(L0, "Thread %u didn't pick up job %llu within %u s.",
+					(unsigned)i, int_port(iJobsFed), (unsigned)(iSwitchTimeoutMs / 1000));
+				return false;
+			}
+			std::this_thread::yield();
+		}
+
+		uint64_t iTime;
+		pvThreads->at(i)->get_stats(vJobStartCnt[i], iTime);
+
+		// The threads leave the initial stall on a 100 ms poll, that isn't a job switch
+		if(iJobsFed > 1)
+		{
+			uint64_t iLate = iTicks > iStartTicks ? iTicks - iStartTicks : 0;
+			vLateTicks[i] += iLate;
+			oSwitchUs.add((uint32_t)(iLate * 1000 / tsc_clock::ticks_per_ms()));
+		}
+	}
+
+	return true;
+}
+
+// Until every thread has done its fixed amount of hashes on the current job
+bool replay::wait_fast()
+{
+	size_t iThreads = pvThreads->size();
+	for(size_t i = 0; i < iThreads; i++)
+	{
+		while(true)
+		{
+			uint64_t iCount, iTime;
+			pvThreads->at(i)->get_stats(iCount, iTime);
+			if(iCount - vJobStartCnt[i] >= opt.iFastHashes)
+				break;
+
+			drain_events();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	return true;
+}
+
+// Results go to on_result, jobs from the pool to the executor, the rest is of no interest here
+size_t replay::drain_events()
+{
+	size_t iJobs = 0;
+	ex_event ev;
+	while(executor::inst()->try_pop_event(ev))
+	{
+		switch(ev.iName)
+		{
+		case EV_MINER_HAVE_RESULT:
+			on_result(ev.oJobResult);
+			break;
+
+		case EV_POOL_HAVE_JOB:
+			executor::inst()->replay_job(ev);
+			// The executor may have swapped it for a copy with the nonce cleared, that is what the threads got
+			mJobs[ev.oPoolJob->sJobID] = ev.oPoolJob;
+			iJobsFed++;
+			iJobs++;
+			break;
+
+		default:
+			break;
+		}
+	}
+	return iJobs;
+}
+
+// What the pool would say about it
+void replay::on_result(job_result& oResult)
+{
+	auto it = mJobs.find(oResult.sJobID);
+	if(it == mJobs.end())
+	{
+		iInvalid++;
+		return;
+	}
+
+	const pool_job& job = *it->second;
+	uint8_t bBlob[sizeof(pool_job::bWorkBlob)];
+	uint8_t bHash[32];
+	memcpy(bBlob, job.bWorkBlob, job.iWorkLen);
+	memcpy(bBlob + 39, &oResult.iNonce, sizeof(oResult.iNonce));
+
+	if(jconf::inst()->HaveHardwareAes())
+		cryptonight_hash_ctx(bBlob, job.iWorkLen, bHash, ctx);
+	else
+		cryptonight_hash_ctx_soft(bBlob, job.iWorkLen, bHash, ctx);
+
+	uint64_t iHashVal;
+	memcpy(&iHashVal, bHash + 24, sizeof(iHashVal));
+	uint64_t iTarget = executor::get_local_target(job.iTarget);
+	if(memcmp(bHash, oResult.bResult, sizeof(bHash)) != 0 || iHashVal >= iTarget)
+	{
+		iInvalid++;
+		return;
+	}
+
+	if(oResult.iJobGen < pool->get_job_gen())
+	{
+		iStale++;
+		return;
+	}
+
+	iAccepted++;
+	iCreditedHashes += jpsock::t64_to_diff(iTarget);
+
+	// Nonces count up from the thread's start nonce, see minethd::calc_start_nonce / calc_nicehash_nonce.
+	// Those low bits tell how far into the job the thread was.
+	if(opt.iFastHashes != 0)
+	{
+		uint32_t iJobNonce;
+		memcpy(&iJobNonce, job.bWorkBlob + 39, sizeof(iJobNonce));
+		uint32_t iOffset = bNiceHash ? (oResult.iNonce - iJobNonce) & 0x3FFFF : oResult.iNonce & 0x3FFFFF;
+		if(iOffset <= opt.iFastHashes)
+			iFixedWork++;
+	}
+}
+
+void replay::print_report(double fSeconds, uint64_t iHashes, double fLostHashes)
+{
+	char buffer[128];
+	printer::inst()->print_str("-----------------------------------------------------\n");
+	printer::inst()->print_str("JOB REPLAY\n");
+	snprintf(buffer, sizeof(buffer), "Messages          : %llu (%llu jobs, %llu bad)\n",
+		int_port(iMessages), int_port(iJobsFed), int_port(iBadLines));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Run time          : %.1f s\n", fSeconds);
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Hashes computed   : %llu\n", int_port(iHashes));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Shares accepted   : %llu (%llu stale, %llu invalid, %llu rate limited)\n",
+		int_port(iAccepted), int_port(iStale), int_port(iInvalid), int_port(minethd::get_rate_limited()));
+	printer::inst()->print_str(buffer);
+	if(opt.iFastHashes != 0)
+	{
+		snprintf(buffer, sizeof(buffer), "Fixed work shares : %llu (first %u nonces of each thread and job)\n",
+			int_port(iFixedWork), (unsigned)opt.iFastHashes);
+		printer::inst()->print_str(buffer);
+	}
+	snprintf(buffer, sizeof(buffer), "Hashes credited   : %llu\n", int_port(iCreditedHashes));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Job feed (us)     : p50 %u, p99 %u, max %u\n",
+		oFeedUs.percentile(50), oFeedUs.percentile(99), oFeedUs.max());
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Job switch (us)   : p50 %u, p99 %u, max %u over %llu thread switches\n",
+		oSwitchUs.percentile(50), oSwitchUs.percentile(99), oSwitchUs.max(), int_port(oSwitchUs.count()));
+	printer::inst()->print_str(buffer);
+	snprintf(buffer, sizeof(buffer), "Lost work         : %.0f hashes on jobs we had replaced (%.3f%%)\n",
+		fLostHashes, iHashes != 0 ? fLostHashes * 100.0 / iHashes : 0.0);
+	printer::inst()->print_str(buffer);
+	printer::inst()->print_str("-----------------------------------------------------\n");
+
+}
+
+bool replay::run(const options& opt)
+{
+	uint64_t iFixedWork;
+	if(!play(opt, iFixedWork))
+		return false;
+
+	if(!opt.bCheck)
+		return true;
+
+	uint64_t iAgain;
+	printer::inst()->print_msg(L0, "Playing %s again, the fixed work shares have to come out the same.", opt.sFile);
+	if(!play(opt, iAgain))
+		return false;
+
+	if(iAgain != iFixedWork)
+	{
+		printer::inst()->print_msg(L0, "Replay check failed - %llu fixed work shares the first time, %llu the second.",
+			int_port(iFixedWork), int_port(iAgain));
+		return false;
+	}
+
+	printer::inst()->print_msg(L0, "Replay check passed, both runs found %llu fixed work shares.", int_port(iFixedWork));
+	return true;
+}
+
+bool replay::play(const options& opt, uint64_t& iFixedWork)
+{
+	replay r(opt);
+	if(!r.load())
+		return false;
+
+	alloc_msg msg = { 0 };
+	r.ctx = cryptonight_alloc_ctx(0, 0, &msg);
+	if(r.ctx == nullptr)
+	{
+		printer::inst()->print_msg(L0, "MEMORY ALLOC FAILED: %s", msg.warning);
+		return false;
+	}
+
+	printer::inst()->print_msg(L0, "Replaying %u messages from %s, %s.", (unsigned)r.vLines.size(), opt.sFile,
+		opt.iFastHashes != 0 ? "each job for a fixed number of hashes" : "on the recorded clock");
+
+	executor::inst()->replay_start(r.pool);
+
+	minethd::miner_work oWork;
+	r.pvThreads = minethd::thread_starter(oWork);
+	size_t iThreads = r.pvThreads->size();
+	r.vJobStartCnt.assign(iThreads, 0);
+	r.vLateTicks.assign(iThreads, 0);
+
+	std::vector<uint64_t> vStartCnt(iThreads, 0);
+	bool bStarted = false;
+	bool bOk = true;
+	uint64_t iStartMs = tsc_clock::now_ms();
+	uint64_t iCalibrateMs = iStartMs;
+
+	for(line& l : r.vLines)
+	{
+		if(opt.iFastHashes != 0)
+		{
+			if(r.iJobsFed > 0)
+				r.wait_fast();
+		}
+		else
+		{
+			uint64_t iDue = iStartMs + (uint64_t)(l.iOffsetMs / opt.fSpeed);
+			while(tsc_clock::now_ms() < iDue)
+			{
+				r.drain_events();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		if(tsc_clock::now_ms() - iCalibrateMs >= 1000)
+		{
+			tsc_clock::calibrate();
+			iCalibrateMs = tsc_clock::now_ms();
+		}
+
+		if(!r.feed(l))
+		{
+			bOk = false;
+			break;
+		}
+
+		// Hashes count from the first job, the threads did nothing before it
+		if(!bStarted && r.iJobsFed > 0)
+		{
+			bStarted = true;
+			vStartCnt = r.vJobStartCnt;
+			iStartMs = tsc_clock::now_ms() - (uint64_t)(l.iOffsetMs / opt.fSpeed);
+		}
+	}
+
+	// The last line is where the recording ends, the job it left the threads on gets its share of time too
+	if(bOk && opt.iFastHashes != 0 && r.iJobsFed > 0)
+		r.wait_fast();
+
+	tsc_clock::calibrate();
+	uint64_t iEndMs = tsc_clock::now_ms();
+	std::vector<uint64_t> vEndCnt(iThreads, 0);
+	for(size_t i = 0; i < iThreads; i++)
+	{
+		uint64_t iTime;
+		r.pvThreads->at(i)->get_stats(vEndCnt[i], iTime);
+	}
+
+	minethd::stop_threads(r.pvThreads);
+	r.drain_events();
+
+	double fSeconds = (iEndMs - iStartMs) / 1000.0;
+	uint64_t iHashes = 0;
+	double fLostHashes = 0.0;
+	for(size_t i = 0; i < iThreads; i++)
+	{
+		uint64_t iThdHashes = vEndCnt[i] - vStartCnt[i];
+		iHashes += iThdHashes;
+		if(fSeconds > 0.0)
+			fLostHashes += r.vLateTicks[i] / tsc_clock::ticks_per_ms() / 1000.0 * iThdHashes / fSeconds;
+	}
+
+	r.print_report((iEndMs - iStartMs) / 1000.0, iHashes, fLostHashes);
+	iFixedWork = r.iFixedWork;
+	return bOk && r.iInvalid == 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "msgstruct.h"
+#include "crypto/cryptonight.h"
+#include "histogram.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+class jpsock;
+class minethd;
+
+/*
+	Job replay - plays a recorded stream of pool messages through a jpsock and the executor's job
+	handling, the same code a live pool connection goes through, and checks every result the threads
+	find against the job it came from. No sockets, no pool and no executor thread, so a run only
+	depends on the recording.
+
+	A recording is a text file with one message per line, "<ms since the start> <JSON line>". Empty
+	lines and lines starting with # are skipped. Only jobs (method "job", or the job in a login reply)
+	go to the threads, other lines are parsed and counted.
+
+	By default every message is fed when it is due (--speed scales the clock). With --fast N the clock
+	is ignored - the next message goes out once every thread has done N hashes on the current job. That
+	fixes the work done on each job, and the shares found in those first N nonces of each thread are the
+	same on any build that computes the same hashes. --check plays the recording twice and fails if the
+	two runs didn't find the same number of them.
+*/
+class replay
+{
+public:
+	struct options
+	{
+		const char* sFile = nullptr;
+		double fSpeed = 1.0;
+		uint32_t iFastHashes = 0; // zero - follow the clock
+		bool bCheck = false; // needs iFastHashes
+	};
+
+	// What follows "replay config.txt" on the command line
+	static bool parse_args(int argc, char* argv[], options& opt);
+	static const char* usage();
+
+	// false if the recording couldn't be read or the threads didn't follow
+	static bool run(const options& opt);
+
+private:
+	struct line
+	{
+		uint64_t iOffsetMs;
+		std::string sJson;
+	};
+
+	replay(const options& opt);
+	~replay();
+
+	static bool play(const options& opt, uint64_t& iFixedWork);
+
+	bool load();
+	bool feed(line& l);
+	bool wait_switch(uint64_t iStartTicks);
+	bool wait_fast();
+	size_t drain_events();
+	void on_result(job_result& oResult);
+	void print_report(double fSeconds, uint64_t iHashes, double fLostHashes);
+
+	const options& opt;
+	std::vector<line> vLines;
+	std::vector<minethd*>* pvThreads;
+	jpsock* pool;
+	cryptonight_ctx* ctx;
+
+	// Every job we fed, by id, to check the results against
+	std::map<std::string, job_ref> mJobs;
+	uint64_t iJobsFed;
+	bool bNiceHash;
+
+	// Hash count of each thread when it picked up the current job
+	std::vector<uint64_t> vJobStartCnt;
+	// Ticks each thread spent on a job after we had a newer one
+	std::vector<uint64_t> vLateTicks;
+	histogram oSwitchUs;
+	histogram oFeedUs;
+
+	uint64_t iMessages;
+	uint64_t iBadLines;
+	uint64_t iAccepted;
+	uint64_t iStale;
+	uint64_t iInvalid;
+	uint64_t iFixedWork;
+	uint64_t iCreditedHashes;
+};
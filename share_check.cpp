@@ -0,0 +1,86 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "share_check.h"
+#include "reactor.h"
+#include "jconf.h"
+#include "console.h"
+
+share_check* share_check::oInst = nullptr;
+
+bool share_check::start()
+{
+	if(ctx != nullptr)
+		return true;
+
+	alloc_msg msg = { 0 };
+	ctx = cryptonight_alloc_ctx(0, 0, &msg);
+	if(ctx == nullptr)
+	{
+		printer::inst()->print_msg(L0, "MEMORY ALLOC FAILED: %s", msg.warning);
+		return false;
+	}
+	bHaveAes = jconf::inst()->HaveHardwareAes();
+
+	std::thread(&share_check::check_main, this).detach();
+	return true;
+}
+
+void share_check::push(share&& oShare)
+{
+	oQueue.push(std::move(oShare));
+}
+
+void share_check::check_main()
+{
+	while(true)
+	{
+		share oShare = oQueue.pop();
+
+		uint8_t bHash[32];
+		memcpy(oShare.bBlob + 39, &oShare.iNonce, sizeof(oShare.iNonce));
+
+		auto start = std::chrono::steady_clock::now();
+		if(bHaveAes)
+			cryptonight_hash_ctx(oShare.bBlob, oShare.iBlobLen, bHash, ctx);
+		else
+			cryptonight_hash_ctx_soft(oShare.bBlob, oShare.iBlobLen, bHash, ctx);
+		uint32_t iVerifyUs = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+		verdict v = share_ok;
+		uint64_t iHashVal;
+		memcpy(&iHashVal, bHash + 24, sizeof(iHashVal));
+		if(memcmp(bHash, oShare.bResult, sizeof(bHash)) != 0)
+			v = share_bad_hash;
+		else if(iHashVal >= oShare.iTarget)
+			v = share_low_diff;
+
+		done_fn fnDone = std::move(oShare.fnDone);
+		reactor::inst()->add_timer(0, [fnDone, v, iVerifyUs]() { fnDone(v, iVerifyUs); });
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+
+#include "thdq.hpp"
+#include "crypto/cryptonight.h"
+
+/*
+	share_check - hashes shares that came in over the network on a thread of its own, so the reactor
+	never waits for cryptonight. Shares are checked in the order they were queued, the verdict goes
+	back to the reactor thread as a zero delay timer.
+*/
+class share_check
+{
+public:
+	static share_check* inst()
+	{
+		if (oInst == nullptr) oInst = new share_check;
+		return oInst;
+	};
+
+	enum verdict { share_ok, share_bad_hash, share_low_diff };
+
+	// Runs on the reactor thread, iVerifyUs is how long the hash took
+	typedef std::function<void(verdict v, uint32_t iVerifyUs)> done_fn;
+
+	struct share
+	{
+		uint8_t bBlob[112];
+		uint32_t iBlobLen;
+		uint32_t iNonce; // Goes to byte 39 of the blob
+		uint8_t bResult[32]; // What the miner says it got
+		uint64_t iTarget;
+		done_fn fnDone;
+	};
+
+	// Needs jconf for the AES check
+	bool start();
+	void push(share&& oShare);
+
+private:
+	share_check() : ctx(nullptr), bHaveAes(false) {}
+	static share_check* oInst;
+
+	void check_main();
+
+	thdq<share> oQueue;
+	cryptonight_ctx* ctx;
+	bool bHaveAes;
+};
@@ -26,6 +26,11 @@
 #include "jconf.h"
 #include "console.h"
 #include "executor.h"
+#include "reactor.h"
+
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #ifndef CONF_NO_TLS
 #include <openssl/ssl.h>
@@ -37,20 +42,151 @@
 #endif
 #endif
 
+/*
+ * Resolved pool addresses. getaddrinfo doesn't tell us the TTL of the records, so entries are good
+ * for dns_cache_time seconds. After that we still connect to the old addresses while a background
+ * thread resolves the name again - only a name we have never seen makes the caller wait.
+ */
+struct dns_entry
+{
+	std::vector<sock_addr> vAddrs;
+	uint64_t iExpire;
+	bool bRefreshing;
+};
+
+static std::mutex dns_mutex;
+static std::unordered_map<std::string, dns_entry> dns_cache;
+
+// Addresses come out with the families taking turns, the preferred one first (RFC 8305 section 4)
+static bool dns_resolve(const std::string& sHost, const std::string& sPort, std::vector<sock_addr>& vAddrs, int& err)
+{
+	addrinfo hints = { 0 };
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	addrinfo *pAddrRoot = nullptr;
+	if ((err = getaddrinfo(sHost.c_str(), sPort.c_str(), &hints, &pAddrRoot)) != 0)
+		return false;
+
+	std::vector<sock_addr> vIpv4, vIpv6;
+	for (addrinfo *ptr = pAddrRoot; ptr != nullptr; ptr = ptr->ai_next)
+	{
+		if (ptr->ai_family != AF_INET && ptr->ai_family != AF_INET6)
+			continue;
+
+		sock_addr a;
+		memset(&a, 0, sizeof(a));
+		memcpy(&a.addr, ptr->ai_addr, ptr->ai_addrlen);
+		a.len = (socklen_t)ptr->ai_addrlen;
+
+		if (ptr->ai_family == AF_INET)
+			vIpv4.push_back(a);
+		else
+			vIpv6.push_back(a);
+	}
+
+	freeaddrinfo(pAddrRoot);
+
+	std::vector<sock_addr>& vFirst = jconf::inst()->PreferIpv4() ? vIpv4 : vIpv6;
+	std::vector<sock_addr>& vSecond = jconf::inst()->PreferIpv4() ? vIpv6 : vIpv4;
+
+	vAddrs.clear();
+	for (size_t i = 0; i < vFirst.size() || i < vSecond.size(); i++)
+	{
+		if (i < vFirst.size())
+			vAddrs.push_back(vFirst[i]);
+		if (i < vSecond.size())
+			vAddrs.push_back(vSecond[i]);
+	}
+
+	return !vAddrs.empty();
+}
+
+static void dns_refresh(std::string sHost, std::string sPort)
+{
+	std::vector<sock_addr> vAddrs;
+	int err;
+	bool bOk = dns_resolve(sHost, sPort, vAddrs, err);
+
+	std::unique_lock<std::mutex> lck(dns_mutex);
+	dns_entry& e = dns_cache[sHost + ":" + sPort];
+	e.bRefreshing = false;
+
+	// If the resolver is having a bad day we keep the addresses that we have, and try again next time
+	if (bOk)
+	{
+		e.vAddrs = std::move(vAddrs);
+		e.iExpire = reactor::get_ms_time() + jconf::inst()->GetDnsCacheTime() * 1000;
+	}
+}
+
+static bool dns_lookup(const std::string& sHost, const std::string& sPort, std::vector<sock_addr>& vAddrs, int& err)
+{
+	uint64_t iCacheTime = jconf::inst()->GetDnsCacheTime() * 1000;
+	std::string sKey = sHost + ":" + sPort;
+
+	if (iCacheTime != 0)
+	{
+		std::unique_lock<std::mutex> lck(dns_mutex);
+		auto it = dns_cache.find(sKey);
+		if (it != dns_cache.end() && !it->second.vAddrs.empty())
+		{
+			vAddrs = it->second.vAddrs;
+			if (reactor::get_ms_time() >= it->second.iExpire && !it->second.bRefreshing)
+			{
+				it->second.bRefreshing = true;
+				std::thread(dns_refresh, sHost, sPort).detach();
+			}
+			return true;
+		}
+	}
+
+	if (!dns_resolve(sHost, sPort, vAddrs, err))
+		return false;
+
+	if (iCacheTime != 0)
+	{
+		std::unique_lock<std::mutex> lck(dns_mutex);
+		dns_entry& e = dns_cache[sKey];
+		e.vAddrs = vAddrs;
+		e.iExpire = reactor::get_ms_time() + iCacheTime;
+	}
+
+	return true;
+}
+
+// None of the addresses answered, maybe the pool moved. Make the next lookup refresh the name.
+static void dns_expire(const std::string& sKey)
+{
+	std::unique_lock<std::mutex> lck(dns_mutex);
+	auto it = dns_cache.find(sKey);
+	if (it != dns_cache.end())
+		it->second.iExpire = 0;
+}
+
 plain_socket::plain_socket(jpsock* err_callback) : pCallback(err_callback)
 {
 	hSocket = INVALID_SOCKET;
-	pSockAddr = nullptr;
+	iAttemptTimer = reactor::invalid_timer;
 }
 
-bool plain_socket::set_hostname(const char* sAddr)
+plain_socket::~plain_socket()
+{
+	plain_socket::close();
+}
+
+bool resolve_pool_addr(const char* sAddr, pool_addr& out, std::string& sError)
 {
 	char sAddrMb[256];
 	char *sTmp, *sPort;
 
 	size_t ln = strlen(sAddr);
 	if (ln >= sizeof(sAddrMb))
-		return pCallback->set_socket_error("CONNECT error: Pool address overflow.");
+	{
+		sError = "CONNECT error: Pool address overflow.";
+		return false;
+	}
 
 	memcpy(sAddrMb, sAddr, ln);
 	sAddrMb[ln] = '\0';
@@ -59,96 +195,259 @@ bool plain_socket::set_hostname(const char* sAddr)
 		memmove(sAddrMb, sTmp, strlen(sTmp) + 1);
 
 	if ((sPort = strchr(sAddrMb, ':')) == nullptr)
-		return pCallback->set_socket_error("CONNECT error: Pool port number not specified, please use format <hostname>:<port>.");
+	{
+		sError = "CONNECT error: Pool port number not specified, please use format <hostname>:<port>.";
+		return false;
+	}
 
 	sPort[0] = '\0';
 	sPort++;
 
-	addrinfo hints = { 0 };
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
+	out.sHostKey.assign(sAddrMb).append(1, ':').append(sPort);
 
-	pAddrRoot = nullptr;
-	int err;
-	if ((err = getaddrinfo(sAddrMb, sPort, &hints, &pAddrRoot)) != 0)
-		return pCallback->set_socket_error_strerr("CONNECT error: GetAddrInfo: ", err);
+	int err = 0;
+	if (!dns_lookup(sAddrMb, sPort, out.vAddrs, err))
+	{
+		if (err != 0)
+		{
+			char sSockErrText[512];
+			sError = "CONNECT error: GetAddrInfo: ";
+			sError += sock_gai_strerror(err, sSockErrText, sizeof(sSockErrText));
+		}
+		else
+			sError = "CONNECT error: I found some DNS records but no IPv4 or IPv6 addresses.";
+		return false;
+	}
 
-	addrinfo *ptr = pAddrRoot;
-	addrinfo *ipv4 = nullptr, *ipv6 = nullptr;
+	return true;
+}
 
-	while (ptr != nullptr)
+bool plain_socket::set_address(const pool_addr& oAddr)
+{
+	sHostKey = oAddr.sHostKey;
+	vAddrs = oAddr.vAddrs;
+	return true;
+}
+
+bool plain_socket::connect()
+{
+	iNextAddr = 0;
+	iLastError = 0;
+
+	while (iNextAddr < vAddrs.size())
 	{
-		if (ptr->ai_family == AF_INET)
-			ipv4 = ptr;
-		if (ptr->ai_family == AF_INET6)
-			ipv6 = ptr;
-		ptr = ptr->ai_next;
+		if (start_attempt())
+			return true;
 	}
 
-	if (ipv4 == nullptr && ipv6 == nullptr)
+	return attempts_failed();
+}
+
+// Starts connecting to the next address, returns false if that failed straight away
+bool plain_socket::start_attempt()
+{
+	const sock_addr& a = vAddrs[iNextAddr++];
+
+	SOCKET s = socket(a.addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET)
 	{
-		freeaddrinfo(pAddrRoot);
-		pAddrRoot = nullptr;
-		return pCallback->set_socket_error("CONNECT error: I found some DNS records but no IPv4 or IPv6 addresses.");
+		iLastError = sock_get_errno();
+		return false;
 	}
-	else if (ipv4 != nullptr && ipv6 == nullptr)
-		pSockAddr = ipv4;
-	else if (ipv4 == nullptr && ipv6 != nullptr)
-		pSockAddr = ipv6;
-	else if (ipv4 != nullptr && ipv6 != nullptr)
+
+	// These are only tuning, we can live without them
+	sock_set_nodelay(s);
+	if (jconf::inst()->GetTcpKeepaliveTime() != 0)
+		sock_set_keepalive(s, (unsigned int)jconf::inst()->GetTcpKeepaliveTime(), (unsigned int)jconf::inst()->GetTcpKeepaliveInterval());
+
+	if (!sock_set_nonblock(s) || (::connect(s, (const sockaddr*)&a.addr, (int)a.len) != 0 && !sock_would_block()))
 	{
-		if(jconf::inst()->PreferIpv4())
-			pSockAddr = ipv4;
-		else
-			pSockAddr = ipv6;
+		iLastError = sock_get_errno();
+		sock_close(s);
+		return false;
 	}
 
-	hSocket = socket(pSockAddr->ai_family, pSockAddr->ai_socktype, pSockAddr->ai_protocol);
+	// We will be told that we are connected (or not) when the socket becomes writable
+	if (!reactor::inst()->add_socket(s, pCallback, true))
+	{
+		iLastError = sock_get_errno();
+		sock_close(s);
+		return false;
+	}
+
+	vAttempts.push_back(s);
+	iAttemptStart = reactor::get_ms_time();
 
-	if (hSocket == INVALID_SOCKET)
+	// A blackholed address never gives us a socket event, so the timer has to check back
+	reactor::inst()->del_timer(iAttemptTimer);
+	iAttemptTimer = reactor::invalid_timer;
+	if (iNextAddr < vAddrs.size())
 	{
-		freeaddrinfo(pAddrRoot);
-		pAddrRoot = nullptr;
-		return pCallback->set_socket_error_strerr("CONNECT error: Socket creation failed ");
+		jpsock* pHandler = pCallback;
+		iAttemptTimer = reactor::inst()->add_timer(iAttemptDelay, [pHandler]() { pHandler->on_sock_event(0); });
 	}
 
 	return true;
 }
 
-bool plain_socket::connect()
+// 1 - connected, 0 - still waiting, -1 - failed
+int plain_socket::check_attempt(SOCKET s)
 {
-	int ret = ::connect(hSocket, pSockAddr->ai_addr, (int)pSockAddr->ai_addrlen);
+	int err = 0;
+	socklen_t errlen = sizeof(err);
+	if (getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen) != 0)
+	{
+		iLastError = sock_get_errno();
+		return -1;
+	}
 
-	freeaddrinfo(pAddrRoot);
-	pAddrRoot = nullptr;
+	if (err != 0)
+	{
+		iLastError = err;
+		return -1;
+	}
 
-	if (ret != 0)
-		return pCallback->set_socket_error_strerr("CONNECT error: ");
-	else
-		return true;
+	// No error, but no peer either means that we are still connecting
+	sockaddr_storage peer;
+	socklen_t peerlen = sizeof(peer);
+	if (getpeername(s, (sockaddr*)&peer, &peerlen) != 0)
+		return 0;
+
+	return 1;
+}
+
+void plain_socket::close_attempts()
+{
+	for (SOCKET s : vAttempts)
+	{
+		reactor::inst()->del_socket(s);
+		sock_close(s);
+	}
+	vAttempts.clear();
+
+	reactor::inst()->del_timer(iAttemptTimer);
+	iAttemptTimer = reactor::invalid_timer;
+}
+
+bool plain_socket::attempts_failed()
+{
+	dns_expire(sHostKey);
+	sock_set_errno(iLastError);
+	return pCallback->set_socket_error_strerr("CONNECT error: ");
+}
+
+int plain_socket::handshake()
+{
+	SOCKET hWinner = INVALID_SOCKET;
+	for (size_t i = 0; i < vAttempts.size();)
+	{
+		SOCKET s = vAttempts[i];
+		int ret = check_attempt(s);
+
+		if (ret == 0 || (ret == 1 && hWinner != INVALID_SOCKET))
+		{
+			i++;
+			continue;
+		}
+
+		if (ret == 1)
+			hWinner = s;
+		else
+		{
+			reactor::inst()->del_socket(s);
+			sock_close(s);
+		}
+
+		vAttempts.erase(vAttempts.begin() + i);
+	}
+
+	if (hWinner != INVALID_SOCKET)
+	{
+		close_attempts();
+		hSocket = hWinner;
+		reactor::inst()->set_want_write(hSocket, !sSendBuf.empty());
+		return 1;
+	}
+
+	// Next address, if the ones we are on failed or had their head start
+	while (iNextAddr < vAddrs.size() && (vAttempts.empty() || reactor::get_ms_time() - iAttemptStart >= iAttemptDelay))
+		start_attempt();
+
+	if (vAttempts.empty())
+	{
+		attempts_failed();
+		return -1;
+	}
+
+	return 0;
 }
 
 int plain_socket::recv(char* buf, unsigned int len)
 {
 	int ret = ::recv(hSocket, buf, len, 0);
 
+	if(ret > 0)
+		return ret;
+
 	if(ret == 0)
+	{
 		pCallback->set_socket_error("RECEIVE error: socket closed");
-	if(ret == SOCKET_ERROR || ret < 0)
-		pCallback->set_socket_error_strerr("RECEIVE error: ");
+		return -1;
+	}
 
-	return ret;
+	if(sock_would_block())
+		return 0;
+
+	pCallback->set_socket_error_strerr("RECEIVE error: ");
+	return -1;
 }
 
-bool plain_socket::send(const char* buf)
+bool plain_socket::send(const char* buf, size_t slen)
 {
-	int pos = 0, slen = strlen(buf);
+	// Keep the ordering, whatever we couldn't send before needs to go out first
+	if(!sSendBuf.empty())
+	{
+		sSendBuf.append(buf, slen);
+		return true;
+	}
+
+	size_t pos = 0;
 	while (pos != slen)
 	{
 		int ret = ::send(hSocket, buf + pos, slen - pos, 0);
 		if (ret == SOCKET_ERROR)
 		{
+			if(sock_would_block())
+			{
+				sSendBuf.assign(buf + pos, slen - pos);
+				reactor::inst()->set_want_write(hSocket, true);
+				return true;
+			}
+
+			pCallback->set_socket_error_strerr("SEND error: ");
+			return false;
+		}
+		else
+			pos += ret;
+	}
+
+	return true;
+}
+
+bool plain_socket::flush()
+{
+	size_t pos = 0, slen = sSendBuf.size();
+	while (pos != slen)
+	{
+		int ret = ::send(hSocket, sSendBuf.data() + pos, slen - pos, 0);
+		if (ret == SOCKET_ERROR)
+		{
+			if(sock_would_block())
+			{
+				sSendBuf.erase(0, pos);
+				return true;
+			}
+
 			pCallback->set_socket_error_strerr("SEND error: ");
 			return false;
 		}
@@ -156,21 +455,37 @@ bool plain_socket::send(const char* buf)
 			pos += ret;
 	}
 
+	sSendBuf.clear();
+	reactor::inst()->set_want_write(hSocket, false);
 	return true;
 }
 
-void plain_socket::close(bool free)
+void plain_socket::close()
 {
+	close_attempts();
+
 	if(hSocket != INVALID_SOCKET)
 	{
+		reactor::inst()->del_socket(hSocket);
 		sock_close(hSocket);
 		hSocket = INVALID_SOCKET;
 	}
+
+	sSendBuf.clear();
 }
 
 #ifndef CONF_NO_TLS
-tls_socket::tls_socket(jpsock* err_callback) : pCallback(err_callback)
+tls_socket::tls_socket(jpsock* err_callback) : plain_socket(err_callback)
+{
+}
+
+tls_socket::~tls_socket()
 {
+	tls_socket::close();
+	drop_session();
+
+	if(ctx != nullptr)
+		SSL_CTX_free(ctx);
 }
 
 void tls_socket::print_error()
@@ -201,9 +516,42 @@ void tls_socket::init_ctx()
 	{
 		SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1 | SSL_OP_NO_COMPRESSION);
 	}
+
+	// We keep the session ourselves, TLS 1.3 tickets only arrive after the handshake
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, &tls_socket::on_new_session);
+}
+
+int tls_socket::on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+	tls_socket* sck = (tls_socket*)SSL_get_app_data(ssl);
+	if(sck == nullptr)
+		return 0;
+
+	sck->drop_session();
+	sck->sSessionHost = sck->sHostKey;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	// The live session gets marked as not resumable if the connection ends badly, which is exactly
+	// when we want it, so keep a copy
+	sck->pSession = SSL_SESSION_dup(session);
+	return 0;
+#else
+	sck->pSession = session;
+	return 1; // The session is ours now
+#endif
 }
 
-bool tls_socket::set_hostname(const char* sAddr)
+void tls_socket::drop_session()
+{
+	if(pSession != nullptr)
+	{
+		SSL_SESSION_free(pSession);
+		pSession = nullptr;
+	}
+}
+
+bool tls_socket::set_address(const pool_addr& oAddr)
 {
 	if(ctx == nullptr)
 	{
@@ -215,20 +563,10 @@ bool tls_socket::set_hostname(const char* sAddr)
 		}
 	}
 
-	if((bio = BIO_new_ssl_connect(ctx)) == nullptr)
-	{
-		print_error();
+	if(!plain_socket::set_address(oAddr))
 		return false;
-	}
 
-	if(BIO_set_conn_hostname(bio, sAddr) != 1)
-	{
-		print_error();
-		return false;
-	}
-
-	BIO_get_ssl(bio, &ssl);
-	if(ssl == nullptr)
+	if((ssl = SSL_new(ctx)) == nullptr)
 	{
 		print_error();
 		return false;
@@ -243,23 +581,73 @@ bool tls_socket::set_hostname(const char* sAddr)
 		}
 	}
 
+	SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_set_app_data(ssl, this);
+
+	if(pSession != nullptr && sSessionHost == sHostKey)
+		SSL_set_session(ssl, pSession);
+
 	return true;
 }
 
 bool tls_socket::connect()
 {
-	if(BIO_do_connect(bio) != 1)
+	bTcpUp = false;
+	iRetryLen = 0;
+	return plain_socket::connect();
+}
+
+int tls_socket::handshake()
+{
+	if(!bTcpUp)
 	{
-		print_error();
-		return false;
+		int ret = plain_socket::handshake();
+		if(ret != 1)
+			return ret;
+		bTcpUp = true;
+
+		// We only know which of the sockets to use now
+		if(SSL_set_fd(ssl, (int)hSocket) != 1)
+		{
+			print_error();
+			return -1;
+		}
 	}
 
-	if(BIO_do_handshake(bio) != 1)
+	ERR_clear_error();
+	int ret = SSL_connect(ssl);
+	if(ret != 1)
 	{
-		print_error();
-		return false;
+		switch(SSL_get_error(ssl, ret))
+		{
+		case SSL_ERROR_WANT_READ:
+			reactor::inst()->set_want_write(hSocket, false);
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			reactor::inst()->set_want_write(hSocket, true);
+			return 0;
+		default:
+			drop_session();
+			print_error();
+			return -1;
+		}
 	}
 
+	if(!check_fingerprint())
+	{
+		drop_session();
+		return -1;
+	}
+
+	if(SSL_session_reused(ssl))
+		printer::inst()->print_msg(L3, "TLS session resumed.");
+
+	reactor::inst()->set_want_write(hSocket, !sSendBuf.empty());
+	return 1;
+}
+
+bool tls_socket::check_fingerprint()
+{
 	/* Step 1: verify a server certificate was presented during the negotiation */
 	X509* cert = SSL_get_peer_certificate(ssl);
 	if(cert == nullptr)
@@ -275,6 +663,7 @@ bool tls_socket::connect()
 	digest = EVP_get_digestbyname("sha256");
 	if(digest == nullptr)
 	{
+		X509_free(cert);
 		print_error();
 		return false;
 	}
@@ -327,36 +716,115 @@ bool tls_socket::connect()
 
 int tls_socket::recv(char* buf, unsigned int len)
 {
-	int ret = BIO_read(bio, buf, len);
+	ERR_clear_error();
+	int ret = SSL_read(ssl, buf, len);
 
-	if(ret == 0)
+	if(ret > 0)
+		return ret;
+
+	switch(SSL_get_error(ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		return 0;
+	case SSL_ERROR_WANT_WRITE:
+		reactor::inst()->set_want_write(hSocket, true);
+		return 0;
+	case SSL_ERROR_ZERO_RETURN:
 		pCallback->set_socket_error("RECEIVE error: socket closed");
-	if(ret < 0)
+		return -1;
+	case SSL_ERROR_SYSCALL:
+		if(ERR_peek_error() == 0)
+		{
+			if(ret == 0)
+				pCallback->set_socket_error("RECEIVE error: socket closed");
+			else
+				pCallback->set_socket_error_strerr("RECEIVE error: ");
+			return -1;
+		}
 		print_error();
-
-	return ret;
+		return -1;
+	default:
+		print_error();
+		return -1;
+	}
 }
 
-bool tls_socket::send(const char* buf)
+// Returns the number of bytes written, 0 if we need to retry later and -1 on error
+int tls_socket::ssl_write(const char* buf, size_t len)
 {
-	return BIO_puts(bio, buf) > 0;
+	ERR_clear_error();
+	int ret = SSL_write(ssl, buf, (int)len);
+
+	if(ret > 0)
+		return ret;
+
+	switch(SSL_get_error(ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		return 0;
+	case SSL_ERROR_WANT_WRITE:
+		reactor::inst()->set_want_write(hSocket, true);
+		return 0;
+	default:
+		print_error();
+		return -1;
+	}
 }
 
-void tls_socket::close(bool free)
+bool tls_socket::send(const char* buf, size_t slen)
 {
-	if(bio == nullptr || ssl == nullptr)
-		return;
+	if(!sSendBuf.empty())
+	{
+		sSendBuf.append(buf, slen);
+		return true;
+	}
+
+	int ret = ssl_write(buf, slen);
+	if(ret < 0)
+		return false;
+
+	if(ret == 0)
+	{
+		sSendBuf.assign(buf, slen);
+		iRetryLen = slen;
+	}
+
+	return true;
+}
 
-	if(!free)
+bool tls_socket::flush()
+{
+	while(!sSendBuf.empty())
 	{
-		sock_close(BIO_get_fd(bio, nullptr));
+		if(iRetryLen == 0)
+			iRetryLen = sSendBuf.size();
+
+		int ret = ssl_write(sSendBuf.data(), iRetryLen);
+		if(ret < 0)
+			return false;
+		if(ret == 0)
+			return true;
+
+		sSendBuf.erase(0, iRetryLen);
+		iRetryLen = 0;
 	}
-	else
+
+	reactor::inst()->set_want_write(hSocket, false);
+	return true;
+}
+
+void tls_socket::close()
+{
+	if(ssl != nullptr)
 	{
-		BIO_free_all(bio);
+		// OpenSSL forgets sessions that weren't shut down cleanly, but a dropped pool
+		// connection says nothing about the session
+		SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+		SSL_free(ssl);
 		ssl = nullptr;
-		bio = nullptr;
 	}
+
+	plain_socket::close();
+	iRetryLen = 0;
 }
 #endif
-
@@ -1,57 +1,120 @@
 #pragma once
+#include <string>
+#include <vector>
 #include "socks.h"
 class jpsock;
 
+struct sock_addr
+{
+	sockaddr_storage addr;
+	socklen_t len;
+};
+
+// A pool address with everything its name resolved to
+struct pool_addr
+{
+	std::string sHostKey; // host:port, the DNS cache and TLS session key
+	std::vector<sock_addr> vAddrs;
+};
+
+// Goes through the DNS cache, but a name we haven't seen yet waits for the resolver, so don't
+// hold any locks. False with the reason in sError if we got no addresses.
+bool resolve_pool_addr(const char* sAddr, pool_addr& out, std::string& sError);
+
+/*
+ * All sockets are non-blocking and serviced by the reactor thread. connect() only starts
+ * the connection, after that the owner calls handshake() on each socket event until it stops
+ * returning 0 (1 - we are up, -1 - error). Handshake can also be called with nothing to do.
+ * recv() returns 0 when there is no more data for now, and -1 on errors. send() queues
+ * whatever the kernel won't take right now, flush() writes it out once the socket is
+ * writable again.
+ */
 class base_socket
 {
 public:
-	virtual bool set_hostname(const char* sAddr) = 0;
+	virtual ~base_socket() {}
+	virtual bool set_address(const pool_addr& oAddr) = 0;
 	virtual bool connect() = 0;
+	virtual int handshake() = 0;
 	virtual int recv(char* buf, unsigned int len) = 0;
-	virtual bool send(const char* buf) = 0;
-	virtual void close(bool free) = 0;
+	virtual bool send(const char* buf, size_t len) = 0;
+	virtual bool flush() = 0;
+	virtual void close() = 0;
 };
 
 class plain_socket : public base_socket
 {
 public:
 	plain_socket(jpsock* err_callback);
+	~plain_socket();
 
-	bool set_hostname(const char* sAddr);
+	bool set_address(const pool_addr& oAddr);
 	bool connect();
+	int handshake();
 	int recv(char* buf, unsigned int len);
-	bool send(const char* buf);
-	void close(bool free);
+	bool send(const char* buf, size_t len);
+	bool flush();
+	void close();
 
-private:
+protected:
 	jpsock* pCallback;
-	addrinfo *pSockAddr;
-	addrinfo *pAddrRoot;
 	SOCKET hSocket;
+
+	/* Connections race as in RFC 8305 (happy eyeballs). Every address the pool name resolves to,
+	 * with the address families taking turns, gets iAttemptDelay ms to connect before we start on the
+	 * next one too. The first socket that connects is kept. */
+	constexpr static size_t iAttemptDelay = 250;
+
+	bool start_attempt();
+	int check_attempt(SOCKET s);
+	void close_attempts();
+	bool attempts_failed();
+
+	std::string sHostKey;
+	std::vector<sock_addr> vAddrs;
+	size_t iNextAddr = 0;
+	std::vector<SOCKET> vAttempts;
+	uint64_t iAttemptStart = 0;
+	size_t iAttemptTimer = 0;
+	int iLastError = 0;
+
+	std::string sSendBuf;
 };
 
 typedef struct ssl_ctx_st SSL_CTX;
-typedef struct bio_st BIO;
 typedef struct ssl_st SSL;
+typedef struct ssl_session_st SSL_SESSION;
 
-class tls_socket : public base_socket
+class tls_socket : public plain_socket
 {
 public:
 	tls_socket(jpsock* err_callback);
+	~tls_socket();
 
-	bool set_hostname(const char* sAddr);
+	bool set_address(const pool_addr& oAddr);
 	bool connect();
+	int handshake();
 	int recv(char* buf, unsigned int len);
-	bool send(const char* buf);
-	void close(bool free);
+	bool send(const char* buf, size_t len);
+	bool flush();
+	void close();
 
 private:
 	void init_ctx();
 	void print_error();
+	bool check_fingerprint();
+	int ssl_write(const char* buf, size_t len);
 
-	jpsock* pCallback;
+	// The last session (or ticket) the pool gave us, we offer it again on reconnect to skip the full handshake
+	static int on_new_session(SSL* ssl, SSL_SESSION* session);
+	void drop_session();
 
 	SSL_CTX* ctx = nullptr;
-	BIO* bio = nullptr;
 	SSL* ssl = nullptr;
+	SSL_SESSION* pSession = nullptr;
+	std::string sSessionHost;
+
+	bool bTcpUp = false;
+	// OpenSSL wants a failed write retried with the same length
+	size_t iRetryLen = 0;
 };
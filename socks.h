@@ -1,10 +1,12 @@
 #pragma once
+#include <stdint.h>
 #ifdef _WIN32
 #ifndef _WIN32_WINNT
 #define _WIN32_WINNT 0x0601  /* Windows 7 */
 #endif
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
 #include <windows.h>
 
 inline void sock_init()
@@ -25,6 +27,47 @@ inline void sock_close(SOCKET s)
 	closesocket(s);
 }
 
+inline bool sock_set_nonblock(SOCKET s)
+{
+	u_long mode = 1;
+	return ioctlsocket(s, FIONBIO, &mode) == 0;
+}
+
+// True if the last call failed only because it would have blocked (or the connect is still in progress)
+inline bool sock_would_block()
+{
+	int err = WSAGetLastError();
+	return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+inline void sock_set_errno(int err)
+{
+	WSASetLastError(err);
+}
+
+inline int sock_get_errno()
+{
+	return WSAGetLastError();
+}
+
+inline bool sock_set_nodelay(SOCKET s)
+{
+	BOOL on = TRUE;
+	return setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on)) == 0;
+}
+
+// Windows has no probe count setting, it gives up after 10 probes
+inline bool sock_set_keepalive(SOCKET s, unsigned int iIdle, unsigned int iInterval)
+{
+	tcp_keepalive ka;
+	ka.onoff = 1;
+	ka.keepalivetime = iIdle * 1000;
+	ka.keepaliveinterval = iInterval * 1000;
+
+	DWORD ret;
+	return WSAIoctl(s, SIO_KEEPALIVE_VALS, &ka, sizeof(ka), NULL, 0, &ret, NULL, NULL) == 0;
+}
+
 inline const char* sock_strerror(char* buf, size_t len)
 {
 	buf[0] = '\0';
@@ -55,9 +98,12 @@ inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 
 /* Assume that any non-Windows platform uses POSIX-style sockets instead. */
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>  /* Needed for getaddrinfo() and freeaddrinfo() */
 #include <unistd.h> /* Needed for close() */
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 
@@ -73,6 +119,61 @@ inline void sock_close(SOCKET s)
 	close(s);
 }
 
+inline bool sock_set_nonblock(SOCKET s)
+{
+	int flags = fcntl(s, F_GETFL, 0);
+	return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// True if the last call failed only because it would have blocked (or the connect is still in progress)
+inline bool sock_would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+inline void sock_set_errno(int err)
+{
+	errno = err;
+}
+
+inline int sock_get_errno()
+{
+	return errno;
+}
+
+inline bool sock_set_nodelay(SOCKET s)
+{
+	int on = 1;
+	return setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == 0;
+}
+
+// The connection is dropped after 3 unanswered probes
+inline bool sock_set_keepalive(SOCKET s, unsigned int iIdle, unsigned int iInterval)
+{
+	int on = 1, idle = iIdle, intvl = iInterval, cnt = 3;
+	if(setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) != 0)
+		return false;
+
+#if defined(__APPLE__)
+	setsockopt(s, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle));
+#elif defined(TCP_KEEPIDLE)
+	setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+#endif
+#if defined(TCP_KEEPINTVL)
+	setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+#endif
+#if defined(TCP_KEEPCNT)
+	setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+#endif
+#if defined(TCP_USER_TIMEOUT)
+	// Keepalive only probes an idle connection, this one covers a submit that never gets acked
+	unsigned int timeout = (iIdle + iInterval * cnt) * 1000;
+	setsockopt(s, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+#endif
+
+	return true;
+}
+
 inline const char* sock_strerror(char* buf, size_t len)
 {
 	buf[0] = '\0';
@@ -90,3 +191,59 @@ inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 	return gai_strerror(err);
 }
 #endif
+
+// Listening socket on every address we have, dual stack if the system lets us. Non-blocking,
+// INVALID_SOCKET with the error left for sock_strerror if it didn't work.
+inline SOCKET sock_listen(uint16_t iPort)
+{
+	SOCKET s = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+	if(s != INVALID_SOCKET)
+	{
+		int off = 0;
+		setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&off, sizeof(off));
+	}
+	else
+		s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if(s == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+#ifndef _WIN32
+	int on = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#endif
+
+	sockaddr_storage addr;
+	socklen_t addrlen;
+	memset(&addr, 0, sizeof(addr));
+
+	sockaddr_storage local;
+	socklen_t locallen = sizeof(local);
+	getsockname(s, (sockaddr*)&local, &locallen);
+	if(local.ss_family == AF_INET6)
+	{
+		sockaddr_in6* a = (sockaddr_in6*)&addr;
+		a->sin6_family = AF_INET6;
+		a->sin6_addr = in6addr_any;
+		a->sin6_port = htons(iPort);
+		addrlen = sizeof(sockaddr_in6);
+	}
+	else
+	{
+		sockaddr_in* a = (sockaddr_in*)&addr;
+		a->sin_family = AF_INET;
+		a->sin_addr.s_addr = htonl(INADDR_ANY);
+		a->sin_port = htons(iPort);
+		addrlen = sizeof(sockaddr_in);
+	}
+
+	if(bind(s, (sockaddr*)&addr, addrlen) != 0 || listen(s, 128) != 0 || !sock_set_nonblock(s))
+	{
+		int err = sock_get_errno();
+		sock_close(s);
+		sock_set_errno(err);
+		return INVALID_SOCKET;
+	}
+
+	return s;
+}
@@ -0,0 +1,278 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "stratum.h"
+#include "jpsock.h"
+#include "hexcodec.h"
+
+#include <stdlib.h>
+
+#include "rapidjson/reader.h"
+
+using namespace rapidjson;
+
+typedef GenericReader<UTF8<>, UTF8<>, MemoryPoolAllocator<>> MemReader;
+
+struct stratum_parser::opaque_private
+{
+	// The parser stack lives in the pool. We never clear it, so it keeps whatever size the
+	// deepest message needed (the pool adds a chunk if the preallocated memory runs out).
+	MemoryPoolAllocator<> parseAllocator;
+	MemReader reader;
+
+	opaque_private(uint8_t* bParseMem) :
+		parseAllocator(bParseMem, iJsonMemSize),
+		reader(&parseAllocator, iJsonMemSize / 4)
+	{
+	}
+};
+
+struct stratum_handler : public BaseReaderHandler<UTF8<>, stratum_handler>
+{
+	enum scope { sc_root, sc_error, sc_result, sc_params, sc_login_job, sc_skip };
+
+	stratum_msg& msg;
+	json_field* pField = nullptr; // Where the value of the last key goes, nullptr - we don't need it
+	scope eNextScope = sc_skip;  // Scope of the value of the last key if it is an object
+
+	static constexpr size_t iMaxScope = 4;
+	scope vScope[iMaxScope];
+	size_t iDepth = 0;
+
+	stratum_handler(stratum_msg& msg) : msg(msg) {}
+
+	inline scope current() { return iDepth <= iMaxScope ? vScope[iDepth-1] : sc_skip; }
+
+	inline void push(scope s)
+	{
+		if(iDepth < iMaxScope)
+			vScope[iDepth] = s;
+		iDepth++;
+	}
+
+	static inline bool key_is(const char* str, SizeType len, const char* key)
+	{
+		return strlen(key) == len && memcmp(str, key, len) == 0;
+	}
+
+	inline json_field* job_key(stratum_job& job, const char* str, SizeType len)
+	{
+		if(key_is(str, len, "job_id"))
+			return &job.job_id;
+		else if(key_is(str, len, "blob"))
+			return &job.blob;
+		else if(key_is(str, len, "target"))
+			return &job.target;
+		return nullptr;
+	}
+
+	bool Key(const char* str, SizeType len, bool)
+	{
+		pField = nullptr;
+		eNextScope = sc_skip;
+
+		switch(current())
+		{
+		case sc_root:
+			if(key_is(str, len, "method"))
+				pField = &msg.method;
+			else if(key_is(str, len, "id"))
+				pField = &msg.id;
+			else if(key_is(str, len, "error"))
+			{
+				pField = &msg.error;
+				eNextScope = sc_error;
+			}
+			else if(key_is(str, len, "result"))
+			{
+				pField = &msg.result;
+				eNextScope = sc_result;
+			}
+			else if(key_is(str, len, "params"))
+			{
+				pField = &msg.params;
+				eNextScope = sc_params;
+			}
+			break;
+
+		case sc_error:
+			if(key_is(str, len, "message"))
+				pField = &msg.error_msg;
+			break;
+
+		case sc_result:
+			if(key_is(str, len, "id"))
+				pField = &msg.miner_id;
+			else if(key_is(str, len, "job"))
+			{
+				pField = &msg.job;
+				eNextScope = sc_login_job;
+			}
+			break;
+
+		case sc_params:
+			pField = job_key(msg.oParams, str, len);
+			break;
+
+		case sc_login_job:
+			pField = job_key(msg.oLoginJob, str, len);
+			break;
+
+		default:
+			break;
+		}
+
+		return true;
+	}
+
+	bool String(const char* str, SizeType len, bool)
+	{
+		if(pField != nullptr)
+			pField->set(str, len);
+		pField = nullptr;
+		return true;
+	}
+
+	bool Null()
+	{
+		if(pField != nullptr)
+			pField->set(jt_null);
+		pField = nullptr;
+		return true;
+	}
+
+	bool Uint(unsigned n) { return Uint64(n); }
+
+	bool Uint64(uint64_t n)
+	{
+		if(pField != nullptr)
+			pField->set(n);
+		pField = nullptr;
+		return true;
+	}
+
+	// Bools, signed and fractional numbers
+	bool Default()
+	{
+		if(pField != nullptr)
+			pField->set(jt_other);
+		pField = nullptr;
+		return true;
+	}
+
+	bool StartObject()
+	{
+		if(iDepth == 0)
+		{
+			msg.bObject = true;
+			push(sc_root);
+			return true;
+		}
+
+		if(pField != nullptr)
+		{
+			pField->set(jt_object);
+			push(eNextScope);
+		}
+		else
+			push(sc_skip);
+
+		pField = nullptr;
+		return true;
+	}
+
+	bool StartArray()
+	{
+		Default();
+		push(sc_skip);
+		return true;
+	}
+
+	bool EndObject(SizeType) { iDepth--; return true; }
+	bool EndArray(SizeType) { iDepth--; return true; }
+};
+
+stratum_parser::stratum_parser()
+{
+	bParseMem = (uint8_t*)malloc(iJsonMemSize);
+	prv = new opaque_private(bParseMem);
+}
+
+stratum_parser::~stratum_parser()
+{
+	delete prv;
+	free(bParseMem);
+}
+
+bool stratum_parser::parse(char* line, stratum_msg& msg)
+{
+	stratum_handler handler(msg);
+	InsituStringStream ss(line);
+
+	// Iterative parsing keeps the nesting on our own stack, not the thread's
+	return !prv->reader.Parse<kParseInsituFlag | kParseIterativeFlag>(ss, handler).IsError();
+}
+
+const char* stratum_parser::decode_job(const stratum_job& job, pool_job& out)
+{
+	if (job.job_id.type != jt_string || job.blob.type != jt_string || job.target.type != jt_string)
+		return "PARSE error: Job error 2";
+
+	if (job.job_id.len >= sizeof(pool_job::sJobID)) // Note >=
+		return "PARSE error: Job error 3";
+
+	uint32_t iWorkLn = job.blob.len / 2;
+	if (iWorkLn > sizeof(pool_job::bWorkBlob))
+		return "PARSE error: Invalid job legth. Are you sure you are mining the correct coin?";
+
+	if (!hex_decode(job.blob.str, iWorkLn * 2, out.bWorkBlob))
+		return "PARSE error: Job error 4";
+
+	out.iWorkLen = iWorkLn;
+	memset(out.sJobID, 0, sizeof(pool_job::sJobID));
+	memcpy(out.sJobID, job.job_id.str, job.job_id.len); //Bounds checking at proto error 3
+
+	size_t target_slen = job.target.len;
+	if(target_slen <= 8)
+	{
+		uint32_t iTempInt = 0;
+		char sTempStr[] = "00000000"; // Little-endian CPU FTW
+		memcpy(sTempStr, job.target.str, target_slen);
+		if(!hex_decode(sTempStr, 8, (uint8_t*)&iTempInt) || iTempInt == 0)
+			return "PARSE error: Invalid target";
+
+		out.iTarget = jpsock::t32_to_t64(iTempInt);
+	}
+	else if(target_slen <= 16)
+	{
+		out.iTarget = 0;
+		char sTempStr[] = "0000000000000000";
+		memcpy(sTempStr, job.target.str, target_slen);
+		if(!hex_decode(sTempStr, 16, (uint8_t*)&out.iTarget) || out.iTarget == 0)
+			return "PARSE error: Invalid target";
+	}
+	else
+		return "PARSE error: Job error 5";
+
+	return nullptr;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "msgstruct.h"
+
+/*
+	Stratum lines are parsed in place with a SAX handler that only picks up the few values we
+	need, so no DOM is ever built. The fields point into the line and are only good as long as it is.
+
+	jpsock runs everything the pool sends through it, and the parser microbenchmark times it on its own.
+*/
+enum json_type { jt_none, jt_null, jt_string, jt_uint, jt_object, jt_other };
+
+// A value we care about. Strings point into the line, which we parse in place.
+struct json_field
+{
+	json_type type = jt_none;
+	const char* str = nullptr;
+	size_t len = 0;
+	uint64_t num = 0;
+
+	inline void set(json_type t) { type = t; }
+	inline void set(const char* s, size_t l) { type = jt_string; str = s; len = l; }
+	inline void set(uint64_t n) { type = jt_uint; num = n; }
+
+	inline bool is(const char* s) const { return type == jt_string && strlen(s) == len && memcmp(s, str, len) == 0; }
+};
+
+struct stratum_job
+{
+	json_field job_id;
+	json_field blob;
+	json_field target;
+};
+
+/*
+ * Everything we use from the three messages the pool sends us:
+ * {"method":"job","params":{"job_id":..,"blob":..,"target":..}}
+ * {"id":..,"error":null,"result":{"id":..,"job":{"job_id":..,"blob":..,"target":..}}} - login
+ * {"id":..,"error":{"message":..},"result":..} - submit
+ */
+struct stratum_msg
+{
+	bool bObject = false;
+	json_field method;
+	json_field id;
+	json_field error;
+	json_field error_msg;
+	json_field result;
+	json_field params;
+	json_field miner_id;
+	json_field job;
+
+	stratum_job oParams;
+	stratum_job oLoginJob;
+};
+
+class stratum_parser
+{
+public:
+	stratum_parser();
+	~stratum_parser();
+
+	// line is NUL terminated and gets changed, false if it isn't JSON at all
+	bool parse(char* line, stratum_msg& msg);
+
+	// Id, blob and target of a job. nullptr if the job is good, otherwise what is wrong with it.
+	static const char* decode_job(const stratum_job& job, pool_job& out);
+
+private:
+	// The parser stack starts small and grows to fit the largest message we see
+	static constexpr size_t iJsonMemSize = 4096;
+
+	struct opaque_private;
+	opaque_private* prv;
+	uint8_t* bParseMem;
+};
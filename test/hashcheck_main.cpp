@@ -0,0 +1,66 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  */
+
+/*
+ * Standalone hash check for "make check" - the known answers and the differential test that
+ * "self_test" runs, without a config file or large pages.
+ *
+ * Usage: hashcheck [ROUNDS] [SEED], 20 rounds and a clock seed by default. Exits non-zero if
+ * any kernel gets a hash wrong.
+ */
+
+#include <stdlib.h>
+#include <chrono>
+
+#include "../hashcheck.h"
+#include "../console.h"
+#include "../cpu_features.h"
+
+int main(int argc, char *argv[])
+{
+	size_t iRounds = 20;
+	uint64_t iSeed = 0;
+	if(!hashcheck::parse_args(argc - 1, argv + 1, iRounds, iSeed))
+	{
+		printer::inst()->print_msg(L0, "Usage: %s [ROUNDS] [SEED]", argv[0]);
+		return 1;
+	}
+
+	if(iSeed == 0)
+		iSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+
+	alloc_msg msg = { 0 };
+	cryptonight_ctx* ctx[2];
+	if((ctx[0] = cryptonight_alloc_ctx(0, 0, &msg)) == nullptr || (ctx[1] = cryptonight_alloc_ctx(0, 0, &msg)) == nullptr)
+	{
+		printer::inst()->print_msg(L0, "MEMORY ALLOC FAILED: %s", msg.warning);
+		return 1;
+	}
+
+	bool bHaveAes = cpu_has_aes();
+	if(!bHaveAes)
+		printer::inst()->print_msg(L0, "No hardware AES, only the soft AES kernels are checked.");
+
+	bool bResult = hashcheck::known_answers(ctx, bHaveAes);
+	if(bResult && iRounds > 0)
+		bResult = hashcheck::differential(ctx, bHaveAes, iRounds, iSeed);
+
+	cryptonight_free_ctx(ctx[0]);
+	cryptonight_free_ctx(ctx[1]);
+
+	printer::inst()->print_msg(L0, bResult ? "Hash check passed, all kernels agree." : "Hash check FAILED.");
+	return bResult ? 0 : 1;
+}
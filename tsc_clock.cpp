@@ -0,0 +1,116 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "tsc_clock.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+bool tsc_clock::bInvariant = false;
+uint64_t tsc_clock::iStartTicks = 0;
+uint64_t tsc_clock::iStartUs = 0;
+uint64_t tsc_clock::iBaseTicks = 0;
+double tsc_clock::fBaseMs = 0.0;
+double tsc_clock::fTicksPerMs = 1000.0;
+
+uint64_t tsc_clock::steady_us()
+{
+	using namespace std::chrono;
+	return time_point_cast<microseconds>(steady_clock::now()).time_since_epoch().count();
+}
+
+static bool have_invariant_tsc()
+{
+	constexpr int INVARIANT_TSC_BIT = 1 << 8;
+
+	int cpu_info[4];
+#ifdef _WIN32
+	__cpuid(cpu_info, 0x80000000);
+#else
+	__cpuid(0x80000000, cpu_info[0], cpu_info[1], cpu_info[2], cpu_info[3]);
+#endif
+
+	if((uint32_t)cpu_info[0] < 0x80000007)
+		return false;
+
+#ifdef _WIN32
+	__cpuid(cpu_info, 0x80000007);
+#else
+	__cpuid(0x80000007, cpu_info[0], cpu_info[1], cpu_info[2], cpu_info[3]);
+#endif
+
+	return (cpu_info[3] & INVARIANT_TSC_BIT) != 0;
+}
+
+void tsc_clock::init()
+{
+	using namespace std::chrono;
+
+	bInvariant = have_invariant_tsc();
+	fBaseMs = (double)time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
+
+	if(!bInvariant)
+	{
+		iStartTicks = iBaseTicks = iStartUs = steady_us();
+		fTicksPerMs = 1000.0;
+		return;
+	}
+
+	// A rough rate to start with, calibrate() takes it from here
+	iStartUs = steady_us();
+	iStartTicks = iBaseTicks = __rdtsc();
+	std::this_thread::sleep_for(milliseconds(20));
+	calibrate();
+}
+
+void tsc_clock::calibrate()
+{
+	if(!bInvariant)
+		return;
+
+	uint64_t iUs = steady_us();
+	uint64_t iTicks = __rdtsc();
+	if(iUs <= iStartUs || iTicks <= iStartTicks)
+		return;
+
+	double fRate = (iTicks - iStartTicks) / ((iUs - iStartUs) / 1000.0);
+
+	// New segment starts where the old one ends, we don't have a rate for the very first one yet
+	if(iBaseTicks == iStartTicks)
+		fBaseMs += (iUs - iStartUs) / 1000.0;
+	else
+		fBaseMs += (int64_t)(iTicks - iBaseTicks) / fTicksPerMs;
+	iBaseTicks = iTicks;
+	fTicksPerMs = fRate;
+}
+
+uint64_t tsc_clock::to_ms(uint64_t iTicks)
+{
+	return uint64_t(fBaseMs + (int64_t)(iTicks - iBaseTicks) / fTicksPerMs);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+/*
+	Time stamps for the hash loop. On CPUs with an invariant TSC (constant rate, keeps ticking in
+	sleep states) reading the clock is a single rdtsc, the conversion to milliseconds happens later
+	on whoever reads the stamps. Anything else falls back to the steady clock in microseconds.
+
+	The tick rate is measured against the steady clock when we start, and refined by calibrate()
+	over a longer and longer baseline. Each refinement starts a new segment from where the old one
+	ended, so converted times never jump.
+
+	calibrate() and to_ms() are meant for one thread (the executor), now() is for everybody.
+*/
+class tsc_clock
+{
+public:
+	// Before anybody calls now()
+	static void init();
+	static void calibrate();
+
+	static inline uint64_t now() { return bInvariant ? __rdtsc() : steady_us(); }
+
+	// ms since the epoch, on the same scale as high_resolution_clock
+	static uint64_t to_ms(uint64_t iTicks);
+	static inline uint64_t now_ms() { return to_ms(now()); }
+
+	static inline bool is_invariant() { return bInvariant; }
+	static inline double ticks_per_ms() { return fTicksPerMs; }
+
+private:
+	static uint64_t steady_us();
+
+	static bool bInvariant;
+
+	// Where we started, for the rate
+	static uint64_t iStartTicks;
+	static uint64_t iStartUs;
+
+	// Start of the current segment
+	static uint64_t iBaseTicks;
+	static double fBaseMs;
+	static double fTicksPerMs;
+};
@@ -122,16 +122,49 @@ extern const char sHtmlHashrateTableRow [] =
 
 extern const char sHtmlHashrateBodyLow [] =
 		"<tr><th>Totals:</th><td>%s</td><td>%s</td><td>%s</td></tr>"
+		"<tr><th>1h / 24h:</th><td>%s</td><td>%s</td><td></td></tr>"
 		"<tr><th>Highest:</th><td>%s</td><td colspan='2'></td></tr>"
 	"</table>"
-	"</div></div></body></html>";
+	"</div>";
+
+extern const char sHtmlHashrateFooter [] =
+	"</div></body></html>";
+
+extern const char sHtmlProfileBodyHigh [] =
+	"<h4>Kernel profile, TSC cycles per hash (1 in %u hashes)</h4>"
+	"<div class=data>"
+	"<table>"
+		"<tr><th>Thread ID</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th></tr>";
+
+extern const char sHtmlProfileTableRow [] =
+	"<tr><th>%u</th><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td></tr>";
+
+extern const char sHtmlCountersBodyHigh [] =
+	"<h4>Hardware counters (last %u s)</h4>"
+	"<div class=data>"
+	"<table>"
+		"<tr><th>Thread ID</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th></tr>";
+
+extern const char sHtmlCountersTableRow [] =
+	"<tr><th>%u</th><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td></tr>";
+
+extern const char sHtmlCountersBodyLow [] =
+	"</table>"
+	"</div>";
+
+extern const char sHtmlProfileBodyLow [] =
+		"<tr><th>Share:</th><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td></tr>"
+	"</table>"
+	"</div>";
 
 extern const char sHtmlConnectionBodyHigh [] =
 	"<div class=data>"
 	"<table>"
 		"<tr><th>Pool address</th><td>%s</td></tr>"
+		"<tr><th>Standby pool</th><td>%s</td></tr>"
 		"<tr><th>Connected since</th><td>%s</td></tr>"
-		"<tr><th>Pool ping time</th><td>%u ms</td></tr>"
+		"<tr><th>Pool ping time</th><td>%u ms (p90 %u ms, p99 %u ms)</td></tr>"
+		"<tr><th>Proxy miners</th><td>%s</td></tr>"
 	"</table>"
 	"<h4>Network error log</h4>"
 	"<table>"
@@ -147,7 +180,10 @@ extern const char sHtmlResultBodyHigh [] =
 	"<div class=data>"
 	"<table>"
 		"<tr><th>Difficulty</th><td>%u</td></tr>"
+		"<tr><th>Share difficulty</th><td>%llu</td></tr>"
 		"<tr><th>Good results</th><td>%u / %u (%.1f %%)</td></tr>"
+		"<tr><th>Stale, not sent</th><td>%llu</td></tr>"
+		"<tr><th>Rate limited</th><td>%llu</td></tr>"
 		"<tr><th>Avg result time</th><td>%.1f sec</td></tr>"
 		"<tr><th>Pool-side hashes</th><td>%u</td></tr>"
 	"</table>"
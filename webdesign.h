@@ -9,6 +9,15 @@ extern const char sHtmlCommonHeader[];
 extern const char sHtmlHashrateBodyHigh[];
 extern const char sHtmlHashrateTableRow[];
 extern const char sHtmlHashrateBodyLow[];
+extern const char sHtmlHashrateFooter[];
+
+extern const char sHtmlProfileBodyHigh[];
+extern const char sHtmlProfileTableRow[];
+extern const char sHtmlProfileBodyLow[];
+
+extern const char sHtmlCountersBodyHigh[];
+extern const char sHtmlCountersTableRow[];
+extern const char sHtmlCountersBodyLow[];
 
 extern const char sHtmlConnectionBodyHigh[];
 extern const char sHtmlConnectionTableRow[];